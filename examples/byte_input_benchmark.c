@@ -0,0 +1,131 @@
+#include "../include/dataset.h"
+#include "../include/network.h"
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// MNIST-shaped uint8 samples and the MNIST example's network
+#define FEATURES 784
+#define HIDDEN 128
+#define CLASSES 10
+#define SAMPLES 8192
+#define BATCH 64
+#define EPOCHS 3
+#define LEARNING_RATE 0.01f
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Network *build_network() {
+  // Same seed so both paths start from the same weights
+  srand(42);
+  Network *n = create_network();
+  add_layer(n, layer_create_dense(FEATURES, HIDDEN));
+  add_layer(n, layer_create_relu());
+  add_layer(n, layer_create_dense(HIDDEN, CLASSES));
+  add_layer(n, layer_create_sigmoid());
+  optimize_network(n, 0);
+  return n;
+}
+
+// Sparse strokes like handwritten digits, about a quarter of pixels set
+static Dataset *make_dataset() {
+  Dataset *d = calloc(1, sizeof(Dataset));
+  if (d == NULL) {
+    return NULL;
+  }
+  d->count = SAMPLES;
+  d->features = FEATURES;
+  d->target_size = CLASSES;
+  d->type = DATASET_UINT8;
+  d->scale = 1.0f / 255.0f;
+  d->inputs = malloc((size_t)SAMPLES * FEATURES);
+  d->labels = malloc(sizeof(int32_t) * SAMPLES);
+  if (d->inputs == NULL || d->labels == NULL) {
+    free_dataset(d);
+    return NULL;
+  }
+  uint8_t *pixels = d->inputs;
+  for (size_t i = 0; i < (size_t)SAMPLES * FEATURES; i++) {
+    pixels[i] = (uint8_t)(rand() % 4 == 0 ? rand() % 256 : 0);
+  }
+  for (int i = 0; i < SAMPLES; i++) {
+    d->labels[i] = rand() % CLASSES;
+  }
+  return d;
+}
+
+// Epochs of shuffled batches. bytes selects the uint8 path, otherwise the
+// batch is decoded to floats first. Returns the seconds taken.
+static double run(Dataset *d, Network *n, int bytes) {
+  DatasetIterator *it = create_dataset_iterator(d, BATCH, 1, 7);
+  Matrix *x = create_matrix(FEATURES, BATCH);
+  Matrix *y = create_matrix(CLASSES, BATCH);
+  ByteMatrix *x8 = create_byte_matrix(FEATURES, BATCH, 0.0f, 0.0f);
+  double start = now_seconds();
+  for (int epoch = 0; epoch < EPOCHS && it != NULL; epoch++) {
+    for (int first = 0; first + BATCH <= d->count; first += BATCH) {
+      const int *indices = it->order + first;
+      if (bytes) {
+        dataset_gather_bytes(d, indices, BATCH, x8, y);
+        train_network_bytes(n, x8, y, LEARNING_RATE);
+      } else {
+        dataset_gather(d, indices, BATCH, x, y);
+        train_network(n, x, y, LEARNING_RATE);
+      }
+    }
+    dataset_iterator_reset(it);
+  }
+  double elapsed = now_seconds() - start;
+  free_byte_matrix(x8);
+  free_matrix(x);
+  free_matrix(y);
+  free_dataset_iterator(it);
+  return elapsed;
+}
+
+// Trains the same network on the same batches twice: once with every batch
+// expanded to float before the first layer, once with the first layer
+// reading the bytes and scaling them inside its matrix multiply.
+int main() {
+  srand(1);
+  Dataset *d = make_dataset();
+  if (d == NULL) {
+    return -1;
+  }
+  Network *float_net = build_network();
+  Network *byte_net = build_network();
+
+  double float_s = run(d, float_net, 0);
+  double byte_s = run(d, byte_net, 1);
+
+  float drift = 0.0f;
+  Matrix *wf = float_net->layers[0]->weights;
+  Matrix *wb = byte_net->layers[0]->weights;
+  for (int i = 0; i < wf->rows * wf->columns; i++) {
+    drift = fmaxf(drift, fabsf(wf->data[i] - wb->data[i]));
+  }
+
+  double steps = (double)EPOCHS * (SAMPLES / BATCH);
+  printf("%d samples: %.1f MB as uint8, %.1f MB as float\n", SAMPLES,
+         (double)SAMPLES * FEATURES / 1e6,
+         (double)SAMPLES * FEATURES * sizeof(float) / 1e6);
+  printf("%d steps of batch %d, first layer %d -> %d\n", (int)steps, BATCH,
+         FEATURES, HIDDEN);
+  printf("%-6s | batch KB | ms/step\n", "input");
+  printf("%-6s | %8.0f | %7.3f\n", "float",
+         sizeof(float) * FEATURES * BATCH / 1024.0, float_s * 1e3 / steps);
+  printf("%-6s | %8.0f | %7.3f\n", "uint8", FEATURES * BATCH / 1024.0,
+         byte_s * 1e3 / steps);
+  printf("Largest first layer weight difference: %g\n", drift);
+
+  free_network(float_net);
+  free_network(byte_net);
+  free_dataset(d);
+  return 0;
+}
@@ -0,0 +1,98 @@
+#include "../include/csv.h"
+#include "../include/scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// MNIST-shaped: a label and 784 pixels per line
+#define LINES 20000
+#define FIELDS 785
+#define PATH "csv_benchmark.csv"
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static long write_file() {
+  FILE *f = fopen(PATH, "w");
+  if (f == NULL) {
+    return -1;
+  }
+  srand(1);
+  for (int l = 0; l < LINES; l++) {
+    for (int c = 0; c < FIELDS; c++) {
+      // Mostly zeros like real digits, some ink
+      int v = c == 0 ? rand() % 10 : (rand() % 4 == 0 ? rand() % 256 : 0);
+      fprintf(f, "%d%c", v, c + 1 < FIELDS ? ',' : '\n');
+    }
+  }
+  fclose(f);
+  struct stat st;
+  return stat(PATH, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// The old way: fgets, strtok and atof per line
+static double baseline(Matrix *out) {
+  FILE *f = fopen(PATH, "r");
+  char line[8192];
+  double start = now_seconds();
+  for (int l = 0; l < LINES && fgets(line, sizeof(line), f) != NULL; l++) {
+    float *row = out->data + (size_t)l * FIELDS;
+    int c = 0;
+    for (char *tok = strtok(line, ","); tok != NULL && c < FIELDS;
+         tok = strtok(NULL, ",")) {
+      row[c++] = atof(tok);
+    }
+  }
+  double elapsed = now_seconds() - start;
+  fclose(f);
+  return elapsed;
+}
+
+// Usage: csv_benchmark [max_threads], defaults to the core count
+int main(int argc, char **argv) {
+  long bytes = write_file();
+  if (bytes < 0) {
+    fprintf(stderr, "Error: could not write %s\n", PATH);
+    return -1;
+  }
+  int max_threads = argc > 1 ? atoi(argv[1])
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  Matrix *out = create_matrix(LINES, FIELDS);
+  double mb = bytes / 1e6;
+  printf("%d x %d CSV, %.1f MB\n", LINES, FIELDS, mb);
+  printf("strtok + atof : %7.1f MB/s\n", mb / baseline(out));
+
+  printf("threads | MB/s | MB/s per thread\n");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    scheduler_init(threads);
+    // Warm the page cache and the pool
+    csv_parse_file(PATH, NULL, out);
+    double start = now_seconds();
+    int rows = csv_parse_file(PATH, NULL, out);
+    double elapsed = now_seconds() - start;
+    if (rows != LINES) {
+      fprintf(stderr, "Error: parsed %d rows\n", rows);
+      break;
+    }
+    printf("%7d | %6.1f | %6.1f\n", threads, mb / elapsed,
+           mb / elapsed / threads);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+
+  free_matrix(out);
+  scheduler_shutdown();
+  remove(PATH);
+  return 0;
+}
@@ -0,0 +1,97 @@
+#include "../include/trainer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FEATURES 784
+#define HIDDEN 128
+#define CLASSES 10
+#define BATCH 256
+#define STEPS 40
+#define LEARNING_RATE 0.001f
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Network *build_network() {
+  // Same seed so every run starts from the same weights
+  srand(42);
+  Network *n = create_network();
+  add_layer(n, layer_create_dense(FEATURES, HIDDEN));
+  add_layer(n, layer_create_relu());
+  add_layer(n, layer_create_dense(HIDDEN, CLASSES));
+  add_layer(n, layer_create_sigmoid());
+  return n;
+}
+
+// Trains a fresh 784-128-10 MLP for STEPS batches and returns samples/sec
+static double run(Matrix *inputs, Matrix *targets, int threads,
+                  float *final_loss) {
+  Network *n = build_network();
+  DataParallelTrainer *t = create_data_parallel_trainer(n, threads);
+  if (t == NULL) {
+    free_network(n);
+    return 0.0;
+  }
+
+  // Warm up thread start and the allocator
+  train_data_parallel(t, inputs, targets, 0.0f);
+
+  double start = now_seconds();
+  float loss = 0.0f;
+  for (int s = 0; s < STEPS; s++) {
+    loss = train_data_parallel(t, inputs, targets, LEARNING_RATE);
+  }
+  double elapsed = now_seconds() - start;
+
+  *final_loss = loss / BATCH;
+  free_data_parallel_trainer(t);
+  free_network(n);
+  return (double)STEPS * BATCH / elapsed;
+}
+
+// Usage: data_parallel_benchmark [max_threads], defaults to the core count
+int main(int argc, char **argv) {
+  Matrix *inputs = create_matrix(FEATURES, BATCH);
+  Matrix *targets = create_matrix(CLASSES, BATCH);
+  zero_matrix(targets);
+  for (int i = 0; i < FEATURES * BATCH; i++) {
+    inputs->data[i] = (float)rand() / (float)RAND_MAX;
+  }
+  for (int b = 0; b < BATCH; b++) {
+    targets->data[(rand() % CLASSES) * BATCH + b] = 1.0f;
+  }
+
+  int max_threads = argc > 1 ? atoi(argv[1])
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  printf("MLP %d-%d-%d, batch %d, %d steps\n", FEATURES, HIDDEN, CLASSES,
+         BATCH, STEPS);
+  printf("threads | samples/s | speedup | efficiency | loss\n");
+
+  double base = 0.0;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    float loss = 0.0f;
+    double rate = run(inputs, targets, threads, &loss);
+    if (threads == 1) {
+      base = rate;
+    }
+    double speedup = base > 0.0 ? rate / base : 0.0;
+    printf("%7d | %9.0f | %6.2fx | %9.0f%% | %f\n", threads, rate, speedup,
+           100.0 * speedup / threads, loss);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+
+  free_matrix(inputs);
+  free_matrix(targets);
+  return 0;
+}
@@ -0,0 +1,152 @@
+#include "../include/scheduler.h"
+#include "../include/trainer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FEATURES 784
+#define HIDDEN 128
+#define CLASSES 10
+#define BATCH 256
+#define STEPS 40
+#define LEARNING_RATE 0.001f
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Network *build_network() {
+  // Same seed so every run starts from the same weights
+  srand(42);
+  Network *n = create_network();
+  add_layer(n, layer_create_dense(FEATURES, HIDDEN));
+  add_layer(n, layer_create_relu());
+  add_layer(n, layer_create_dense(HIDDEN, CLASSES));
+  add_layer(n, layer_create_sigmoid());
+  return n;
+}
+
+// Weights of both Dense layers, flattened
+static float *copy_weights(Network *n, int *count) {
+  *count = 0;
+  for (int i = 0; i < n->layer_count; i++) {
+    if (n->layers[i]->weights != NULL) {
+      *count += n->layers[i]->weights->rows * n->layers[i]->weights->columns;
+    }
+  }
+  float *out = malloc(sizeof(float) * *count);
+  int offset = 0;
+  for (int i = 0; i < n->layer_count; i++) {
+    Matrix *w = n->layers[i]->weights;
+    if (w != NULL) {
+      memcpy(out + offset, w->data, sizeof(float) * w->rows * w->columns);
+      offset += w->rows * w->columns;
+    }
+  }
+  return out;
+}
+
+// Trains a fresh MLP for STEPS batches in the given mode. Returns samples/sec
+// and hands back the final weights.
+static double run(Matrix *inputs, Matrix *targets, int threads,
+                  int deterministic, float **weights, int *count) {
+  scheduler_set_deterministic(deterministic);
+  Network *n = build_network();
+  DataParallelTrainer *t = create_data_parallel_trainer(n, threads);
+  if (t == NULL) {
+    free_network(n);
+    return 0.0;
+  }
+
+  // Warm up thread start and the allocator
+  train_data_parallel(t, inputs, targets, 0.0f);
+
+  double start = now_seconds();
+  for (int s = 0; s < STEPS; s++) {
+    train_data_parallel(t, inputs, targets, LEARNING_RATE);
+  }
+  double elapsed = now_seconds() - start;
+
+  *weights = copy_weights(n, count);
+  free_data_parallel_trainer(t);
+  free_network(n);
+  scheduler_set_deterministic(0);
+  return (double)STEPS * BATCH / elapsed;
+}
+
+static float max_difference(const float *a, const float *b, int count) {
+  float diff = 0.0f;
+  for (int i = 0; i < count; i++) {
+    float d = fabsf(a[i] - b[i]);
+    if (d > diff) {
+      diff = d;
+    }
+  }
+  return diff;
+}
+
+// Usage: deterministic_benchmark [max_threads], defaults to the core count.
+// Compares fast and deterministic data-parallel training: throughput, and
+// how far the final weights drift from the single-threaded run of each mode.
+int main(int argc, char **argv) {
+  Matrix *inputs = create_matrix(FEATURES, BATCH);
+  Matrix *targets = create_matrix(CLASSES, BATCH);
+  zero_matrix(targets);
+  for (int i = 0; i < FEATURES * BATCH; i++) {
+    inputs->data[i] = (float)rand() / (float)RAND_MAX;
+  }
+  for (int b = 0; b < BATCH; b++) {
+    targets->data[(rand() % CLASSES) * BATCH + b] = 1.0f;
+  }
+
+  int max_threads = argc > 1 ? atoi(argv[1])
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  printf("MLP %d-%d-%d, batch %d, %d steps, %d deterministic shards\n",
+         FEATURES, HIDDEN, CLASSES, BATCH, STEPS,
+         TRAINER_DETERMINISTIC_SHARDS);
+  printf("threads | fast samples/s | det samples/s | overhead | "
+         "fast drift | det drift\n");
+
+  float *fast_base = NULL;
+  float *det_base = NULL;
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    float *fast_weights;
+    float *det_weights;
+    int count;
+    double fast = run(inputs, targets, threads, 0, &fast_weights, &count);
+    double det = run(inputs, targets, threads, 1, &det_weights, &count);
+    if (threads == 1) {
+      fast_base = fast_weights;
+      det_base = det_weights;
+    }
+
+    // Drift: largest weight difference to the 1-thread run of the same mode
+    printf("%7d | %14.0f | %13.0f | %7.1f%% | %10.3g | %9.3g\n", threads,
+           fast, det, fast > 0.0 ? 100.0 * (fast / det - 1.0) : 0.0,
+           max_difference(fast_weights, fast_base, count),
+           max_difference(det_weights, det_base, count));
+
+    if (threads > 1) {
+      free(fast_weights);
+      free(det_weights);
+    }
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+
+  free(fast_base);
+  free(det_base);
+  free_matrix(inputs);
+  free_matrix(targets);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include "../include/graph.h"
+#include <stdio.h>
+
+#define LEARNING_RATE 0.05f
+#define EPOCHS 500
+
+// Residual block plus a concat skip:
+//
+//   x -> dense -> relu -> (+ x) -> concat(x, .) -> dense -> out
+int main() {
+  Graph *graph = create_graph();
+  if (graph == NULL) {
+    return -1;
+  }
+
+  graph_add_input(graph, "x");
+  graph_add_layer(graph, "hidden", layer_create_dense(2, 2), "x");
+  graph_add_layer(graph, "act", layer_create_relu(), "hidden");
+
+  const char *residual_inputs[] = {"x", "act"};
+  graph_add_sum(graph, "residual", residual_inputs, 2);
+
+  const char *concat_inputs[] = {"x", "residual"};
+  graph_add_concat(graph, "features", concat_inputs, 2);
+
+  graph_add_layer(graph, "out", layer_create_dense(4, 1), "features");
+  graph_set_output(graph, "out");
+
+  if (graph_compile(graph) != 0) {
+    free_graph(graph);
+    return -1;
+  }
+
+  Matrix *inputs = create_matrix(2, 1);
+  Matrix *targets = create_matrix(1, 1);
+
+  // Learns y = a + 2b
+  for (int i = 0; i < EPOCHS; i += 1) {
+    float epoch_error = 0.0f;
+
+    for (int j = 0; j < 10; j += 1) {
+      inputs->data[0] = j / 10.0f;
+      inputs->data[1] = ((j * 7) % 10) / 20.0f;
+      targets->data[0] = inputs->data[0] + 2.0f * inputs->data[1];
+
+      Matrix *pred = predict_graph(graph, inputs);
+      float error = pred->data[0] - targets->data[0];
+      epoch_error += error * error;
+      free_matrix(pred);
+
+      train_graph(graph, inputs, targets, LEARNING_RATE);
+    }
+
+    if (i % 100 == 0) {
+      printf("EPOCH %d | MSE: %f\n", i, epoch_error / 10.0f);
+    }
+  }
+
+  inputs->data[0] = 0.3f;
+  inputs->data[1] = 0.25f;
+  Matrix *output = predict_graph(graph, inputs);
+  printf("\nInput: (0.30, 0.25), Output: %f (Expected: 0.80)\n\n",
+         output->data[0]);
+
+  print_graph_info(graph);
+
+  free_matrix(output);
+  free_graph(graph);
+  free_matrix(inputs);
+  free_matrix(targets);
+
+  return 0;
+}
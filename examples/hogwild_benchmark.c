@@ -0,0 +1,132 @@
+#include "../include/trainer.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FEATURES 2000
+#define ACTIVE 20 // nonzero features per sample
+#define HIDDEN 16
+#define SAMPLES 4096
+#define BATCH 8
+#define EPOCHS 3
+#define LEARNING_RATE 0.05f
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Network *build_network() {
+  // Same seed so both paths start from the same weights
+  srand(42);
+  Network *n = create_network();
+  add_layer(n, layer_create_dense(FEATURES, HIDDEN));
+  add_layer(n, layer_create_relu());
+  add_layer(n, layer_create_dense(HIDDEN, 1));
+  add_layer(n, layer_create_sigmoid());
+  return n;
+}
+
+static float mse(Network *n, Matrix *inputs, Matrix *targets) {
+  Matrix *pred = predict_network(n, inputs);
+  float sum = 0.0f;
+  for (int i = 0; i < SAMPLES; i++) {
+    float d = pred->data[i] - targets->data[i];
+    sum += d * d;
+  }
+  free_matrix(pred);
+  return sum / SAMPLES;
+}
+
+// Synchronous path: every mini-batch is one data-parallel step
+static float train_sync(Network *n, DataParallelTrainer *t, Matrix *inputs,
+                        Matrix *targets) {
+  Matrix *x = create_matrix(FEATURES, BATCH);
+  Matrix *y = create_matrix(1, BATCH);
+  float loss = 0.0f;
+  for (int first = 0; first < SAMPLES; first += BATCH) {
+    for (int r = 0; r < FEATURES; r++) {
+      for (int b = 0; b < BATCH; b++) {
+        x->data[r * BATCH + b] = inputs->data[r * SAMPLES + first + b];
+      }
+    }
+    for (int b = 0; b < BATCH; b++) {
+      y->data[b] = targets->data[first + b];
+    }
+    loss += train_data_parallel(t, x, y, LEARNING_RATE);
+  }
+  free_matrix(x);
+  free_matrix(y);
+  return loss;
+}
+
+static void run(const char *mode, int threads, Matrix *inputs,
+                Matrix *targets) {
+  Network *n = build_network();
+  DataParallelTrainer *t = NULL;
+  if (mode[0] == 's') {
+    t = create_data_parallel_trainer(n, threads);
+  }
+
+  double start = now_seconds();
+  for (int e = 0; e < EPOCHS; e++) {
+    if (t != NULL) {
+      train_sync(n, t, inputs, targets);
+    } else {
+      train_hogwild(n, inputs, targets, threads, BATCH, LEARNING_RATE);
+    }
+  }
+  double elapsed = now_seconds() - start;
+
+  printf("%-8s | %7d | %9.0f | %f\n", mode, threads,
+         (double)EPOCHS * SAMPLES / elapsed, mse(n, inputs, targets));
+
+  free_data_parallel_trainer(t);
+  free_network(n);
+}
+
+// Sparse binary inputs, target is a thresholded random linear function
+// Usage: hogwild_benchmark [max_threads], defaults to the core count
+int main(int argc, char **argv) {
+  Matrix *inputs = create_matrix(FEATURES, SAMPLES);
+  Matrix *targets = create_matrix(1, SAMPLES);
+  float *truth = malloc(sizeof(float) * FEATURES);
+  zero_matrix(inputs);
+  for (int f = 0; f < FEATURES; f++) {
+    truth[f] = (float)rand() / (float)RAND_MAX * 2.0f - 1.0f;
+  }
+  for (int s = 0; s < SAMPLES; s++) {
+    float dot = 0.0f;
+    for (int a = 0; a < ACTIVE; a++) {
+      int f = rand() % FEATURES;
+      inputs->data[f * SAMPLES + s] = 1.0f;
+      dot += truth[f];
+    }
+    targets->data[s] = dot > 0.0f ? 1.0f : 0.0f;
+  }
+  free(truth);
+
+  int max_threads = argc > 1 ? atoi(argv[1])
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+
+  printf("Sparse %d-%d-1 MLP, %d samples, batch %d, %d epochs\n", FEATURES,
+         HIDDEN, SAMPLES, BATCH, EPOCHS);
+  printf("mode     | threads | samples/s | final MSE\n");
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    run("sync", threads, inputs, targets);
+    run("hogwild", threads, inputs, targets);
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+
+  free_matrix(inputs);
+  free_matrix(targets);
+  return 0;
+}
@@ -1,9 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>
 #include <time.h>
 
+#include "../../include/dataset.h"
 #include "../../include/network.h"
+#include "../../include/staging.h"
 
 #define INPUT_SIZE 784 
 #define HIDDEN_SIZE 128 
@@ -13,35 +14,52 @@
 #define TRAIN_SAMPLES 5000
 #define TEST_SAMPLES 1000
 #define EPOCHS 10
+#define BATCH_SIZE 16
+// Batches gathered ahead of the one being trained on
+#define STAGING_DEPTH 4
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-int parse_csv_line(FILE *file, Matrix *input, Matrix *target) {
-  char line[5000];
-
-  if (fgets(line, sizeof(line), file) == NULL) {
-    return -1;
+// Loads a whole MNIST CSV (label, then 784 pixels per line) scaled to
+// [0, 1]. The first run parses the CSV and writes a uint8 cache next to it,
+// later runs just map the cache until the CSV changes. Some copies of the
+// data start with a header line.
+static Dataset *load_mnist(const char *csv_path, const char *cache_path) {
+  double start = now_seconds();
+  Dataset *cached = dataset_load_source(cache_path, csv_path);
+  if (cached != NULL) {
+    printf("Mapped %s (%d samples) in %.3f ms\n", cache_path, cached->count,
+           (now_seconds() - start) * 1e3);
+    return cached;
   }
 
-  if (strlen(line) <= 1) {
-    return -1;
+  FILE *file = fopen(csv_path, "r");
+  if (file == NULL) {
+    fprintf(stderr, "Error: Could not open %s\n", csv_path);
+    fprintf(stderr, "Make sure you run this from the examples/mnist directory\n");
+    return NULL;
   }
-
-  char *token = strtok(line, ",");
-  if (token == NULL)
-    return -1;
-
-  int label = atoi(token);
-
-  for (int i = 0; i < OUTPUT_SIZE; i++) {
-    target->data[i] = (i == label) ? 1.0f : 0.0f;
+  int first = fgetc(file);
+  fclose(file);
+
+  CsvOptions options = {',', first != EOF && (first < '0' || first > '9')};
+  Dataset *d = dataset_from_csv(csv_path, &options, 0, OUTPUT_SIZE,
+                                1.0f / 255.0f);
+  if (d == NULL) {
+    return NULL;
   }
-
-  int pixel_idx = 0;
-  while ((token = strtok(NULL, ",")) != NULL && pixel_idx < INPUT_SIZE) {
-    input->data[pixel_idx] = atof(token) / 255.0f;
-    pixel_idx++;
+  printf("Parsed %s (%d samples) in %.3f s\n", csv_path, d->count,
+         now_seconds() - start);
+  // Pixels were bytes to begin with, so uint8 with scale 1/255 is lossless
+  if (dataset_save_source(d, cache_path, DATASET_UINT8, 1.0f / 255.0f,
+                          0.0f, csv_path) == 0) {
+    printf("Wrote %s\n", cache_path);
   }
-
-  return label;
+  return d;
 }
 
 int main() {
@@ -77,11 +95,28 @@ int main() {
   add_layer(network, dense2);
   add_layer(network, sigmoid2);
 
-  Matrix *input = create_matrix(INPUT_SIZE, 1);
-  Matrix *target = create_matrix(OUTPUT_SIZE, 1);
+  // Each file is read and parsed at most once, not once per epoch
+  Dataset *train = load_mnist("mnist_train.csv", "mnist_train.cache");
+  Dataset *test = load_mnist("mnist_test.csv", "mnist_test.cache");
+  if (train == NULL || test == NULL) {
+    free_dataset(train);
+    free_dataset(test);
+    free_network(network);
+    return -1;
+  }
+  // Storage is sample by sample, so the first N samples are a prefix
+  if (train->count > TRAIN_SAMPLES) {
+    train->count = TRAIN_SAMPLES;
+  }
+  if (test->count > TEST_SAMPLES) {
+    test->count = TEST_SAMPLES;
+  }
 
-  if (input == NULL || target == NULL) {
-    fprintf(stderr, "Failed to create input/target matrices\n");
+  DatasetIterator *batches =
+      create_dataset_iterator(train, BATCH_SIZE, 1, (unsigned int)rand());
+  if (batches == NULL) {
+    free_dataset(train);
+    free_dataset(test);
     free_network(network);
     return -1;
   }
@@ -89,91 +124,94 @@ int main() {
   printf("--- Training Phase ---\n");
 
   for (int epoch = 0; epoch < EPOCHS; epoch++) {
-    FILE *train_file = fopen("mnist_train.csv", "r");
-    if (train_file == NULL) {
-      fprintf(stderr, "Error: Could not open mnist_train.csv\n");
-      fprintf(stderr,
-              "Make sure you run this from the examples/mnist directory\n");
-      free_matrix(input);
-      free_matrix(target);
-      free_network(network);
-      return -1;
-    }
-
     int correct = 0;
     float total_loss = 0.0f;
 
-    for (int sample = 0; sample < TRAIN_SAMPLES; sample++) {
-      int label = parse_csv_line(train_file, input, target);
-      if (label < 0)
-        break;
-
-      Matrix *prediction = predict_network(network, input);
-      int predicted_label = argmax(prediction);
+    // A new order every epoch. The staging thread gathers the next shuffled
+    // batches while the network trains on the current one.
+    dataset_iterator_reset(batches);
+    BatchStager *stager =
+        create_batch_stager(INPUT_SIZE, OUTPUT_SIZE, BATCH_SIZE, STAGING_DEPTH,
+                            dataset_produce_batch, batches);
+    if (stager == NULL) {
+      break;
+    }
 
-      if (predicted_label == label) {
-        correct++;
+    Matrix *staged_input;
+    Matrix *staged_target;
+    int columns;
+    int sample = 0;
+    while ((columns = batch_stager_next(stager, &staged_input,
+                                        &staged_target)) > 0) {
+      Matrix *prediction = predict_network(network, staged_input);
+      if (prediction == NULL) {
+        break;
       }
 
-      for (int i = 0; i < OUTPUT_SIZE; i++) {
-        float diff = prediction->data[i] - target->data[i];
+      for (int b = 0; b < columns; b++) {
+        if (argmax_column(prediction, b) == argmax_column(staged_target, b)) {
+          correct++;
+        }
+      }
+      for (int i = 0; i < OUTPUT_SIZE * columns; i++) {
+        float diff = prediction->data[i] - staged_target->data[i];
         total_loss += diff * diff;
       }
 
       free_matrix(prediction);
 
-      train_network(network, input, target, LEARNING_RATE);
+      train_network(network, staged_input, staged_target, LEARNING_RATE);
+      batch_stager_release(stager);
 
-      if ((sample + 1) % 200 == 0) {
-        printf("  Epoch %d: Processed %d/%d samples...\n", epoch + 1,
-               sample + 1, TRAIN_SAMPLES);
+      int previous = sample;
+      sample += columns;
+      if (sample / 1000 != previous / 1000) {
+        printf("  Epoch %d: Processed %d/%d samples...\n", epoch + 1, sample,
+               train->count);
       }
     }
 
-    fclose(train_file);
+    printf("  Waited %.3fs for batches\n", batch_stager_wait_seconds(stager));
+    free_batch_stager(stager);
 
-    float accuracy = (float)correct / TRAIN_SAMPLES * 100.0f;
-    float avg_loss = total_loss / TRAIN_SAMPLES;
+    float accuracy = (float)correct / train->count * 100.0f;
+    float avg_loss = total_loss / train->count;
     printf("Epoch %d/%d - Train Accuracy: %.2f%% - Avg Loss: %.4f\n", epoch + 1,
            EPOCHS, accuracy, avg_loss);
   }
 
   printf("\n--- Testing Phase ---\n");
 
-  FILE *test_file = fopen("mnist_test.csv", "r");
-  if (test_file == NULL) {
-    fprintf(stderr, "Error: Could not open mnist_test.csv\n");
-    free_matrix(input);
-    free_matrix(target);
-    free_network(network);
-    return -1;
-  }
-
   int test_correct = 0;
   int confusion_matrix[10][10] = {0};
 
-  for (int sample = 0; sample < TEST_SAMPLES; sample++) {
-    int label = parse_csv_line(test_file, input, target);
-    if (label < 0)
-      break;
-
+  DatasetIterator *test_batches = create_dataset_iterator(test, BATCH_SIZE, 0, 0);
+  Matrix *input;
+  Matrix *target;
+  int columns;
+  while (test_batches != NULL &&
+         (columns = dataset_next_batch(test_batches, &input, &target)) > 0) {
     Matrix *prediction = predict_network(network, input);
-    int predicted_label = argmax(prediction);
-
-    confusion_matrix[label][predicted_label]++;
+    if (prediction == NULL) {
+      break;
+    }
 
-    if (predicted_label == label) {
-      test_correct++;
+    for (int b = 0; b < columns; b++) {
+      int label = argmax_column(target, b);
+      int predicted_label = argmax_column(prediction, b);
+      confusion_matrix[label][predicted_label]++;
+      if (predicted_label == label) {
+        test_correct++;
+      }
     }
 
     free_matrix(prediction);
   }
+  free_dataset_iterator(test_batches);
 
-  fclose(test_file);
-
-  float test_accuracy = (float)test_correct / TEST_SAMPLES * 100.0f;
+  float test_accuracy = (float)test_correct / test->count * 100.0f;
   printf("\n=== Results ===\n");
-  printf("Test Accuracy: %d/%d = %.2f%%\n", test_correct, TEST_SAMPLES,
+  printf("Test Accuracy: %d/%d = %.2f%%\n", test_correct, test->count,
          test_accuracy);
 
   printf("\nPer-digit accuracy:\n");
@@ -191,30 +229,32 @@ int main() {
 
   printf("\n--- Demo: Single Sample Predictions ---\n");
 
-  FILE *demo_file = fopen("mnist_test.csv", "r");
-  if (demo_file != NULL) {
-    for (int i = 0; i < 5; i++) {
-      int label = parse_csv_line(demo_file, input, target);
-      if (label < 0)
-        break;
+  Matrix *demo_input = create_matrix(INPUT_SIZE, 1);
+  Matrix *demo_target = create_matrix(OUTPUT_SIZE, 1);
+  for (int i = 0; i < 5 && i < test->count; i++) {
+    if (dataset_gather(test, &i, 1, demo_input, demo_target) != 0) {
+      break;
+    }
+    int label = argmax(demo_target);
 
-      Matrix *prediction = predict_network(network, input);
-      int predicted = argmax(prediction);
+    Matrix *prediction = predict_network(network, demo_input);
+    int predicted = argmax(prediction);
 
-      printf("  Sample %d: True Label = %d, Predicted = %d %s\n", i + 1, label,
-             predicted, (label == predicted) ? "✓" : "✗");
+    printf("  Sample %d: True Label = %d, Predicted = %d %s\n", i + 1, label,
+           predicted, (label == predicted) ? "✓" : "✗");
 
-      free_matrix(prediction);
-    }
-    fclose(demo_file);
+    free_matrix(prediction);
   }
+  free_matrix(demo_input);
+  free_matrix(demo_target);
 
   print_network_info(network);
 
-  free_matrix(input);
-  free_matrix(target);
+  free_dataset_iterator(batches);
+  free_dataset(train);
+  free_dataset(test);
   free_network(network);
 
   printf("\nDone!\n");
   return 0;
-}
\ No newline at end of file
+}
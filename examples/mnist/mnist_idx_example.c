@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../../include/idx.h"
+#include "../../include/network.h"
+
+#define INPUT_SIZE 784
+#define HIDDEN_SIZE 128
+#define OUTPUT_SIZE 10
+
+#define LEARNING_RATE 0.01f
+#define BATCH_SIZE 16
+#define EPOCHS 10
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Opens an image file and its label file and checks that they belong
+// together
+static int open_pair(const char *images_path, const char *labels_path,
+                     IdxFile **images, IdxFile **labels) {
+  *images = idx_open(images_path);
+  *labels = idx_open(labels_path);
+  if (*images == NULL || *labels == NULL) {
+    idx_close(*images);
+    idx_close(*labels);
+    return -1;
+  }
+  if ((*images)->sample_size != INPUT_SIZE ||
+      (*images)->count != (*labels)->count) {
+    fprintf(stderr, "Error: %s (%d x %zu) doesn't match %s (%d labels)\n",
+            images_path, (*images)->count, (*images)->sample_size,
+            labels_path, (*labels)->count);
+    idx_close(*images);
+    idx_close(*labels);
+    return -1;
+  }
+  return 0;
+}
+
+// Trains on the binary IDX files MNIST is distributed as. The files are
+// mapped once; each batch is built straight from the mapped bytes and stays
+// bytes, the first layer scales them by 1/255 inside its matrix multiply.
+int main() {
+  srand(time(NULL));
+
+  IdxFile *train_images, *train_labels, *test_images, *test_labels;
+  double start = now_seconds();
+  if (open_pair("train-images-idx3-ubyte", "train-labels-idx1-ubyte",
+                &train_images, &train_labels) != 0) {
+    fprintf(stderr, "Make sure the MNIST IDX files are in the working "
+                    "directory\n");
+    return -1;
+  }
+  if (open_pair("t10k-images-idx3-ubyte", "t10k-labels-idx1-ubyte",
+                &test_images, &test_labels) != 0) {
+    idx_close(train_images);
+    idx_close(train_labels);
+    return -1;
+  }
+  printf("Mapped %d training and %d test images in %.3f ms\n",
+         train_images->count, test_images->count,
+         (now_seconds() - start) * 1e3);
+
+  Network *network = create_network();
+  add_layer(network, layer_create_dense(INPUT_SIZE, HIDDEN_SIZE));
+  add_layer(network, layer_create_relu());
+  add_layer(network, layer_create_dense(HIDDEN_SIZE, OUTPUT_SIZE));
+  add_layer(network, layer_create_sigmoid());
+
+  ByteMatrix *input =
+      create_byte_matrix(INPUT_SIZE, BATCH_SIZE, 1.0f / 255.0f, 0.0f);
+  Matrix *target = create_matrix(OUTPUT_SIZE, BATCH_SIZE);
+  ByteMatrix *last_input = NULL;
+  Matrix *last_target = NULL;
+  int tail = train_images->count % BATCH_SIZE;
+  if (tail > 0) {
+    last_input = create_byte_matrix(INPUT_SIZE, tail, 1.0f / 255.0f, 0.0f);
+    last_target = create_matrix(OUTPUT_SIZE, tail);
+  }
+
+  printf("--- Training Phase ---\n");
+  for (int epoch = 0; epoch < EPOCHS; epoch++) {
+    double epoch_start = now_seconds();
+    for (int first = 0; first < train_images->count; first += BATCH_SIZE) {
+      int count = train_images->count - first < BATCH_SIZE
+                      ? train_images->count - first
+                      : BATCH_SIZE;
+      ByteMatrix *x = count == BATCH_SIZE ? input : last_input;
+      Matrix *y = count == BATCH_SIZE ? target : last_target;
+      if (idx_copy_byte_columns(train_images, first, count, x, 0) ||
+          idx_copy_one_hot(train_labels, first, count, y, 0)) {
+        break;
+      }
+      train_network_bytes(network, x, y, LEARNING_RATE);
+    }
+    printf("Epoch %d/%d - %.2fs\n", epoch + 1, EPOCHS,
+           now_seconds() - epoch_start);
+  }
+
+  printf("\n--- Testing Phase ---\n");
+  int correct = 0;
+  for (int first = 0; first + BATCH_SIZE <= test_images->count;
+       first += BATCH_SIZE) {
+    if (idx_copy_byte_columns(test_images, first, BATCH_SIZE, input, 0) !=
+        0) {
+      break;
+    }
+    Matrix *prediction = predict_network_bytes(network, input);
+    if (prediction == NULL) {
+      break;
+    }
+    for (int b = 0; b < BATCH_SIZE; b++) {
+      if (argmax_column(prediction, b) == test_labels->data[first + b]) {
+        correct++;
+      }
+    }
+    free_matrix(prediction);
+  }
+  int tested = test_images->count / BATCH_SIZE * BATCH_SIZE;
+  printf("Test Accuracy: %d/%d = %.2f%%\n", correct, tested,
+         tested > 0 ? 100.0f * correct / tested : 0.0f);
+
+  // Samples are plain byte views into the mapping
+  const uint8_t *pixels = idx_sample(test_images, 0);
+  int ink = 0;
+  for (int i = 0; i < INPUT_SIZE; i++) {
+    ink += pixels[i] > 127;
+  }
+  printf("First test image: label %d, %d of %d pixels set\n",
+         test_labels->data[0], ink, INPUT_SIZE);
+
+  free_byte_matrix(input);
+  free_matrix(target);
+  free_byte_matrix(last_input);
+  free_matrix(last_target);
+  free_network(network);
+  idx_close(train_images);
+  idx_close(train_labels);
+  idx_close(test_images);
+  idx_close(test_labels);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include "../include/pipeline.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define INPUTS 256
+#define BATCH 4 // columns per streamed request
+#define REQUESTS 200
+#define QUEUE_CAPACITY 8
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static Matrix *make_request(int i) {
+  Matrix *m = create_matrix(INPUTS, BATCH);
+  for (int j = 0; j < INPUTS * BATCH; j++) {
+    m->data[j] = sinf((float)(i * 31 + j) * 0.01f);
+  }
+  return m;
+}
+
+// Streams requests through a deep MLP, first one at a time with
+// predict_network, then through a pipeline with one stage per core
+// Usage: pipeline_example [stages], defaults to the core count
+int main(int argc, char **argv) {
+  int widths[] = {INPUTS, 512, 512, 256, 256, 128, 64, 10};
+  int depth = sizeof(widths) / sizeof(widths[0]) - 1;
+
+  Network *n = create_network();
+  for (int i = 0; i < depth; i++) {
+    add_layer(n, layer_create_dense(widths[i], widths[i + 1]));
+    add_layer(n, layer_create_relu());
+  }
+
+  int stages = argc > 1 ? atoi(argv[1]) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (stages < 2) {
+    stages = 2;
+  }
+
+  // Sequential reference
+  Matrix **expected = malloc(sizeof(Matrix *) * REQUESTS);
+  double start = now_seconds();
+  for (int i = 0; i < REQUESTS; i++) {
+    Matrix *request = make_request(i);
+    expected[i] = predict_network(n, request);
+    free_matrix(request);
+  }
+  double sequential = now_seconds() - start;
+
+  Matrix *sample = make_request(0);
+  Pipeline *p = create_pipeline(n, sample, stages, QUEUE_CAPACITY);
+  free_matrix(sample);
+  if (p == NULL) {
+    free_network(n);
+    return -1;
+  }
+  print_pipeline_info(p);
+
+  // Keep the queues full: submit ahead, receive in order
+  float max_diff = 0.0f;
+  int received = 0;
+  start = now_seconds();
+  for (int i = 0; i < REQUESTS; i++) {
+    pipeline_submit(p, make_request(i));
+    if (i >= QUEUE_CAPACITY) {
+      Matrix *out = pipeline_receive(p);
+      for (int j = 0; j < out->rows * out->columns; j++) {
+        float d = fabsf(out->data[j] - expected[received]->data[j]);
+        max_diff = d > max_diff ? d : max_diff;
+      }
+      free_matrix(out);
+      received++;
+    }
+  }
+  while (received < REQUESTS) {
+    Matrix *out = pipeline_receive(p);
+    for (int j = 0; j < out->rows * out->columns; j++) {
+      float d = fabsf(out->data[j] - expected[received]->data[j]);
+      max_diff = d > max_diff ? d : max_diff;
+    }
+    free_matrix(out);
+    received++;
+  }
+  double pipelined = now_seconds() - start;
+
+  printf("Sequential: %.0f requests/s\n", REQUESTS / sequential);
+  printf("Pipelined:  %.0f requests/s (%.2fx), max diff %g\n",
+         REQUESTS / pipelined, sequential / pipelined, max_diff);
+
+  free_pipeline(p);
+  for (int i = 0; i < REQUESTS; i++) {
+    free_matrix(expected[i]);
+  }
+  free(expected);
+  free_network(n);
+  return 0;
+}
@@ -0,0 +1,73 @@
+#include "../include/matrix.h"
+#include "../include/scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH 256
+#define REPEATS 20
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// GFLOP/s of the Dense forward GEMM (out x in) * (in x BATCH)
+static double dense_gflops(int in, int out) {
+  float *w = malloc(sizeof(float) * out * in);
+  float *x = malloc(sizeof(float) * in * BATCH);
+  float *y = malloc(sizeof(float) * out * BATCH);
+  for (int i = 0; i < out * in; i++) {
+    w[i] = (float)rand() / (float)RAND_MAX;
+  }
+  for (int i = 0; i < in * BATCH; i++) {
+    x[i] = (float)rand() / (float)RAND_MAX;
+  }
+
+  gemm(0, 0, out, BATCH, in, 1.0f, w, in, x, BATCH, 0.0f, y, BATCH);
+  double start = now_seconds();
+  for (int r = 0; r < REPEATS; r++) {
+    gemm(0, 0, out, BATCH, in, 1.0f, w, in, x, BATCH, 0.0f, y, BATCH);
+  }
+  double elapsed = now_seconds() - start;
+
+  free(w);
+  free(x);
+  free(y);
+  return 2.0 * out * in * BATCH * REPEATS / elapsed * 1e-9;
+}
+
+// Usage: scheduler_benchmark [max_threads], defaults to the core count
+int main(int argc, char **argv) {
+  int max_threads = argc > 1 ? atoi(argv[1])
+                             : (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (max_threads < 1) {
+    max_threads = 1;
+  }
+  int shapes[][2] = {{784, 128}, {128, 10}, {512, 512}};
+  int shape_count = sizeof(shapes) / sizeof(shapes[0]);
+
+  printf("Dense forward GEMM, batch %d, GFLOP/s\n", BATCH);
+  printf("threads");
+  for (int s = 0; s < shape_count; s++) {
+    printf(" | %4dx%-4d", shapes[s][0], shapes[s][1]);
+  }
+  printf("\n");
+
+  for (int threads = 1; threads <= max_threads; threads *= 2) {
+    scheduler_init(threads);
+    printf("%7d", threads);
+    for (int s = 0; s < shape_count; s++) {
+      printf(" | %9.2f", dense_gflops(shapes[s][0], shapes[s][1]));
+    }
+    printf("\n");
+    if (threads < max_threads && threads * 2 > max_threads) {
+      threads = max_threads / 2;
+    }
+  }
+
+  scheduler_shutdown();
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include "../include/dataset.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// uint8 samples with a class label
+#define CLASSES 10
+#define BATCH_SIZE 64
+#define ROUNDS 3
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// One epoch of byte batches, as train_network_bytes would see it
+static double epoch_seconds(DatasetIterator *it, ByteMatrix *inputs,
+                            Matrix *targets) {
+  Dataset *d = it->dataset;
+  dataset_iterator_reset(it);
+  double start = now_seconds();
+  for (int first = 0; first + BATCH_SIZE <= d->count; first += BATCH_SIZE) {
+    dataset_gather_bytes(d, it->order + first, BATCH_SIZE, inputs, targets);
+  }
+  return now_seconds() - start;
+}
+
+// Usage: shuffle_benchmark [megabytes] [features], defaults to 512 MB of
+// 64-byte rows. Narrow rows make the access pattern matter most; at 3072
+// (3x32x32 images) the transpose into columns dominates.
+int main(int argc, char **argv) {
+  double mb = argc > 1 ? atof(argv[1]) : 512.0;
+  int features = argc > 2 ? atoi(argv[2]) : 64;
+  if (features < 1) {
+    features = 64;
+  }
+  Dataset d = {0};
+  d.count = (int)(mb * 1e6 / features);
+  d.features = features;
+  d.target_size = CLASSES;
+  d.type = DATASET_UINT8;
+  d.scale = 1.0f / 255.0f;
+  d.inputs = malloc((size_t)d.count * features);
+  d.labels = malloc(sizeof(int32_t) * (d.count > 0 ? d.count : 1));
+  ByteMatrix *inputs = create_byte_matrix(features, BATCH_SIZE, 0.0f, 0.0f);
+  Matrix *targets = create_matrix(CLASSES, BATCH_SIZE);
+  if (d.count < BATCH_SIZE || d.inputs == NULL || d.labels == NULL ||
+      inputs == NULL || targets == NULL) {
+    fprintf(stderr, "Error: could not allocate %.0f MB of samples\n", mb);
+    return -1;
+  }
+  srand(1);
+  uint8_t *pixels = d.inputs;
+  for (size_t i = 0; i < (size_t)d.count * features; i++) {
+    pixels[i] = (uint8_t)rand();
+  }
+  for (int i = 0; i < d.count; i++) {
+    d.labels[i] = rand() % CLASSES;
+  }
+  mb = (double)d.count * features / 1e6;
+
+  struct {
+    const char *name;
+    int shuffle;
+    int block_size;
+    int window_blocks;
+  } configs[] = {
+      {"storage order", 0, 0, 0},
+      {"full shuffle", 1, 0, 0},
+      {"block 16, window 64", 1, 16, 64},
+      {"block 64, window 16", 1, 64, 16},
+      {"block 256, window 4", 1, 256, 4},
+      {"block 1024, window 1", 1, 1024, 1},
+  };
+  int config_count = sizeof(configs) / sizeof(configs[0]);
+  DatasetIterator *its[sizeof(configs) / sizeof(configs[0])];
+  double best[sizeof(configs) / sizeof(configs[0])];
+  for (int c = 0; c < config_count; c++) {
+    its[c] = create_dataset_iterator(&d, BATCH_SIZE, configs[c].shuffle, 1);
+    if (its[c] == NULL ||
+        dataset_iterator_block_shuffle(its[c], configs[c].block_size,
+                                       configs[c].window_blocks) != 0) {
+      return -1;
+    }
+    best[c] = 1e30;
+  }
+
+  // Interleaved so that drift on the machine hits every config alike
+  for (int round = 0; round < ROUNDS; round++) {
+    for (int c = 0; c < config_count; c++) {
+      double t = epoch_seconds(its[c], inputs, targets);
+      if (t < best[c]) {
+        best[c] = t;
+      }
+    }
+  }
+
+  printf("%d samples, %.0f MB of uint8 inputs, best of %d epochs\n", d.count,
+         mb, ROUNDS);
+  printf("%-22s | batch drawn from | epoch s | MB/s\n", "order");
+  for (int c = 0; c < config_count; c++) {
+    char range[32];
+    if (configs[c].block_size > 0) {
+      snprintf(range, sizeof(range), "%d x %d samples",
+               configs[c].window_blocks, configs[c].block_size);
+    } else {
+      snprintf(range, sizeof(range), "%s",
+               configs[c].shuffle ? "whole dataset" : "64 in a row");
+    }
+    printf("%-22s | %-16s | %7.3f | %6.0f\n", configs[c].name, range,
+           best[c], mb / best[c]);
+    free_dataset_iterator(its[c]);
+  }
+
+  free_byte_matrix(inputs);
+  free_matrix(targets);
+  free(d.inputs);
+  free(d.labels);
+  return 0;
+}
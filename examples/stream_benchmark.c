@@ -0,0 +1,115 @@
+#include "../include/staging.h"
+#include "../include/stream.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// MNIST-shaped uint8 samples with a class label
+#define FEATURES 784
+#define CLASSES 10
+#define BATCH_SIZE 64
+#define PATH "stream_benchmark.cache"
+
+static double now_seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int write_cache(int count) {
+  Dataset d = {0};
+  d.count = count;
+  d.features = FEATURES;
+  d.target_size = CLASSES;
+  d.type = DATASET_UINT8;
+  d.scale = 1.0f / 255.0f;
+  d.inputs = malloc((size_t)count * FEATURES);
+  d.labels = malloc(sizeof(int32_t) * count);
+  if (d.inputs == NULL || d.labels == NULL) {
+    free(d.inputs);
+    free(d.labels);
+    return -1;
+  }
+  srand(1);
+  uint8_t *pixels = d.inputs;
+  for (size_t i = 0; i < (size_t)count * FEATURES; i++) {
+    pixels[i] = (uint8_t)(rand() % 4 == 0 ? rand() % 256 : 0);
+  }
+  for (int i = 0; i < count; i++) {
+    d.labels[i] = rand() % CLASSES;
+  }
+  int result = dataset_save(&d, PATH, DATASET_UINT8, d.scale, 0.0f);
+  free(d.inputs);
+  free(d.labels);
+  return result;
+}
+
+// One epoch through a stager, as train_network_staged would see it
+static void run(const char *name, BatchProducer produce, void *ctx, double mb) {
+  BatchStager *s = create_batch_stager(FEATURES, CLASSES, BATCH_SIZE, 4,
+                                       produce, ctx);
+  if (s == NULL) {
+    return;
+  }
+  Matrix *inputs, *targets;
+  long samples = 0;
+  int n;
+  double start = now_seconds();
+  while ((n = batch_stager_next(s, &inputs, &targets)) > 0) {
+    samples += n;
+    batch_stager_release(s);
+  }
+  double elapsed = now_seconds() - start;
+  printf("%-30s | %8.0f | %7.1f | %6.3f\n", name, samples / elapsed,
+         mb / elapsed, batch_stager_wait_seconds(s));
+  free_batch_stager(s);
+}
+
+// Usage: stream_benchmark [megabytes], defaults to 256
+int main(int argc, char **argv) {
+  double mb = argc > 1 ? atof(argv[1]) : 256.0;
+  int count = (int)(mb * 1e6 / FEATURES);
+  if (count < BATCH_SIZE || write_cache(count) != 0) {
+    fprintf(stderr, "Error: could not write %s\n", PATH);
+    return -1;
+  }
+  mb = (double)count * FEATURES / 1e6;
+  printf("%d samples, %.0f MB of uint8 pixels\n", count, mb);
+  printf("%-30s | samples/s | MB/s | wait s\n", "source");
+
+  // Whole file mapped, every batch gathered from random places
+  Dataset *d = dataset_load(PATH);
+  DatasetIterator *it = create_dataset_iterator(d, BATCH_SIZE, 1, 1);
+  if (it != NULL) {
+    run("mapped, full shuffle", dataset_produce_batch, it, mb);
+  }
+  free_dataset_iterator(it);
+  free_dataset(d);
+
+  struct {
+    const char *name;
+    int shuffle;
+    int direct;
+  } configs[] = {
+      {"stream, file order", 0, 0},
+      {"stream, window shuffle", 1, 0},
+      {"stream, window shuffle, direct", 1, 1},
+  };
+  for (int c = 0; c < 3; c++) {
+    DatasetStreamOptions options = {0};
+    options.direct = configs[c].direct;
+    DatasetStream *s = create_dataset_stream(PATH, BATCH_SIZE,
+                                             configs[c].shuffle, 1, &options);
+    if (s == NULL) {
+      break;
+    }
+    run(configs[c].name, dataset_stream_produce_batch, s, mb);
+    printf("%-30s   reader wait %.3f s\n", "",
+           dataset_stream_wait_seconds(s));
+    free_dataset_stream(s);
+  }
+
+  remove(PATH);
+  return 0;
+}
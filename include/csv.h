@@ -0,0 +1,38 @@
+#ifndef CSV_H
+#define CSV_H
+
+#include <stddef.h>
+
+#include "matrix.h"
+
+// Numeric CSV ingestion. The file is mapped, cut into chunks at line
+// boundaries and the chunks are parsed in parallel on the scheduler pool.
+// Each line becomes one row of a preallocated (lines x fields) matrix, so a
+// sample's values end up contiguous. Numbers are read by a hand-written
+// scanner that ignores the locale and never allocates.
+//
+// Accepted per field: optional spaces, sign, digits, '.', fraction and an
+// e/E exponent. Empty lines are skipped, "\r\n" endings are fine. Any other
+// text, or a line with the wrong number of fields, is an error.
+
+typedef struct {
+    char delimiter;     // 0 means ','
+    int skip_header;    // ignore the first line
+} CsvOptions;
+
+// Counts the data lines and the fields of the first one, for sizing the
+// output. options may be NULL. Returns 0 or -1.
+int csv_shape(const char* path, const CsvOptions* options, int* rows,
+              int* columns);
+
+// Parses size bytes of CSV text into out, which must have exactly one row
+// per data line and one column per field. Returns the rows parsed or -1.
+int csv_parse_buffer(const char* data, size_t size, const CsvOptions* options,
+                     Matrix* out);
+int csv_parse_file(const char* path, const CsvOptions* options, Matrix* out);
+
+// csv_shape, create_matrix and csv_parse_file in one, over a single mapping
+// and line count. Caller frees.
+Matrix* csv_load(const char* path, const CsvOptions* options);
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef DATASET_H
+#define DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "csv.h"
+#include "idx.h"
+#include "matrix.h"
+
+// In-memory dataset. All samples are stored once, contiguously and sample
+// by sample. Iterators walk it in mini-batches through a permutation index
+// and gather each batch into (features x batch) matrices for train_network.
+//
+// Inputs are stored as float32, float16 or uint8. Packed types decode as
+// stored * scale + offset while a batch is gathered. Targets are either
+// dense float rows or a class index per sample, expanded to one-hot columns
+// of target_size rows.
+
+typedef enum {
+    DATASET_FLOAT32 = 0,
+    DATASET_FLOAT16 = 1,
+    DATASET_UINT8 = 2,
+} DatasetType;
+
+typedef struct {
+    int count;
+    int features;
+    int target_size;    // dense target rows or classes, 0 for unlabeled data
+
+    DatasetType type;
+    void* inputs;       // count x features values of type
+    float scale;        // packed types: value = stored * scale + offset
+    float offset;
+
+    float* targets;     // count x target_size, or NULL
+    int32_t* labels;    // class index per sample, or NULL
+
+    // Set when the dataset lives in a mapped cache file
+    void* map;
+    size_t map_size;
+} Dataset;
+
+// Uninitialized float32 storage for count samples with dense targets
+Dataset* create_dataset(int count, int features, int target_size);
+void free_dataset(Dataset* d);
+
+// Builds a dataset from a CSV file with the class label in label_column.
+// The other fields, times scale, are float32 features (MNIST CSV: label 0,
+// 10 classes, 1/255).
+Dataset* dataset_from_csv(const char* path, const CsvOptions* options,
+                          int label_column, int classes, float scale);
+// Same from a uint8 IDX image file and its label file. The pixels stay
+// uint8 and decode with scale.
+Dataset* dataset_from_idx(const IdxFile* images, const IdxFile* labels,
+                          int classes, float scale);
+
+// Input i of sample s, decoded
+float dataset_input(const Dataset* d, int sample, int i);
+
+// Copies samples indices[0..count) into the first count columns of inputs
+// (and targets, which may be NULL). The matrices need features/target_size
+// rows and at least count columns. Returns 0 or -1.
+int dataset_gather(const Dataset* d, const int* indices, int count,
+                   Matrix* inputs, Matrix* targets);
+// Same for a uint8 dataset into a byte matrix, without decoding: the bytes
+// are copied and inputs takes the dataset's scale and offset, for
+// train_network_bytes.
+int dataset_gather_bytes(const Dataset* d, const int* indices, int count,
+                         ByteMatrix* inputs, Matrix* targets);
+
+// Binary cache: a 64-byte header (shape, input type, label layout, scale
+// and offset) followed by the 64-byte aligned payloads, in host byte order.
+// Write it once after ingesting the raw data; loading maps the file without
+// parsing or converting anything.
+//
+// dataset_save stores the inputs as type. Values are encoded as
+// (value - offset) / scale; float32 always stores values as they are.
+// Returns 0 or -1.
+int dataset_save(const Dataset* d, const char* path, DatasetType type,
+                 float scale, float offset);
+// Maps a cache file copy-on-write. NULL if it is missing or invalid.
+Dataset* dataset_load(const char* path);
+
+// Same pair for a cache built from a file: the size and modification time
+// of source_path are stored after the header, and dataset_load_source
+// returns NULL, so the caller rebuilds, once they no longer match (or the
+// cache has none). If source_path is gone the cache is used as it is.
+int dataset_save_source(const Dataset* d, const char* path, DatasetType type,
+                        float scale, float offset, const char* source_path);
+Dataset* dataset_load_source(const char* path, const char* source_path);
+
+// Where the parts of a cache file are, for reading it without mapping it
+typedef struct {
+    int count;
+    int features;
+    int target_size;
+    DatasetType type;
+    float scale;
+    float offset;
+    int has_labels;             // targets are an int32 class per sample,
+                                // otherwise target_size float32 (if any)
+    uint64_t file_size;
+    uint64_t inputs_offset;     // count x features values of type
+    uint64_t targets_offset;
+} DatasetCacheLayout;
+
+// Reads and checks the header of a cache file. Returns 0 or -1.
+int dataset_cache_layout(const char* path, DatasetCacheLayout* layout);
+
+typedef struct {
+    Dataset* dataset;
+    int batch_size;
+    int shuffle;
+    unsigned long long rng;
+    int* order;         // permutation of the current epoch
+    int next;           // position in order
+
+    // Block shuffle (dataset_iterator_block_shuffle), block_size 0 when off
+    int block_size;
+    int window_blocks;
+    int* blocks;
+
+    // Batches returned by dataset_next_batch; the last batch of an epoch has
+    // fewer columns
+    Matrix* inputs;
+    Matrix* targets;
+} DatasetIterator;
+
+// Starts the first epoch. With shuffle set every epoch visits the samples
+// in a new random order drawn from seed, otherwise in storage order.
+DatasetIterator* create_dataset_iterator(Dataset* d, int batch_size,
+                                         int shuffle, unsigned int seed);
+void free_dataset_iterator(DatasetIterator* it);
+
+// Switches a shuffling iterator from a full permutation to a block shuffle
+// and restarts the epoch. Each epoch then visits runs of block_size
+// consecutive samples in a random order and shuffles the samples within
+// every window_blocks runs of that order. A batch is then gathered from
+// window_blocks contiguous runs instead of from all over the dataset, which
+// keeps the reads local in cache, TLB and page cache. Smaller blocks and
+// larger windows mix more and approach the full shuffle; block_size 0 goes
+// back to it. A block larger than the dataset is the whole dataset.
+// Returns 0 or -1.
+int dataset_iterator_block_shuffle(DatasetIterator* it, int block_size,
+                                   int window_blocks);
+// Starts the next epoch, reshuffling if enabled
+void dataset_iterator_reset(DatasetIterator* it);
+
+// Next batch of the epoch in the iterator's own matrices, valid until the
+// next call. Returns its column count, 0 at the end of the epoch.
+int dataset_next_batch(DatasetIterator* it, Matrix** inputs, Matrix** targets);
+
+// The same as a BatchProducer (staging.h): gathers the next batch into the
+// caller's matrices so the copy can run on a staging thread. ctx is the
+// iterator.
+int dataset_produce_batch(void* ctx, Matrix* inputs, Matrix* targets);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "layer.h"
+
+// A network as a DAG of named nodes. Each node names its inputs, so skip
+// connections and multi-branch models can be expressed. A node read by
+// several others is a branch point; its gradient is the sum over consumers.
+
+typedef enum {
+    GRAPH_NODE_INPUT,
+    GRAPH_NODE_LAYER,
+    GRAPH_NODE_SUM,    // element-wise sum of the inputs (residual add)
+    GRAPH_NODE_CONCAT  // inputs stacked along the rows (features)
+} GraphNodeType;
+
+typedef struct {
+    GraphNodeType type;
+    char *name;
+    Layer *layer;         // GRAPH_NODE_LAYER only, owned by the graph
+
+    char **input_names;   // as given by the caller, resolved on compile
+    int *inputs;          // node indices
+    int input_count;
+    int *input_rows;      // CONCAT: rows of each input seen in forward
+
+    int last_use;         // schedule step after which the value can be freed
+} GraphNode;
+
+typedef struct Graph Graph;
+
+struct Graph {
+    GraphNode *nodes;
+    int node_count;
+
+    int input_node;
+    int output_node;
+    char *output_name;
+
+    int *schedule;        // topological order of node indices
+    int *level_start;     // schedule[level_start[l]..level_start[l+1]) are
+    int level_count;      // independent of each other and run concurrently
+    int **free_after;     // free_after[step]: values dead after that step
+    int *free_count;
+    int compiled;
+};
+
+Graph* create_graph();
+void free_graph(Graph *g);
+
+// Each returns the new node's index, or -1 on error.
+int graph_add_input(Graph *g, const char *name);
+// The graph takes l over even on error, where it is freed (as add_layer
+// does), so layer_create_* can be passed inline.
+int graph_add_layer(Graph *g, const char *name, Layer *l, const char *input);
+int graph_add_sum(Graph *g, const char *name, const char **inputs, int count);
+int graph_add_concat(Graph *g, const char *name, const char **inputs, int count);
+void graph_set_output(Graph *g, const char *name);
+
+// Resolves names, orders nodes topologically and derives buffer lifetimes.
+// Called automatically by predict/train after the graph changes.
+int graph_compile(Graph *g);
+
+Matrix* predict_graph(Graph *g, Matrix *input);
+void train_graph(Graph *g, Matrix *input, Matrix *target, float learning_rate);
+void print_graph_info(Graph *g);
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef IDX_H
+#define IDX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "matrix.h"
+
+// Memory-mapped IDX files, the binary format MNIST ships in. The file is
+// mapped read-only once; samples are views into the mapping, so loading a
+// dataset costs no parsing and no copies until a batch is built.
+//
+// Layout: two zero bytes, a type byte, the dimension count, then one
+// big-endian uint32 per dimension followed by the payload. Dimension 0
+// counts the samples.
+
+#define IDX_MAX_DIMENSIONS 8
+
+typedef enum {
+    IDX_UINT8 = 0x08,
+    IDX_INT8 = 0x09,
+    IDX_INT16 = 0x0B,
+    IDX_INT32 = 0x0C,
+    IDX_FLOAT32 = 0x0D,
+    IDX_FLOAT64 = 0x0E,
+} IdxType;
+
+typedef struct {
+    IdxType type;
+    int element_size;
+    int dimension_count;
+    int dimensions[IDX_MAX_DIMENSIONS];
+    int count;                  // samples, dimensions[0]
+    size_t sample_size;         // elements per sample
+    const unsigned char* data;  // payload, multi-byte types are big-endian
+
+    void* map;
+    size_t map_size;
+} IdxFile;
+
+// Maps and validates the file. Returns NULL on a bad header or a size that
+// doesn't match it.
+IdxFile* idx_open(const char* path);
+void idx_close(IdxFile* f);
+
+// Zero-copy view of sample index of a uint8 file, sample_size bytes long.
+// Valid until idx_close. NULL for other types or out of range.
+const uint8_t* idx_sample(const IdxFile* f, int index);
+
+// Writes samples first..first+count-1 of a uint8 file, times scale, into
+// columns column..column+count-1 of out (sample_size rows). Returns 0, or -1
+// if they don't fit.
+int idx_copy_columns(const IdxFile* f, int first, int count, float scale,
+                     Matrix* out, int column);
+// Same without decoding, into a byte matrix; set its scale (1/255 for
+// pixels) for train_network_bytes
+int idx_copy_byte_columns(const IdxFile* f, int first, int count,
+                          ByteMatrix* out, int column);
+// Same for a uint8 label file: one-hot columns of out (classes rows)
+int idx_copy_one_hot(const IdxFile* labels, int first, int count,
+                     Matrix* out, int column);
+
+#endif
@@ -4,19 +4,73 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define STB_IMAGE_IMPLEMENTATION
+#include "matrix.h"
 #include "stb_image.h"
 // This struct and it's functions are an abstraction
 // of stb_image library. 
 
 typedef struct {
-    float *data;
+    float *data; // height x width x channels, interleaved, scaled to [0, 1]
+    int width;
+    int height;
+    int channels;
 
     char *type; // JPG, PNG etc.
     char *name;
 } Image ;
 
+// Decodes any format stb_image reads (JPG, PNG, BMP, GIF, TGA, PSD, HDR,
+// PIC, PNM). Returns NULL if the file can't be decoded.
 Image* read_image(char *path);
 void free_image(Image *img);
 
-#endif
\ No newline at end of file
+typedef enum {
+    IMAGE_RESIZE_NONE = 0,  // crop from the image as decoded
+    IMAGE_RESIZE_BILINEAR,
+    IMAGE_RESIZE_AREA,      // box average, the better choice for shrinking
+} ImageResize;
+
+typedef enum {
+    IMAGE_CROP_CENTER = 0,
+    IMAGE_CROP_RANDOM,
+} ImageCrop;
+
+// Preprocessing applied while an image is written into a batch. Zeroed
+// fields keep the image as it is: no resize, a center crop, mean 0, std 1.
+typedef struct {
+    int width;
+    int height;
+    int channels; // converted to this many: 1 gray, 3 RGB, 4 RGBA
+
+    ImageResize resize;
+    // With a resize: scale so the shorter side has this length (aspect kept),
+    // then crop width x height. 0 scales straight to width x height.
+    int resize_short_side;
+    ImageCrop crop;
+    unsigned int seed;      // random crops: image b of a batch uses seed + b
+
+    // Per channel: value = (pixel / 255 - mean) / std. std 0 counts as 1.
+    float mean[4];
+    float std[4];
+} ImageBatchOptions;
+
+// Resizes, crops, normalizes and converts interleaved HWC bytes (channels as
+// in options) to CHW in one pass, written straight into the given column of
+// out (channels * height * width rows). Returns 0, or -1 if the image is
+// too small for the crop.
+int preprocess_image(const unsigned char *pixels, int width, int height,
+                     const ImageBatchOptions *options, unsigned int seed,
+                     Matrix *out, int column);
+
+// Decodes count images across the scheduler pool and preprocesses each one
+// into its column of out, which needs channels * height * width rows and at
+// least count columns. An image that fails leaves a zero column behind.
+// Returns the number decoded, or -1 for bad arguments.
+int read_image_batch(char **paths, int count, const ImageBatchOptions *options,
+                     Matrix *out);
+// Same, also setting status[b] to 1 if image b was decoded and 0 if not
+int read_image_batch_status(char **paths, int count,
+                            const ImageBatchOptions *options, Matrix *out,
+                            unsigned char *status);
+
+#endif
@@ -0,0 +1,55 @@
+#ifndef IMAGE_FOLDER_H
+#define IMAGE_FOLDER_H
+
+#include <stdint.h>
+
+#include "dataset.h"
+#include "image.h"
+
+// Image datasets laid out one folder per class, the way most of them are
+// distributed:
+//
+//   root/hotdog/1423.jpg
+//   root/hotdog/more/1424.jpg
+//   root/nothotdog/17.png
+//
+// Every subdirectory of root is a class, numbered in name order. Every image
+// file below it, at any depth, is a sample of that class. Hidden entries,
+// symlinked subdirectories and files without an image extension are
+// skipped.
+
+typedef struct {
+    int count;
+    char** paths;       // root/class/..., sorted within each class
+    int32_t* labels;    // class of each path
+    int class_count;
+    char** classes;     // subdirectory names, sorted
+} ImageFolder;
+
+// Scans root once. NULL if it can't be read or holds no images.
+ImageFolder* image_folder_scan(const char* root);
+void free_image_folder(ImageFolder* f);
+
+typedef struct {
+    int reused;         // copied from the previous cache file
+    int decoded;
+    int failed;         // could not be read or decoded, left out
+} ImageCacheStats;
+
+// The folder's images decoded, resized and cropped as in options, as a
+// uint8 dataset: channels * height * width features in CHW order that decode
+// to [0, 1] (scale 1/255), one-hot targets over the classes. Bytes can't
+// hold normalized values, so options' mean and std are not applied, and
+// random crops are refused since they differ on every pass.
+//
+// The dataset is the mapped cache_path, a dataset cache (dataset.h) with
+// the path, modification time and size of every image appended. An image
+// whose key matches the cache file from an earlier call with the same
+// options is copied from it instead of being decoded, and when nothing
+// changed the file is mapped as it is. stats may be NULL. Returns NULL on
+// failure.
+Dataset* image_folder_cache(const ImageFolder* f,
+                            const ImageBatchOptions* options,
+                            const char* cache_path, ImageCacheStats* stats);
+
+#endif
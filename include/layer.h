@@ -7,14 +7,28 @@ typedef struct Layer Layer;
 
 typedef Matrix* (*ForwardFunction)(struct Layer *l, Matrix *input);
 typedef Matrix* (*BackwardFunction)(struct Layer* l, Matrix* error_gradient, float learning);
+typedef void (*FreeStateFunction)(struct Layer *l);
+// Output shape for an input of rows x columns. columns is the batch (times
+// seq_len for sequences) and is 0 when only the rows are known, the output
+// columns are then 0 too. Returns 0, or -1 with a message when the layer
+// can't take that input.
+typedef int (*InferShapeFunction)(struct Layer *l, int rows, int columns, int *out_rows, int *out_columns);
+// Bytes the layer keeps alive between forward and backward for an input of
+// rows x columns: saved activations and scratch, not the returned output or
+// the parameters.
+typedef size_t (*WorkspaceSizeFunction)(struct Layer *l, int rows, int columns);
 
 
 struct Layer{
 
     ForwardFunction forward;
     BackwardFunction backward;
+    InferShapeFunction infer_shape;
+    WorkspaceSizeFunction workspace_size;
 
     Matrix *inputs;
+    // Set instead of inputs after layer_forward_bytes
+    ByteMatrix *byte_inputs;
     Matrix *weights;
     Matrix *bias;
     Matrix *output;
@@ -25,6 +39,11 @@ struct Layer{
     int input_n;
     int output_n;
 
+    // Layer specific buffers (saved statistics, caches, ...) that don't fit
+    // the weights/bias model. Released by free_state when not NULL.
+    void *state;
+    FreeStateFunction free_state;
+
     char *name; // FOR REFERENCE ONLY
 };
 
@@ -32,10 +51,40 @@ struct Layer{
 Layer* layer_create_dense(int input_n, int output_n);
 Layer* layer_create_sigmoid();
 Layer* layer_create_relu();
+Layer* layer_create_layernorm(int features);
+Layer* layer_create_embedding(int vocab_size, int embedding_dim);
+Layer* layer_create_lstm(int input_n, int hidden_n, int seq_len, int return_sequences);
+Layer* layer_create_gru(int input_n, int hidden_n, int seq_len, int return_sequences);
+Layer* layer_create_attention(int d_model, int heads, int seq_len);
+Layer* layer_create_depthwise_conv(int channels, int height, int width, int kernel, int stride, int padding);
+Layer* layer_create_pointwise_conv(int in_channels, int out_channels, int height, int width);
+
+// Fuse a with the layer after it: Dense+ReLU / Dense+Sigmoid always,
+// Dense+Dense into one pre-multiplied Dense when inference_only. On success
+// both inputs are consumed and the fused layer is returned, else NULL and
+// neither is touched.
+Layer* layer_fuse(Layer *a, Layer *b, int inference_only);
 
 void free_layer(Layer *layer);
+int layer_infer_shape(Layer *l, int rows, int columns, int *out_rows, int *out_columns);
+size_t layer_workspace_size(Layer *l, int rows, int columns);
+// Drop the stored inputs/output; the next forward recreates them
+void layer_release_activations(Layer *l);
+
+// A replica runs the same kernels on the original's weights and bias but has
+// its own gradients and activations, so several threads can run forward and
+// backward (with learning rate 0) at once. Layers with private state can't
+// be replicated. Free with layer_free_replica, never free_layer.
+Layer* layer_create_replica(Layer *l);
+void layer_free_replica(Layer *r);
 Matrix* layer_forward(Layer *l, Matrix *input);
 Matrix* layer_backward(Layer* l, Matrix* error_gradient, float learning_rate);
+// Forward of a Dense layer (plain or fused with an activation) on byte
+// input, dequantized inside the matrix multiply so the input is never
+// expanded to floats. The bytes are kept for backward, which trains the
+// layer as usual but returns NULL instead of an input gradient. For the
+// first layer of a network only.
+Matrix* layer_forward_bytes(Layer *l, ByteMatrix *input);
 
 void print_layer_info(Layer *l);
 #endif
\ No newline at end of file
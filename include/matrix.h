@@ -12,11 +12,36 @@ typedef struct {
   float *data;
 } Matrix;
 
+// Bytes standing for data * scale + offset, e.g. raw pixels with scale
+// 1/255: the same values as a Matrix in a quarter of the memory
+typedef struct {
+  int rows;
+  int columns;
+  unsigned char *data;
+  float scale;
+  float offset;
+} ByteMatrix;
+
 Matrix *create_matrix(int rows, int columns);
 void free_matrix(Matrix *m);
+ByteMatrix *create_byte_matrix(int rows, int columns, float scale,
+                               float offset);
+void free_byte_matrix(ByteMatrix *m);
+ByteMatrix *copy_byte_matrix(ByteMatrix *m);
 void randomize_matrix(Matrix *m);
 void print_matrix(Matrix *m);
 Matrix *multiply_mat(Matrix *m1, Matrix *m2);
+// C = alpha * op(A) * op(B) + beta * C on raw row-major buffers, where op(A)
+// is (m x k), op(B) is (k x n) and lda/ldb/ldc are row strides. Lets callers
+// multiply sub-blocks (time steps, heads, ...) without copying them out.
+void gemm(int trans_a, int trans_b, int m, int n, int k, float alpha,
+          const float *a, int lda, const float *b, int ldb, float beta,
+          float *c, int ldc);
+// gemm with B stored as bytes and dequantized inside the kernel:
+// C = alpha * op(A) * (scale * op(B) + offset) + beta * C
+void gemm_u8(int trans_a, int trans_b, int m, int n, int k, float alpha,
+             const float *a, int lda, const unsigned char *b, int ldb,
+             float scale, float offset, float beta, float *c, int ldc);
 void add_scaler(Matrix *m, float scaler);
 void subtract_scaler(Matrix *m, float scaler);
 void add_matrix(Matrix *m1, Matrix *m2);
@@ -24,7 +49,13 @@ Matrix *subtract_matrix(Matrix *m1, Matrix *m2);
 void matrix_sigmoid(Matrix *m);
 void zero_matrix(Matrix *m);
 void scale_matrix(Matrix *m, float scaler);
+// param = param - learning_rate * grad, grad is left untouched. A zero
+// learning rate writes nothing, so gradients can be computed on shared
+// weights without touching them.
+void sgd_update(Matrix *param, Matrix *grad, float learning_rate);
 Matrix *copy_matrix(Matrix *m);
 Matrix *transpose_mat(Matrix *m);
 int argmax(Matrix *m);
+// Row of the largest value in one column, the class of one sample in a batch
+int argmax_column(Matrix *m, int column);
 #endif
\ No newline at end of file
@@ -8,13 +8,48 @@ typedef struct Network Network;
 struct Network {
     Layer **layers;
     int layer_count;
+
+    // Rows the first layer takes and the last one produces, propagated by
+    // add_layer. 0 while unknown (only shape-agnostic layers so far); input
+    // rows stay -1, any, after a row-agnostic layer that changes the row
+    // count, such as an Embedding.
+    int input_rows;
+    int output_rows;
+
+    // Gradient checkpointing: ascending layer indices whose input activation
+    // is kept during training. Everything else is recomputed in backward.
+    // No checkpoints means every layer keeps its activations (the default).
+    int *checkpoints;
+    int checkpoint_count;
 };
 
 Network* create_network();
-void add_layer(Network *n, Layer *l);
+// Checks that l takes what the network produces so far. Returns 0, or -1 if
+// the shapes don't fit, in which case l is freed and not added.
+int add_layer(Network *n, Layer *l);
 void free_network(Network *n);
 void train_network(Network *n, Matrix *inputs, Matrix* targets, float learning_rate);
 Matrix* predict_network(Network *n, Matrix *input);
+// Same on byte input, e.g. raw pixels, which the first layer (a Dense layer,
+// see layer_forward_bytes) dequantizes inside its matrix multiply. Byte
+// training ignores checkpoints.
+void train_network_bytes(Network *n, ByteMatrix *inputs, Matrix *targets, float learning_rate);
+Matrix* predict_network_bytes(Network *n, ByteMatrix *input);
+
+// Keep activations only at the given layer boundaries (boundary k is the
+// input of layer k, 0 is always kept) and recompute the segments in between
+// during backward. count 0 turns checkpointing off.
+void network_set_checkpoints(Network *n, const int *boundaries, int count);
+// Checkpoint every ceil(sqrt(layer_count)) layers
+void network_auto_checkpoints(Network *n);
+// Replaces fusible layer sequences with fused layers and prints each fusion.
+// Dense+Dense merging is only done when inference_only is set. Checkpoints
+// move with their layers; one that ends up inside a fused layer is dropped.
+// Returns the number of fusions.
+int optimize_network(Network *n, int inference_only);
+// Bytes kept alive by one training step on batch columns: every layer's
+// workspace plus the largest input/output pair in flight. 0 on a mismatch.
+size_t network_workspace_size(Network *n, int batch);
 void print_network_info(Network *n);
 
 #endif
\ No newline at end of file
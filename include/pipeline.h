@@ -0,0 +1,35 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "network.h"
+
+// Pipeline-parallel streaming inference. The layer list is cut into
+// contiguous stages, and each stage runs on its own thread pinned to a core.
+// The stages are linked by lock-free single-producer/single-consumer queues,
+// so stage k works on sample i while stage k+1 works on sample i-1. Stage
+// boundaries are chosen from the per-layer forward cost measured on a sample
+// input, so that the slowest stage is as fast as possible.
+//
+// One thread submits and one thread receives (they may be the same one).
+// The network must stay alive and must not be used elsewhere while the
+// pipeline exists.
+
+typedef struct Pipeline Pipeline;
+
+// sample: a representative input used to time every layer. stages is clamped
+// to the number of layers. queue_capacity bounds the in-flight samples
+// between two stages.
+Pipeline* create_pipeline(Network *n, Matrix *sample, int stages, int queue_capacity);
+// Stops the stages. Results that were never received are freed.
+void free_pipeline(Pipeline *p);
+
+// Queues an input and takes ownership of it. Blocks while the first queue is
+// full. Returns 0, or -1 on a NULL input.
+int pipeline_submit(Pipeline *p, Matrix *input);
+// Next output in submission order, caller must free. Blocks until it is
+// ready. Returns NULL if a layer failed on that input.
+Matrix* pipeline_receive(Pipeline *p);
+
+void print_pipeline_info(Pipeline *p);
+
+#endif
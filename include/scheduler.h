@@ -0,0 +1,42 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+// Work-stealing task scheduler shared by the whole library. A fixed pool of
+// worker threads each own a deque of tasks. Owners push and pop at the
+// bottom, idle workers steal from the top of the others. A parallel region
+// splits its range in halves on demand, and the thread that opened it helps
+// run tasks until the region is done. A region opened inside a task only
+// adds tasks to the deques and never starts threads, so nested regions don't
+// oversubscribe the machine.
+
+// Body of a parallel loop over [begin, end)
+typedef void (*ParallelForFunction)(void *ctx, int begin, int end);
+
+// (Re)starts the pool with threads workers in total, counting the calling
+// thread. threads <= 0 uses one per online core, which is what the first
+// region does automatically. Must not be called while a region is running.
+// Returns the new size.
+int scheduler_init(int threads);
+// Stops and joins the workers; the next region restarts the pool
+void scheduler_shutdown();
+int scheduler_thread_count();
+
+// Runs fn over [begin, end) in chunks of at least grain iterations and
+// returns when every chunk is done. Small ranges run inline.
+void parallel_for(int begin, int end, int grain, ParallelForFunction fn, void *ctx);
+
+// Threads that already have a core to themselves (trainer replicas,
+// pipeline stages) set this so the regions they open run inline instead of
+// fanning out into the pool as well. Per thread; returns the previous value.
+int scheduler_run_inline(int enable);
+
+// Deterministic mode, process wide and off by default. Reductions that
+// would otherwise depend on the thread count (the data-parallel gradient
+// all-reduce, Hogwild) switch to a fixed partitioning and a fixed reduction
+// tree, so results are bitwise reproducible on any pool size. Work that is
+// already split into disjoint outputs, like gemm tiles and graph branches,
+// is deterministic in both modes. Returns the previous setting.
+int scheduler_set_deterministic(int enable);
+int scheduler_deterministic();
+
+#endif
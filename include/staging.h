@@ -0,0 +1,40 @@
+#ifndef STAGING_H
+#define STAGING_H
+
+#include "network.h"
+
+// Double-buffered (or deeper) input staging. A helper thread fills batch
+// i+1 into a ring of preallocated staging matrices while the caller computes
+// on batch i. The caller only waits when preparing a batch is slower than
+// computing one.
+
+// Fills up to inputs->columns samples, one per column, into inputs and
+// targets (targets is NULL when the stager was created with target_rows 0).
+// Returns the number of columns filled; fewer than a full batch is fine, 0
+// means the data is exhausted and -1 is an error. Runs on the helper thread.
+typedef int (*BatchProducer)(void *ctx, Matrix *inputs, Matrix *targets);
+
+typedef struct BatchStager BatchStager;
+
+// depth: staging buffers in the ring (at least 2). The helper thread starts
+// producing right away.
+BatchStager* create_batch_stager(int input_rows, int target_rows, int batch_size,
+                                 int depth, BatchProducer produce, void *ctx);
+// Stops the helper thread, also in the middle of the stream
+void free_batch_stager(BatchStager *s);
+
+// Blocks until the next batch is staged. inputs/targets point into the ring
+// and stay valid until batch_stager_release (or the next call). A short last
+// batch has fewer columns. Returns the column count, 0 at the end of the
+// data, -1 if the producer failed.
+int batch_stager_next(BatchStager *s, Matrix **inputs, Matrix **targets);
+// Hands the current buffers back to the helper thread for refilling
+void batch_stager_release(BatchStager *s);
+
+// Seconds batch_stager_next spent waiting for the helper thread
+double batch_stager_wait_seconds(BatchStager *s);
+
+// Trains on every batch of the stager. Returns the number of samples.
+int train_network_staged(Network *n, BatchStager *s, float learning_rate);
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include "dataset.h"
+
+// Streams a dataset cache file (dataset.h) that need not fit in memory.
+// A reader thread reads it in large sequential chunks into a bounded ring
+// of prefetch buffers, running ahead of training and on into the next
+// epoch. Batches are drawn from a shuffle window: a fixed number of samples
+// that every new sample from the file replaces one of at random, so the
+// order is random within about the window size while the file is still
+// read front to back. With shuffling the chunks are also visited in a new
+// random order each epoch.
+//
+// Use it as the BatchProducer of a BatchStager (staging.h) so batches are
+// assembled on the staging thread as well.
+
+typedef struct {
+    int chunk_samples;  // samples per read, 0: about 4 MB
+    int prefetch;       // chunks read ahead, 0: 4
+    int window;         // samples in the shuffle window, 0: 4 chunks
+    int direct;         // O_DIRECT reads past the page cache, where supported
+} DatasetStreamOptions;
+
+typedef struct DatasetStream DatasetStream;
+
+// options may be NULL for the defaults. Without shuffle the samples come in
+// file order. The reader thread starts right away.
+DatasetStream* create_dataset_stream(const char* path, int batch_size,
+                                     int shuffle, unsigned int seed,
+                                     const DatasetStreamOptions* options);
+void free_dataset_stream(DatasetStream* s);
+
+// Shape of the streamed data (features, target_size, count)
+const DatasetCacheLayout* dataset_stream_layout(const DatasetStream* s);
+
+// BatchProducer over the stream, ctx is the stream. Returns the samples
+// gathered, 0 at the end of an epoch (the next call starts the next one)
+// and -1 if reading failed.
+int dataset_stream_produce_batch(void* ctx, Matrix* inputs, Matrix* targets);
+
+// Seconds the producer spent waiting for the reader thread
+double dataset_stream_wait_seconds(DatasetStream* s);
+
+#endif
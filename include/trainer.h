@@ -0,0 +1,42 @@
+#ifndef TRAINER_H
+#define TRAINER_H
+
+#include "network.h"
+
+// Data-parallel mini-batch training. Each batch (features x batch) is split
+// by columns across the threads. Every thread runs forward/backward on a
+// replica of the network that shares the weights. The gradients are then
+// summed and applied in one SGD step. The result is the same step that
+// train_network takes on the whole batch.
+
+typedef struct DataParallelTrainer DataParallelTrainer;
+
+// With scheduler_set_deterministic(1) every batch is cut into this many
+// shards regardless of the thread count, and their gradients are summed in
+// a fixed pairwise tree. Costs this many extra copies of the gradients.
+#define TRAINER_DETERMINISTIC_SHARDS 16
+
+// The network must stay alive while the trainer exists. Returns NULL if a
+// layer can't be replicated (layers with private state).
+DataParallelTrainer* create_data_parallel_trainer(Network *n, int threads);
+void free_data_parallel_trainer(DataParallelTrainer *t);
+
+// One SGD step on the batch. Returns the summed squared error of the
+// predictions made before the step.
+float train_data_parallel(DataParallelTrainer *t, Matrix *inputs,
+                          Matrix *targets, float learning_rate);
+
+// Hogwild: one epoch of lock-free asynchronous SGD. The threads pull
+// mini-batches of batch_size columns from inputs and apply their updates
+// straight to the shared weights without locks, so concurrent updates may
+// overwrite each other. Shared parameters are only touched with relaxed
+// atomic loads and stores. Each step snapshots the weights, computes the
+// gradient on the snapshot and writes back the nonzero entries. Works best
+// for wide, sparse inputs where updates rarely collide. Same layer
+// restrictions as the data-parallel trainer. Returns the summed squared
+// error seen during the epoch. In deterministic mode the mini-batches run in
+// order on the calling thread.
+float train_hogwild(Network *n, Matrix *inputs, Matrix *targets, int threads,
+                    int batch_size, float learning_rate);
+
+#endif
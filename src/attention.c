@@ -0,0 +1,541 @@
+#include "../include/layer.h"
+
+// Multi-head self-attention over sequences laid out like the recurrent
+// layers: (d_model x seq_len*batch), token t of sample b in column t*batch+b.
+//
+// Scores are computed ATTENTION_TILE queries by ATTENTION_TILE keys at a time
+// with an online softmax, so the (seq_len x seq_len) score matrix never
+// exists. Forward keeps only the per-query log-sum-exp; backward recomputes
+// each tile of probabilities from it. Memory stays linear in seq_len.
+//
+// weights/bias hold the stacked Q, K, V projections (3*d_model x d_model),
+// the output projection lives in the state.
+
+#define ATTENTION_TILE 32
+
+typedef struct {
+  int heads;
+  int head_dim;
+  int seq_len;
+  int batch; // batch size the buffers below are sized for
+
+  Matrix *w_out;   // (d_model x d_model)
+  Matrix *b_out;   // (d_model x 1)
+  Matrix *d_w_out; // (d_model x d_model)
+  Matrix *d_b_out; // (d_model x 1)
+
+  Matrix *qkv;    // (3*d_model x T*B) projected queries, keys, values
+  Matrix *attn;   // (d_model x T*B) concatenated head outputs
+  Matrix *lse;    // (heads x T*B) per-query log-sum-exp of the scores
+  Matrix *d_qkv;  // (3*d_model x T*B)
+  Matrix *d_attn; // (d_model x T*B)
+
+  // Token-major (seq_len x head_dim) copies of one head of one sample:
+  // q, k, v, o, d_o, d_q, d_k, d_v
+  float *head;
+  float *row_max;  // (seq_len)
+  float *row_sum;  // (seq_len)
+  float *lse_row;  // (seq_len)
+  float *scores;   // (TILE x TILE)
+  float *d_scores; // (TILE x TILE)
+} AttentionState;
+
+static void _attention_free_buffers(AttentionState *s) {
+  free_matrix(s->qkv);
+  free_matrix(s->attn);
+  free_matrix(s->lse);
+  free_matrix(s->d_qkv);
+  free_matrix(s->d_attn);
+  s->qkv = NULL;
+  s->attn = NULL;
+  s->lse = NULL;
+  s->d_qkv = NULL;
+  s->d_attn = NULL;
+  s->batch = 0;
+}
+
+static void _attention_free_state(Layer *l) {
+  AttentionState *s = (AttentionState *)l->state;
+  if (s == NULL) {
+    return;
+  }
+  _attention_free_buffers(s);
+  free_matrix(s->w_out);
+  free_matrix(s->b_out);
+  free_matrix(s->d_w_out);
+  free_matrix(s->d_b_out);
+  free(s->head);
+  free(s->row_max);
+  free(s->row_sum);
+  free(s->lse_row);
+  free(s->scores);
+  free(s->d_scores);
+  free(s);
+  l->state = NULL;
+}
+
+static int _attention_ensure_buffers(AttentionState *s, int d_model,
+                                     int batch) {
+  if (s->batch == batch) {
+    return 0;
+  }
+  _attention_free_buffers(s);
+
+  int tb = s->seq_len * batch;
+  s->qkv = create_matrix(3 * d_model, tb);
+  s->attn = create_matrix(d_model, tb);
+  s->lse = create_matrix(s->heads, tb);
+  s->d_qkv = create_matrix(3 * d_model, tb);
+  s->d_attn = create_matrix(d_model, tb);
+  if (s->qkv == NULL || s->attn == NULL || s->lse == NULL ||
+      s->d_qkv == NULL || s->d_attn == NULL) {
+    _attention_free_buffers(s);
+    return -1;
+  }
+  s->batch = batch;
+  return 0;
+}
+
+// Copy rows [row, row + head_dim) of sample b into a token-major block
+static void _attention_gather(const Matrix *m, int row, int b, int batch,
+                              int seq_len, int head_dim, float *dst) {
+  int tb = m->columns;
+  for (int d = 0; d < head_dim; d++) {
+    const float *src = m->data + (row + d) * tb + b;
+    for (int t = 0; t < seq_len; t++) {
+      dst[t * head_dim + d] = src[t * batch];
+    }
+  }
+}
+
+static void _attention_scatter(Matrix *m, int row, int b, int batch,
+                               int seq_len, int head_dim, const float *src) {
+  int tb = m->columns;
+  for (int d = 0; d < head_dim; d++) {
+    float *dst = m->data + (row + d) * tb + b;
+    for (int t = 0; t < seq_len; t++) {
+      dst[t * batch] = src[t * head_dim + d];
+    }
+  }
+}
+
+static void _attention_add_bias(Matrix *m, const Matrix *bias) {
+  for (int r = 0; r < m->rows; r++) {
+    float *row = m->data + r * m->columns;
+    float b = bias->data[r];
+    for (int c = 0; c < m->columns; c++) {
+      row[c] += b;
+    }
+  }
+}
+
+static void _attention_row_sums(const Matrix *m, Matrix *out) {
+  for (int r = 0; r < m->rows; r++) {
+    const float *row = m->data + r * m->columns;
+    float sum = 0.0f;
+    for (int c = 0; c < m->columns; c++) {
+      sum += row[c];
+    }
+    out->data[r] = sum;
+  }
+}
+
+// One head of one sample: O = softmax(Q K^T * scale) V, tile by tile
+static void _attention_head_forward(AttentionState *s, float scale,
+                                    const float *q, const float *k,
+                                    const float *v, float *o, float *lse) {
+  int seq_len = s->seq_len;
+  int dh = s->head_dim;
+  float *m = s->row_max;
+  float *sum = s->row_sum;
+  float *p = s->scores;
+
+  for (int i = 0; i < seq_len; i++) {
+    m[i] = -INFINITY;
+    sum[i] = 0.0f;
+  }
+  for (int i = 0; i < seq_len * dh; i++) {
+    o[i] = 0.0f;
+  }
+
+  for (int q0 = 0; q0 < seq_len; q0 += ATTENTION_TILE) {
+    int nq = (seq_len - q0 < ATTENTION_TILE) ? seq_len - q0 : ATTENTION_TILE;
+
+    for (int k0 = 0; k0 < seq_len; k0 += ATTENTION_TILE) {
+      int nk = (seq_len - k0 < ATTENTION_TILE) ? seq_len - k0 : ATTENTION_TILE;
+
+      gemm(0, 1, nq, nk, dh, scale, q + q0 * dh, dh, k + k0 * dh, dh, 0.0f, p,
+           ATTENTION_TILE);
+
+      // Online softmax: rescale what was accumulated under the old max
+      for (int i = 0; i < nq; i++) {
+        float *p_row = p + i * ATTENTION_TILE;
+        float tile_max = p_row[0];
+        for (int j = 1; j < nk; j++) {
+          tile_max = (p_row[j] > tile_max) ? p_row[j] : tile_max;
+        }
+        float new_max = (tile_max > m[q0 + i]) ? tile_max : m[q0 + i];
+        float correction = expf(m[q0 + i] - new_max);
+
+        float tile_sum = 0.0f;
+        for (int j = 0; j < nk; j++) {
+          p_row[j] = expf(p_row[j] - new_max);
+          tile_sum += p_row[j];
+        }
+        sum[q0 + i] = sum[q0 + i] * correction + tile_sum;
+        m[q0 + i] = new_max;
+
+        float *o_row = o + (q0 + i) * dh;
+        for (int d = 0; d < dh; d++) {
+          o_row[d] *= correction;
+        }
+      }
+
+      gemm(0, 0, nq, dh, nk, 1.0f, p, ATTENTION_TILE, v + k0 * dh, dh, 1.0f,
+           o + q0 * dh, dh);
+    }
+
+    for (int i = q0; i < q0 + nq; i++) {
+      float inv = 1.0f / sum[i];
+      for (int d = 0; d < dh; d++) {
+        o[i * dh + d] *= inv;
+      }
+      lse[i] = m[i] + logf(sum[i]);
+    }
+  }
+}
+
+// One head of one sample, probabilities recomputed per tile from lse
+static void _attention_head_backward(AttentionState *s, float scale,
+                                     const float *q, const float *k,
+                                     const float *v, const float *o,
+                                     const float *d_o, const float *lse,
+                                     float *d_q, float *d_k, float *d_v) {
+  int seq_len = s->seq_len;
+  int dh = s->head_dim;
+  float *delta = s->row_sum;
+  float *p = s->scores;
+  float *dp = s->d_scores;
+
+  // delta_i = dO_i . O_i, the softmax Jacobian's correction term
+  for (int i = 0; i < seq_len; i++) {
+    float acc = 0.0f;
+    for (int d = 0; d < dh; d++) {
+      acc += d_o[i * dh + d] * o[i * dh + d];
+    }
+    delta[i] = acc;
+  }
+  for (int i = 0; i < seq_len * dh; i++) {
+    d_q[i] = 0.0f;
+    d_k[i] = 0.0f;
+    d_v[i] = 0.0f;
+  }
+
+  for (int k0 = 0; k0 < seq_len; k0 += ATTENTION_TILE) {
+    int nk = (seq_len - k0 < ATTENTION_TILE) ? seq_len - k0 : ATTENTION_TILE;
+
+    for (int q0 = 0; q0 < seq_len; q0 += ATTENTION_TILE) {
+      int nq = (seq_len - q0 < ATTENTION_TILE) ? seq_len - q0 : ATTENTION_TILE;
+
+      gemm(0, 1, nq, nk, dh, scale, q + q0 * dh, dh, k + k0 * dh, dh, 0.0f, p,
+           ATTENTION_TILE);
+      for (int i = 0; i < nq; i++) {
+        float *p_row = p + i * ATTENTION_TILE;
+        for (int j = 0; j < nk; j++) {
+          p_row[j] = expf(p_row[j] - lse[q0 + i]);
+        }
+      }
+
+      // dV += P^T dO
+      gemm(1, 0, nk, dh, nq, 1.0f, p, ATTENTION_TILE, d_o + q0 * dh, dh, 1.0f,
+           d_v + k0 * dh, dh);
+
+      // dS = P * (dO V^T - delta)
+      gemm(0, 1, nq, nk, dh, 1.0f, d_o + q0 * dh, dh, v + k0 * dh, dh, 0.0f,
+           dp, ATTENTION_TILE);
+      for (int i = 0; i < nq; i++) {
+        float *p_row = p + i * ATTENTION_TILE;
+        float *dp_row = dp + i * ATTENTION_TILE;
+        for (int j = 0; j < nk; j++) {
+          dp_row[j] = p_row[j] * (dp_row[j] - delta[q0 + i]);
+        }
+      }
+
+      // dQ += dS K * scale, dK += dS^T Q * scale
+      gemm(0, 0, nq, dh, nk, scale, dp, ATTENTION_TILE, k + k0 * dh, dh, 1.0f,
+           d_q + q0 * dh, dh);
+      gemm(1, 0, nk, dh, nq, scale, dp, ATTENTION_TILE, q + q0 * dh, dh, 1.0f,
+           d_k + k0 * dh, dh);
+    }
+  }
+}
+
+Matrix *_layer_forward_attention(Layer *l, Matrix *input) {
+  AttentionState *s = (AttentionState *)l->state;
+  int d_model = l->input_n;
+
+  if (input == NULL || input->rows != d_model ||
+      input->columns % s->seq_len != 0) {
+    fprintf(stderr,
+            "Error: attention expects (%d x seq_len*batch) input with "
+            "seq_len %d, got (%d, %d)\n",
+            d_model, s->seq_len, input == NULL ? -1 : input->rows,
+            input == NULL ? -1 : input->columns);
+    return NULL;
+  }
+
+  int batch = input->columns / s->seq_len;
+  int tb = input->columns;
+  if (_attention_ensure_buffers(s, d_model, batch) != 0) {
+    return NULL;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  l->inputs = copy_matrix(input);
+
+  // Q, K and V for every token in one GEMM
+  gemm(0, 0, 3 * d_model, tb, d_model, 1.0f, l->weights->data, d_model,
+       input->data, tb, 0.0f, s->qkv->data, tb);
+  _attention_add_bias(s->qkv, l->bias);
+
+  int dh = s->head_dim;
+  int block = s->seq_len * dh;
+  float scale = 1.0f / sqrtf((float)dh);
+  float *q = s->head;
+  float *k = q + block;
+  float *v = k + block;
+  float *o = v + block;
+  float *lse = s->lse_row;
+
+  for (int b = 0; b < batch; b++) {
+    for (int h = 0; h < s->heads; h++) {
+      _attention_gather(s->qkv, h * dh, b, batch, s->seq_len, dh, q);
+      _attention_gather(s->qkv, d_model + h * dh, b, batch, s->seq_len, dh, k);
+      _attention_gather(s->qkv, 2 * d_model + h * dh, b, batch, s->seq_len, dh,
+                        v);
+
+      _attention_head_forward(s, scale, q, k, v, o, lse);
+
+      _attention_scatter(s->attn, h * dh, b, batch, s->seq_len, dh, o);
+      for (int t = 0; t < s->seq_len; t++) {
+        s->lse->data[h * tb + t * batch + b] = lse[t];
+      }
+    }
+  }
+
+  // Output projection
+  Matrix *out = create_matrix(d_model, tb);
+  if (out == NULL) {
+    return NULL;
+  }
+  gemm(0, 0, d_model, tb, d_model, 1.0f, s->w_out->data, d_model,
+       s->attn->data, tb, 0.0f, out->data, tb);
+  _attention_add_bias(out, s->b_out);
+
+  return out;
+}
+
+Matrix *_layer_backward_attention(Layer *l, Matrix *error_gradient,
+                                  float learning_rate) {
+  AttentionState *s = (AttentionState *)l->state;
+  int d_model = l->input_n;
+
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_attention\n");
+    return NULL;
+  }
+  if (error_gradient->rows != d_model ||
+      error_gradient->columns != l->inputs->columns) {
+    fprintf(stderr,
+            "Error: attention gradient (%d,%d) does not match output (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, d_model,
+            l->inputs->columns);
+    return NULL;
+  }
+
+  int batch = s->batch;
+  int tb = l->inputs->columns;
+
+  // Output projection: dAttn = W_o^T dY, dW_o = dY Attn^T
+  gemm(1, 0, d_model, tb, d_model, 1.0f, s->w_out->data, d_model,
+       error_gradient->data, tb, 0.0f, s->d_attn->data, tb);
+  gemm(0, 1, d_model, d_model, tb, 1.0f, error_gradient->data, tb,
+       s->attn->data, tb, 0.0f, s->d_w_out->data, d_model);
+  _attention_row_sums(error_gradient, s->d_b_out);
+
+  int dh = s->head_dim;
+  int block = s->seq_len * dh;
+  float scale = 1.0f / sqrtf((float)dh);
+  float *q = s->head;
+  float *k = q + block;
+  float *v = k + block;
+  float *o = v + block;
+  float *d_o = o + block;
+  float *d_q = d_o + block;
+  float *d_k = d_q + block;
+  float *d_v = d_k + block;
+  float *lse = s->lse_row;
+
+  for (int b = 0; b < batch; b++) {
+    for (int h = 0; h < s->heads; h++) {
+      _attention_gather(s->qkv, h * dh, b, batch, s->seq_len, dh, q);
+      _attention_gather(s->qkv, d_model + h * dh, b, batch, s->seq_len, dh, k);
+      _attention_gather(s->qkv, 2 * d_model + h * dh, b, batch, s->seq_len, dh,
+                        v);
+      _attention_gather(s->attn, h * dh, b, batch, s->seq_len, dh, o);
+      _attention_gather(s->d_attn, h * dh, b, batch, s->seq_len, dh, d_o);
+      for (int t = 0; t < s->seq_len; t++) {
+        lse[t] = s->lse->data[h * tb + t * batch + b];
+      }
+
+      _attention_head_backward(s, scale, q, k, v, o, d_o, lse, d_q, d_k, d_v);
+
+      _attention_scatter(s->d_qkv, h * dh, b, batch, s->seq_len, dh, d_q);
+      _attention_scatter(s->d_qkv, d_model + h * dh, b, batch, s->seq_len, dh,
+                         d_k);
+      _attention_scatter(s->d_qkv, 2 * d_model + h * dh, b, batch, s->seq_len,
+                         dh, d_v);
+    }
+  }
+
+  // dW_qkv = dQKV X^T, dX = W_qkv^T dQKV from the pre-update weights
+  gemm(0, 1, 3 * d_model, d_model, tb, 1.0f, s->d_qkv->data, tb,
+       l->inputs->data, tb, 0.0f, l->d_weight->data, d_model);
+  _attention_row_sums(s->d_qkv, l->d_bias);
+
+  Matrix *input_grad = create_matrix(d_model, tb);
+  if (input_grad == NULL) {
+    return NULL;
+  }
+  gemm(1, 0, d_model, tb, 3 * d_model, 1.0f, l->weights->data, d_model,
+       s->d_qkv->data, tb, 0.0f, input_grad->data, tb);
+
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
+  sgd_update(s->w_out, s->d_w_out, learning_rate);
+  sgd_update(s->b_out, s->d_b_out, learning_rate);
+
+  return input_grad;
+}
+
+static int _attention_infer_shape(Layer *l, int rows, int columns,
+                                  int *out_rows, int *out_columns) {
+  AttentionState *s = (AttentionState *)l->state;
+  if (rows != l->input_n) {
+    fprintf(stderr, "Error: attention expects %d input rows, got %d\n",
+            l->input_n, rows);
+    return -1;
+  }
+  if (columns % s->seq_len != 0) {
+    fprintf(stderr,
+            "Error: attention columns %d are not a multiple of seq_len %d\n",
+            columns, s->seq_len);
+    return -1;
+  }
+  *out_rows = rows;
+  *out_columns = columns;
+  return 0;
+}
+
+// Stored input, the per-batch buffers of _attention_ensure_buffers and the
+// fixed per-head tiles
+static size_t _attention_workspace_size(Layer *l, int rows, int columns) {
+  AttentionState *s = (AttentionState *)l->state;
+  size_t tb = (size_t)columns;
+  size_t floats = rows * tb;
+  floats += (3 * (size_t)rows + rows + s->heads) * tb; // qkv, attn, lse
+  floats += (3 * (size_t)rows + rows) * tb;            // d_qkv, d_attn
+  floats += 8 * (size_t)s->seq_len * s->head_dim + 3 * (size_t)s->seq_len;
+  floats += 2 * ATTENTION_TILE * ATTENTION_TILE;
+  return sizeof(float) * floats;
+}
+
+Layer *layer_create_attention(int d_model, int heads, int seq_len) {
+  if (heads <= 0 || d_model % heads != 0) {
+    fprintf(stderr, "Error: d_model %d is not divisible by %d heads\n",
+            d_model, heads);
+    return NULL;
+  }
+
+  Layer *l = (Layer *)malloc(sizeof(Layer));
+
+  if (l == NULL) {
+    perror("Could Not allocate memory for layer. NULL");
+    return NULL;
+  }
+
+  AttentionState *s = (AttentionState *)calloc(1, sizeof(AttentionState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for attention state. NULL");
+    free(l);
+    return NULL;
+  }
+  s->heads = heads;
+  s->head_dim = d_model / heads;
+  s->seq_len = seq_len;
+
+  l->forward = _layer_forward_attention;
+  l->backward = _layer_backward_attention;
+  l->infer_shape = _attention_infer_shape;
+  l->workspace_size = _attention_workspace_size;
+
+  l->weights = create_matrix(3 * d_model, d_model);
+  l->bias = create_matrix(3 * d_model, 1);
+  l->d_weight = create_matrix(3 * d_model, d_model);
+  l->d_bias = create_matrix(3 * d_model, 1);
+  s->w_out = create_matrix(d_model, d_model);
+  s->b_out = create_matrix(d_model, 1);
+  s->d_w_out = create_matrix(d_model, d_model);
+  s->d_b_out = create_matrix(d_model, 1);
+
+  int block = seq_len * s->head_dim;
+  s->head = malloc(sizeof(float) * 8 * block);
+  s->row_max = malloc(sizeof(float) * seq_len);
+  s->row_sum = malloc(sizeof(float) * seq_len);
+  s->lse_row = malloc(sizeof(float) * seq_len);
+  s->scores = malloc(sizeof(float) * ATTENTION_TILE * ATTENTION_TILE);
+  s->d_scores = malloc(sizeof(float) * ATTENTION_TILE * ATTENTION_TILE);
+
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+
+  l->state = s;
+  l->free_state = _attention_free_state;
+
+  if (l->weights == NULL || l->bias == NULL || l->d_weight == NULL ||
+      l->d_bias == NULL || s->w_out == NULL || s->b_out == NULL ||
+      s->d_w_out == NULL || s->d_b_out == NULL || s->head == NULL ||
+      s->row_max == NULL || s->row_sum == NULL || s->lse_row == NULL ||
+      s->scores == NULL || s->d_scores == NULL) {
+    perror("Could Not allocate memory for attention weights. NULL");
+    free_layer(l);
+    return NULL;
+  }
+
+  // Uniform in +-sqrt(1 / d_model), centered at 0
+  float scale = sqrtf(1.0f / (float)d_model);
+  for (int i = 0; i < 3 * d_model * d_model; i++) {
+    l->weights->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale;
+  }
+  for (int i = 0; i < d_model * d_model; i++) {
+    s->w_out->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale;
+  }
+  zero_matrix(l->bias);
+  zero_matrix(s->b_out);
+  zero_matrix(l->d_weight);
+  zero_matrix(l->d_bias);
+  zero_matrix(s->d_w_out);
+  zero_matrix(s->d_b_out);
+
+  l->input_n = d_model;
+  l->output_n = d_model;
+
+  l->name = "Attention";
+  return l;
+}
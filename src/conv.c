@@ -0,0 +1,408 @@
+#include "../include/layer.h"
+
+// Images are stored channel-major per column: (channels*height*width x batch),
+// pixel (c, y, x) of sample b at ((c*height + y)*width + x)*batch + b.
+//
+// With that layout the innermost loops of the depthwise kernel walk
+// contiguous memory, and a 1x1 pointwise conv is a plain GEMM over the
+// (channels x height*width*batch) view of the same buffer.
+
+typedef struct {
+  int channels;
+  int height;
+  int width;
+  int kernel;
+  int stride;
+  int padding;
+  int out_h;
+  int out_w;
+} DepthwiseState;
+
+typedef struct {
+  int in_channels;
+  int out_channels;
+  int spatial; // height * width
+} PointwiseState;
+
+static void _conv_free_state(Layer *l) {
+  free(l->state);
+  l->state = NULL;
+}
+
+// Output columns ox in [*ox0, *ox1) whose input column for tap kx is in range
+static void _depthwise_valid_range(const DepthwiseState *s, int kx, int *ox0,
+                                   int *ox1) {
+  int lo = s->padding - kx;
+  *ox0 = (lo > 0) ? (lo + s->stride - 1) / s->stride : 0;
+
+  int hi = s->width - 1 + s->padding - kx;
+  *ox1 = (hi < 0) ? 0 : hi / s->stride + 1;
+  if (*ox1 > s->out_w) {
+    *ox1 = s->out_w;
+  }
+}
+
+Matrix *_layer_forward_depthwise(Layer *l, Matrix *input) {
+  DepthwiseState *s = (DepthwiseState *)l->state;
+
+  if (input == NULL || input->rows != l->input_n) {
+    fprintf(stderr, "Error: depthwise conv expects %d rows, got %d\n",
+            l->input_n, input == NULL ? -1 : input->rows);
+    return NULL;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  l->inputs = copy_matrix(input);
+
+  int batch = input->columns;
+  int k = s->kernel;
+  int out_plane = s->out_h * s->out_w * batch;
+
+  Matrix *out = create_matrix(l->output_n, batch);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  for (int c = 0; c < s->channels; c++) {
+    float *restrict dst_c = out->data + c * out_plane;
+    const float *src_c = input->data + c * s->height * s->width * batch;
+
+    float bias = l->bias->data[c];
+    for (int i = 0; i < out_plane; i++) {
+      dst_c[i] = bias;
+    }
+
+    for (int ky = 0; ky < k; ky++) {
+      for (int kx = 0; kx < k; kx++) {
+        float w = l->weights->data[(c * k + ky) * k + kx];
+        int ox0, ox1;
+        _depthwise_valid_range(s, kx, &ox0, &ox1);
+        if (ox0 >= ox1) {
+          continue;
+        }
+        // Stride 1 maps a run of output columns onto a run of input columns,
+        // so the whole row is one contiguous multiply-add.
+        int step = (s->stride == 1) ? ox1 - ox0 : 1;
+        int len = step * batch;
+
+        for (int oy = 0; oy < s->out_h; oy++) {
+          int iy = oy * s->stride - s->padding + ky;
+          if (iy < 0 || iy >= s->height) {
+            continue;
+          }
+          for (int ox = ox0; ox < ox1; ox += step) {
+            int ix = ox * s->stride - s->padding + kx;
+            const float *restrict src = src_c + (iy * s->width + ix) * batch;
+            float *restrict dst = dst_c + (oy * s->out_w + ox) * batch;
+            for (int i = 0; i < len; i++) {
+              dst[i] += w * src[i];
+            }
+          }
+        }
+      }
+    }
+  }
+
+  return out;
+}
+
+Matrix *_layer_backward_depthwise(Layer *l, Matrix *error_gradient,
+                                  float learning_rate) {
+  DepthwiseState *s = (DepthwiseState *)l->state;
+
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_depthwise\n");
+    return NULL;
+  }
+  if (error_gradient->rows != l->output_n ||
+      error_gradient->columns != l->inputs->columns) {
+    fprintf(stderr,
+            "Error: depthwise gradient (%d,%d) does not match output (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, l->output_n,
+            l->inputs->columns);
+    return NULL;
+  }
+
+  int batch = l->inputs->columns;
+  int k = s->kernel;
+  int in_plane = s->height * s->width * batch;
+  int out_plane = s->out_h * s->out_w * batch;
+
+  Matrix *input_grad = create_matrix(l->input_n, batch);
+  if (input_grad == NULL) {
+    return NULL;
+  }
+  zero_matrix(input_grad);
+
+  for (int c = 0; c < s->channels; c++) {
+    const float *dy_c = error_gradient->data + c * out_plane;
+    const float *x_c = l->inputs->data + c * in_plane;
+    float *dx_c = input_grad->data + c * in_plane;
+
+    float d_bias = 0.0f;
+    for (int i = 0; i < out_plane; i++) {
+      d_bias += dy_c[i];
+    }
+    l->d_bias->data[c] = d_bias;
+
+    for (int ky = 0; ky < k; ky++) {
+      for (int kx = 0; kx < k; kx++) {
+        int w_idx = (c * k + ky) * k + kx;
+        float w = l->weights->data[w_idx];
+        float d_w = 0.0f;
+        int ox0, ox1;
+        _depthwise_valid_range(s, kx, &ox0, &ox1);
+        int step = (s->stride == 1) ? ox1 - ox0 : 1;
+        int len = step * batch;
+
+        for (int oy = 0; oy < s->out_h && ox0 < ox1; oy++) {
+          int iy = oy * s->stride - s->padding + ky;
+          if (iy < 0 || iy >= s->height) {
+            continue;
+          }
+          for (int ox = ox0; ox < ox1; ox += step) {
+            int ix = ox * s->stride - s->padding + kx;
+            int in_off = (iy * s->width + ix) * batch;
+            const float *restrict x = x_c + in_off;
+            float *restrict dx = dx_c + in_off;
+            const float *restrict dy = dy_c + (oy * s->out_w + ox) * batch;
+            for (int i = 0; i < len; i++) {
+              d_w += dy[i] * x[i];
+              dx[i] += w * dy[i];
+            }
+          }
+        }
+        l->d_weight->data[w_idx] = d_w;
+      }
+    }
+  }
+
+  // W = w - lr*dW, B = b - lr*dB
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
+
+  return input_grad;
+}
+
+Matrix *_layer_forward_pointwise(Layer *l, Matrix *input) {
+  PointwiseState *s = (PointwiseState *)l->state;
+
+  if (input == NULL || input->rows != l->input_n) {
+    fprintf(stderr, "Error: pointwise conv expects %d rows, got %d\n",
+            l->input_n, input == NULL ? -1 : input->rows);
+    return NULL;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  l->inputs = copy_matrix(input);
+
+  int plane = s->spatial * input->columns;
+  Matrix *out = create_matrix(l->output_n, input->columns);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  // (out_c x in_c) * (in_c x H*W*batch): the input is already in that shape
+  gemm(0, 0, s->out_channels, plane, s->in_channels, 1.0f, l->weights->data,
+       s->in_channels, input->data, plane, 0.0f, out->data, plane);
+
+  for (int c = 0; c < s->out_channels; c++) {
+    float *row = out->data + c * plane;
+    float bias = l->bias->data[c];
+    for (int i = 0; i < plane; i++) {
+      row[i] += bias;
+    }
+  }
+
+  return out;
+}
+
+Matrix *_layer_backward_pointwise(Layer *l, Matrix *error_gradient,
+                                  float learning_rate) {
+  PointwiseState *s = (PointwiseState *)l->state;
+
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_pointwise\n");
+    return NULL;
+  }
+  if (error_gradient->rows != l->output_n ||
+      error_gradient->columns != l->inputs->columns) {
+    fprintf(stderr,
+            "Error: pointwise gradient (%d,%d) does not match output (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, l->output_n,
+            l->inputs->columns);
+    return NULL;
+  }
+
+  int plane = s->spatial * l->inputs->columns;
+
+  // dW = dY X^T
+  gemm(0, 1, s->out_channels, s->in_channels, plane, 1.0f,
+       error_gradient->data, plane, l->inputs->data, plane, 0.0f,
+       l->d_weight->data, s->in_channels);
+
+  for (int c = 0; c < s->out_channels; c++) {
+    const float *row = error_gradient->data + c * plane;
+    float sum = 0.0f;
+    for (int i = 0; i < plane; i++) {
+      sum += row[i];
+    }
+    l->d_bias->data[c] = sum;
+  }
+
+  // dX = W^T dY from the pre-update weights
+  Matrix *input_grad = create_matrix(l->input_n, l->inputs->columns);
+  if (input_grad == NULL) {
+    return NULL;
+  }
+  gemm(1, 0, s->in_channels, plane, s->out_channels, 1.0f, l->weights->data,
+       s->in_channels, error_gradient->data, plane, 0.0f, input_grad->data,
+       plane);
+
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
+
+  return input_grad;
+}
+
+// Both convolutions take and produce whole images of a fixed geometry
+static int _conv_infer_shape(Layer *l, int rows, int columns, int *out_rows,
+                             int *out_columns) {
+  if (rows != l->input_n) {
+    fprintf(stderr, "Error: %s layer expects %d input rows, got %d\n", l->name,
+            l->input_n, rows);
+    return -1;
+  }
+  *out_rows = l->output_n;
+  *out_columns = columns;
+  return 0;
+}
+
+// The stored input copy
+static size_t _conv_workspace_size(Layer *l, int rows, int columns) {
+  return sizeof(float) * (size_t)rows * columns;
+}
+
+static Layer *_layer_create_conv(int weight_rows, int weight_cols, int fan_in,
+                                 int fan_out) {
+  Layer *l = (Layer *)malloc(sizeof(Layer));
+
+  if (l == NULL) {
+    perror("Could Not allocate memory for layer. NULL");
+    return NULL;
+  }
+
+  l->weights = create_matrix(weight_rows, weight_cols);
+  l->bias = create_matrix(weight_rows, 1);
+  l->d_weight = create_matrix(weight_rows, weight_cols);
+  l->d_bias = create_matrix(weight_rows, 1);
+
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+
+  l->state = NULL;
+  l->free_state = _conv_free_state;
+  l->infer_shape = _conv_infer_shape;
+  l->workspace_size = _conv_workspace_size;
+
+  if (l->weights == NULL || l->bias == NULL || l->d_weight == NULL ||
+      l->d_bias == NULL) {
+    perror("Could Not allocate memory for conv weights. NULL");
+    free_layer(l);
+    return NULL;
+  }
+
+  // Xavier initialization: scale by sqrt(2 / (fan_in + fan_out)), centered at 0
+  float scale = sqrtf(2.0f / (float)(fan_in + fan_out));
+  for (int i = 0; i < weight_rows * weight_cols; i++) {
+    l->weights->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale;
+  }
+  zero_matrix(l->bias);
+  zero_matrix(l->d_weight);
+  zero_matrix(l->d_bias);
+
+  return l;
+}
+
+Layer *layer_create_depthwise_conv(int channels, int height, int width,
+                                   int kernel, int stride, int padding) {
+  int out_h = (height + 2 * padding - kernel) / stride + 1;
+  int out_w = (width + 2 * padding - kernel) / stride + 1;
+  if (kernel <= 0 || stride <= 0 || padding < 0 || out_h <= 0 || out_w <= 0) {
+    fprintf(stderr,
+            "Error: invalid depthwise geometry %dx%d, kernel %d, stride %d, "
+            "padding %d\n",
+            height, width, kernel, stride, padding);
+    return NULL;
+  }
+
+  DepthwiseState *s = (DepthwiseState *)malloc(sizeof(DepthwiseState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for depthwise state. NULL");
+    return NULL;
+  }
+  s->channels = channels;
+  s->height = height;
+  s->width = width;
+  s->kernel = kernel;
+  s->stride = stride;
+  s->padding = padding;
+  s->out_h = out_h;
+  s->out_w = out_w;
+
+  // One (kernel x kernel) filter per channel, stored as a row
+  Layer *l = _layer_create_conv(channels, kernel * kernel, kernel * kernel,
+                                kernel * kernel);
+  if (l == NULL) {
+    free(s);
+    return NULL;
+  }
+  l->state = s;
+
+  l->forward = _layer_forward_depthwise;
+  l->backward = _layer_backward_depthwise;
+
+  l->input_n = channels * height * width;
+  l->output_n = channels * out_h * out_w;
+
+  l->name = "DepthwiseConv";
+  return l;
+}
+
+Layer *layer_create_pointwise_conv(int in_channels, int out_channels,
+                                   int height, int width) {
+  PointwiseState *s = (PointwiseState *)malloc(sizeof(PointwiseState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for pointwise state. NULL");
+    return NULL;
+  }
+  s->in_channels = in_channels;
+  s->out_channels = out_channels;
+  s->spatial = height * width;
+
+  // Weights: (out_channels × in_channels), same as a Dense over channels
+  Layer *l =
+      _layer_create_conv(out_channels, in_channels, in_channels, out_channels);
+  if (l == NULL) {
+    free(s);
+    return NULL;
+  }
+  l->state = s;
+
+  l->forward = _layer_forward_pointwise;
+  l->backward = _layer_backward_pointwise;
+
+  l->input_n = in_channels * s->spatial;
+  l->output_n = out_channels * s->spatial;
+
+  l->name = "PointwiseConv";
+  return l;
+}
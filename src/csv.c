@@ -0,0 +1,429 @@
+#include "../include/csv.h"
+#include "../include/scheduler.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Bytes per parse task. Large enough that the per-chunk setup is noise,
+// small enough that a few hundred MB spread across any pool.
+#define CSV_CHUNK_BYTES (1 << 20)
+
+// Mantissas up to 2^53 times these powers are exact in double
+static const double _pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+typedef struct {
+    const char* data;
+    size_t size;
+    char delimiter;
+    size_t* starts;     // chunk k is [starts[k], starts[k + 1])
+    int chunk_count;
+    int* rows;          // per chunk: data lines, then the first row index
+    int* lines;         // per chunk: all lines, then the first line number
+    int header_lines;   // lines skipped before data
+    int* failed_line;   // per chunk: line number of the first bad row or -1
+    Matrix* out;
+} CsvJob;
+
+static inline int _is_space(char c) {
+    return c == ' ' || c == '\t';
+}
+
+// Scans one number starting at p. Returns the first byte after it, or NULL
+// if there is no number.
+static const char* _scan_number(const char* p, const char* end, double* value) {
+    while (p < end && _is_space(*p)) {
+        p++;
+    }
+    int negative = 0;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Up to 19 significant digits fit a uint64; the rest only scale
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    int any = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        any = 1;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += mantissa != 0;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            any = 1;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            }
+        }
+    }
+    if (!any) {
+        return NULL;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int exp_negative = 0;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exp_negative = *p == '-';
+            p++;
+        }
+        if (p >= end || *p < '0' || *p > '9') {
+            return NULL;
+        }
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (e < 10000) {
+                e = e * 10 + (*p - '0');
+            }
+        }
+        exponent += exp_negative ? -e : e;
+    }
+
+    // Zero takes the common path too, branching on it mispredicts on
+    // sparse data
+    double v = (double)mantissa;
+    if (mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        v = exponent < 0 ? v / _pow10[-exponent] : v * _pow10[exponent];
+    } else if (mantissa != 0) {
+        v *= pow(10.0, exponent);
+    }
+    *value = negative ? -v : v;
+    return p;
+}
+
+static int _parse_line(const char* p, const char* end, char delimiter,
+                       float* row, int columns) {
+    for (int c = 0; c < columns; c++) {
+        // Fast path for short unsigned integers right before a delimiter,
+        // which is most fields of pixel and label data
+        const char* q = p;
+        uint32_t integer = 0;
+        unsigned digit;
+        while (q < end && q - p < 9 && (digit = (unsigned)(*q - '0')) <= 9) {
+            integer = integer * 10 + digit;
+            q++;
+        }
+        if (q > p && (q == end || *q == delimiter)) {
+            row[c] = (float)integer;
+            p = q;
+        } else {
+            double v;
+            p = _scan_number(p, end, &v);
+            if (p == NULL) {
+                return -1;
+            }
+            row[c] = (float)v;
+            while (p < end && _is_space(*p)) {
+                p++;
+            }
+        }
+        if (c + 1 < columns) {
+            if (p >= end || *p != delimiter) {
+                return -1;
+            }
+            p++;
+        }
+    }
+    return p == end ? 0 : -1;
+}
+
+// Line [p, next newline) without its "\r"; sets *next past the newline
+static const char* _line_end(const char* p, const char* end, const char** next) {
+    const char* nl = memchr(p, '\n', (size_t)(end - p));
+    const char* line_end = nl != NULL ? nl : end;
+    *next = nl != NULL ? nl + 1 : end;
+    if (line_end > p && line_end[-1] == '\r') {
+        line_end--;
+    }
+    return line_end;
+}
+
+static void _count_chunks(void* ctx, int begin, int end) {
+    CsvJob* job = (CsvJob*)ctx;
+    for (int k = begin; k < end; k++) {
+        const char* p = job->data + job->starts[k];
+        const char* stop = job->data + job->starts[k + 1];
+        int rows = 0;
+        int lines = 0;
+        while (p < stop) {
+            const char* next;
+            const char* line_end = _line_end(p, stop, &next);
+            rows += line_end > p;
+            lines++;
+            p = next;
+        }
+        job->rows[k] = rows;
+        job->lines[k] = lines;
+    }
+}
+
+static void _parse_chunks(void* ctx, int begin, int end) {
+    CsvJob* job = (CsvJob*)ctx;
+    Matrix* out = job->out;
+    for (int k = begin; k < end; k++) {
+        const char* p = job->data + job->starts[k];
+        const char* stop = job->data + job->starts[k + 1];
+        int row = job->rows[k];
+        int line = job->lines[k];
+        job->failed_line[k] = -1;
+        while (p < stop) {
+            const char* next;
+            const char* line_end = _line_end(p, stop, &next);
+            if (line_end > p) {
+                if (_parse_line(p, line_end, job->delimiter,
+                                out->data + (size_t)row * out->columns,
+                                out->columns) != 0) {
+                    job->failed_line[k] = line;
+                    break;
+                }
+                row++;
+            }
+            line++;
+            p = next;
+        }
+    }
+}
+
+static void _free_job(CsvJob* job) {
+    free(job->starts);
+    free(job->rows);
+    free(job->lines);
+    free(job->failed_line);
+}
+
+// Skips the header and cuts the rest into chunks that start on a line.
+// Returns 0 or -1.
+static int _prepare_job(CsvJob* job, const char* data, size_t size,
+                        const CsvOptions* options) {
+    memset(job, 0, sizeof(CsvJob));
+    job->delimiter = options != NULL && options->delimiter != 0
+                         ? options->delimiter
+                         : ',';
+    if (options != NULL && options->skip_header && size > 0) {
+        const char* nl = memchr(data, '\n', size);
+        size_t header = nl != NULL ? (size_t)(nl - data) + 1 : size;
+        data += header;
+        size -= header;
+        job->header_lines = 1;
+    }
+    job->data = data;
+    job->size = size;
+
+    int max_chunks = (int)(size / CSV_CHUNK_BYTES) + 1;
+    job->starts = malloc(sizeof(size_t) * (max_chunks + 1));
+    job->rows = malloc(sizeof(int) * max_chunks);
+    job->lines = malloc(sizeof(int) * max_chunks);
+    job->failed_line = malloc(sizeof(int) * max_chunks);
+    if (job->starts == NULL || job->rows == NULL || job->lines == NULL ||
+        job->failed_line == NULL) {
+        perror("Error Allocating memory for CSV chunks.\n");
+        _free_job(job);
+        return -1;
+    }
+
+    job->starts[0] = 0;
+    for (int k = 1; k < max_chunks; k++) {
+        size_t nominal = (size_t)k * CSV_CHUNK_BYTES;
+        if (nominal <= job->starts[job->chunk_count]) {
+            continue;   // the previous chunk ran past this one's start
+        }
+        const char* nl = memchr(data + nominal, '\n', size - nominal);
+        if (nl == NULL) {
+            break;
+        }
+        job->starts[++job->chunk_count] = (size_t)(nl - data) + 1;
+    }
+    job->starts[++job->chunk_count] = size;
+
+    parallel_for(0, job->chunk_count, 1, _count_chunks, job);
+    return 0;
+}
+
+static int _total_rows(CsvJob* job) {
+    int total = 0;
+    for (int k = 0; k < job->chunk_count; k++) {
+        total += job->rows[k];
+    }
+    return total;
+}
+
+// Fields of the first data line, 0 if there is none
+static int _first_columns(const CsvJob* job) {
+    const char* p = job->data;
+    const char* end = job->data + job->size;
+    while (p < end) {
+        const char* next;
+        const char* line_end = _line_end(p, end, &next);
+        if (line_end > p) {
+            int columns = 1;
+            for (const char* c = p; c < line_end; c++) {
+                columns += *c == job->delimiter;
+            }
+            return columns;
+        }
+        p = next;
+    }
+    return 0;
+}
+
+// Parses a prepared job into out, which has its row count. Returns the rows
+// parsed or -1.
+static int _parse_job(CsvJob* job, Matrix* out) {
+    // Counts become the first row and line number of each chunk
+    int total = 0;
+    int line = job->header_lines + 1;
+    for (int k = 0; k < job->chunk_count; k++) {
+        int rows = job->rows[k];
+        int lines = job->lines[k];
+        job->rows[k] = total;
+        job->lines[k] = line;
+        total += rows;
+        line += lines;
+    }
+    job->out = out;
+    parallel_for(0, job->chunk_count, 1, _parse_chunks, job);
+
+    for (int k = 0; k < job->chunk_count; k++) {
+        if (job->failed_line[k] >= 0) {
+            fprintf(stderr, "Error: CSV line %d is not %d numbers\n",
+                    job->failed_line[k], out->columns);
+            return -1;
+        }
+    }
+    return total;
+}
+
+int csv_parse_buffer(const char* data, size_t size, const CsvOptions* options,
+                     Matrix* out) {
+    if (data == NULL || out == NULL) return -1;
+
+    CsvJob job;
+    if (_prepare_job(&job, data, size, options) != 0) {
+        return -1;
+    }
+    int total = _total_rows(&job);
+    if (total != out->rows) {
+        fprintf(stderr, "Error: CSV has %d lines, matrix has %d rows\n", total,
+                out->rows);
+        _free_job(&job);
+        return -1;
+    }
+    int result = _parse_job(&job, out);
+    _free_job(&job);
+    return result;
+}
+
+// Maps path read-only. An empty file maps to NULL with size 0.
+static int _map_file(const char* path, const char** data, size_t* size) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: could not stat %s\n", path);
+        close(fd);
+        return -1;
+    }
+    *size = (size_t)st.st_size;
+    *data = NULL;
+    if (*size > 0) {
+        void* map = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("Error mapping CSV file.\n");
+            close(fd);
+            return -1;
+        }
+        posix_madvise(map, *size, POSIX_MADV_SEQUENTIAL);
+        *data = map;
+    }
+    close(fd);
+    return 0;
+}
+
+static void _unmap_file(const char* data, size_t size) {
+    if (data != NULL) {
+        munmap((void*)data, size);
+    }
+}
+
+int csv_shape(const char* path, const CsvOptions* options, int* rows,
+              int* columns) {
+    const char* data;
+    size_t size;
+    if (path == NULL || _map_file(path, &data, &size) != 0) {
+        return -1;
+    }
+
+    CsvJob job;
+    if (_prepare_job(&job, data, size, options) != 0) {
+        _unmap_file(data, size);
+        return -1;
+    }
+    *rows = _total_rows(&job);
+    *columns = _first_columns(&job);
+    _free_job(&job);
+    _unmap_file(data, size);
+    return 0;
+}
+
+int csv_parse_file(const char* path, const CsvOptions* options, Matrix* out) {
+    const char* data;
+    size_t size;
+    if (path == NULL || _map_file(path, &data, &size) != 0) {
+        return -1;
+    }
+    int rows = csv_parse_buffer(data != NULL ? data : "", size, options, out);
+    _unmap_file(data, size);
+    return rows;
+}
+
+// One mapping and one pass of line counting serve both the shape and the
+// parse
+Matrix* csv_load(const char* path, const CsvOptions* options) {
+    const char* data;
+    size_t size;
+    if (path == NULL || _map_file(path, &data, &size) != 0) {
+        return NULL;
+    }
+    CsvJob job;
+    if (_prepare_job(&job, data != NULL ? data : "", size, options) != 0) {
+        _unmap_file(data, size);
+        return NULL;
+    }
+
+    int rows = _total_rows(&job);
+    int columns = _first_columns(&job);
+    Matrix* out = NULL;
+    if (rows == 0 || columns == 0) {
+        fprintf(stderr, "Error: %s has no data\n", path);
+    } else {
+        out = create_matrix(rows, columns);
+    }
+    if (out != NULL && _parse_job(&job, out) < 0) {
+        free_matrix(out);
+        out = NULL;
+    }
+    _free_job(&job);
+    _unmap_file(data, size);
+    return out;
+}
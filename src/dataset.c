@@ -0,0 +1,942 @@
+#include "../include/dataset.h"
+
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Rows of the output written together while gathering: one cache line of
+// each sample is read while the same rows of the output stay hot
+#define DATASET_GATHER_BLOCK 16
+
+#define DATASET_CACHE_MAGIC "CNNDATA"
+#define DATASET_CACHE_VERSION 1
+#define DATASET_CACHE_BYTE_ORDER 0x01020304u
+// Payloads start on a cache line
+#define DATASET_CACHE_ALIGN 64
+
+typedef enum {
+    CACHE_LABELS_NONE = 0,
+    CACHE_LABELS_INDEX = 1,     // int32 class per sample
+    CACHE_LABELS_DENSE = 2,     // target_size float32 per sample
+} CacheLabelLayout;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;        // reads back differently on another endianness
+    uint32_t type;              // DatasetType of the inputs
+    uint32_t label_layout;
+    uint32_t count;
+    uint32_t features;
+    uint32_t target_size;
+    float scale;
+    float offset;
+    uint32_t has_source;        // a DatasetCacheSource follows the header
+    uint64_t inputs_offset;
+    uint64_t targets_offset;
+} DatasetCacheHeader;
+
+_Static_assert(sizeof(DatasetCacheHeader) == 64, "cache header is 64 bytes");
+
+// The file a cache was built from, as it was then. It sits between the
+// header and inputs_offset, so readers that don't know it skip it.
+typedef struct {
+    int64_t size;
+    int64_t mtime_ns;
+} DatasetCacheSource;
+
+// Returns 0 or -1 if path can't be stat'ed
+static int _source_of(const char* path, DatasetCacheSource* source) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    source->size = (int64_t)st.st_size;
+    source->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+static size_t _type_size(DatasetType type) {
+    switch (type) {
+    case DATASET_FLOAT32:
+        return 4;
+    case DATASET_FLOAT16:
+        return 2;
+    case DATASET_UINT8:
+        return 1;
+    }
+    return 0;
+}
+
+// IEEE half precision, round to nearest even
+static uint16_t _float_to_half(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mantissa = x & 0x7fffff;
+    int exponent = (int)((x >> 23) & 0xff);
+
+    if (exponent == 0xff) {
+        return (uint16_t)(sign | 0x7c00 | (mantissa != 0 ? 0x200 : 0));
+    }
+    int e = exponent - 127 + 15;
+    if (e >= 0x1f) {
+        return (uint16_t)(sign | 0x7c00);
+    }
+    if (e <= 0) {
+        // Subnormal half, or zero
+        if (e < -10) {
+            return (uint16_t)sign;
+        }
+        mantissa |= 0x800000;
+        int shift = 14 - e;
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) {
+            half++;
+        }
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)e << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    // A carry out of the mantissa correctly bumps the exponent
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+        half++;
+    }
+    return (uint16_t)half;
+}
+
+static float _half_to_float(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    uint32_t x;
+    if (exponent == 0x1f) {
+        x = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        x = sign;
+    } else {
+        // Subnormal: shift the leading one up to the implicit bit
+        uint32_t e = 113;
+        do {
+            mantissa <<= 1;
+            e--;
+        } while ((mantissa & 0x400) == 0);
+        x = sign | (e << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+static Dataset* _alloc_dataset(int count, int features, DatasetType type) {
+    if (count <= 0 || features <= 0) {
+        fprintf(stderr, "Error: invalid dataset shape %d x %d\n", count,
+                features);
+        return NULL;
+    }
+    Dataset* d = calloc(1, sizeof(Dataset));
+    if (d == NULL) {
+        perror("Error Allocating memory for dataset.\n");
+        return NULL;
+    }
+    d->count = count;
+    d->features = features;
+    d->type = type;
+    d->scale = 1.0f;
+    d->inputs = malloc(_type_size(type) * (size_t)count * features);
+    if (d->inputs == NULL) {
+        perror("Error Allocating memory for dataset samples.\n");
+        free(d);
+        return NULL;
+    }
+    return d;
+}
+
+// Storage for count samples labeled with one of classes
+static Dataset* _create_labeled(int count, int features, int classes,
+                                DatasetType type) {
+    Dataset* d = _alloc_dataset(count, features, type);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->target_size = classes;
+    d->labels = malloc(sizeof(int32_t) * count);
+    if (d->labels == NULL) {
+        perror("Error Allocating memory for dataset labels.\n");
+        free_dataset(d);
+        return NULL;
+    }
+    return d;
+}
+
+Dataset* create_dataset(int count, int features, int target_size) {
+    if (target_size < 0) {
+        fprintf(stderr, "Error: invalid target size %d\n", target_size);
+        return NULL;
+    }
+    Dataset* d = _alloc_dataset(count, features, DATASET_FLOAT32);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->target_size = target_size;
+    if (target_size > 0) {
+        d->targets = malloc(sizeof(float) * (size_t)count * target_size);
+        if (d->targets == NULL) {
+            perror("Error Allocating memory for dataset targets.\n");
+            free_dataset(d);
+            return NULL;
+        }
+    }
+    return d;
+}
+
+void free_dataset(Dataset* d) {
+    if (d == NULL) return;
+    if (d->map != NULL) {
+        // Everything points into the mapping
+        munmap(d->map, d->map_size);
+    } else {
+        free(d->inputs);
+        free(d->targets);
+        free(d->labels);
+    }
+    free(d);
+}
+
+// Class index of label, or -1 if it isn't one of classes
+static int _class_index(float label, int classes) {
+    int index = (int)label;
+    if (label != (float)index || index < 0 || index >= classes) {
+        return -1;
+    }
+    return index;
+}
+
+Dataset* dataset_from_csv(const char* path, const CsvOptions* options,
+                          int label_column, int classes, float scale) {
+    Matrix* m = csv_load(path, options);
+    if (m == NULL) {
+        return NULL;
+    }
+    if (label_column < 0 || label_column >= m->columns || m->columns < 2 ||
+        classes <= 0) {
+        fprintf(stderr, "Error: %s has %d fields, can't use field %d as one of %d labels\n",
+                path, m->columns, label_column, classes);
+        free_matrix(m);
+        return NULL;
+    }
+
+    Dataset* d = _create_labeled(m->rows, m->columns - 1, classes,
+                                 DATASET_FLOAT32);
+    if (d == NULL) {
+        free_matrix(m);
+        return NULL;
+    }
+    for (int i = 0; i < m->rows; i++) {
+        const float* fields = m->data + (size_t)i * m->columns;
+        float* features = (float*)d->inputs + (size_t)i * d->features;
+        int f = 0;
+        for (int c = 0; c < m->columns; c++) {
+            if (c != label_column) {
+                features[f++] = fields[c] * scale;
+            }
+        }
+        d->labels[i] = _class_index(fields[label_column], classes);
+        if (d->labels[i] < 0) {
+            fprintf(stderr, "Error: line %d of %s has label %g, expected 0..%d\n",
+                    i + 1, path, fields[label_column], classes - 1);
+            free_dataset(d);
+            free_matrix(m);
+            return NULL;
+        }
+    }
+    free_matrix(m);
+    return d;
+}
+
+Dataset* dataset_from_idx(const IdxFile* images, const IdxFile* labels,
+                          int classes, float scale) {
+    if (images == NULL || labels == NULL || images->type != IDX_UINT8 ||
+        labels->type != IDX_UINT8 || labels->sample_size != 1 ||
+        images->count != labels->count || classes <= 0) {
+        fprintf(stderr, "Error: dataset needs uint8 images with one uint8 label each\n");
+        return NULL;
+    }
+
+    Dataset* d = _create_labeled(images->count, (int)images->sample_size,
+                                 classes, DATASET_UINT8);
+    if (d == NULL) {
+        return NULL;
+    }
+    d->scale = scale;
+    memcpy(d->inputs, images->data, (size_t)images->count * images->sample_size);
+    for (int i = 0; i < labels->count; i++) {
+        d->labels[i] = _class_index(labels->data[i], classes);
+        if (d->labels[i] < 0) {
+            fprintf(stderr, "Error: sample %d has label %d, expected 0..%d\n",
+                    i, labels->data[i], classes - 1);
+            free_dataset(d);
+            return NULL;
+        }
+    }
+    return d;
+}
+
+float dataset_input(const Dataset* d, int sample, int i) {
+    size_t at = (size_t)sample * d->features + i;
+    switch (d->type) {
+    case DATASET_FLOAT16:
+        return _half_to_float(((const uint16_t*)d->inputs)[at]) * d->scale +
+               d->offset;
+    case DATASET_UINT8:
+        return ((const uint8_t*)d->inputs)[at] * d->scale + d->offset;
+    default:
+        return ((const float*)d->inputs)[at];
+    }
+}
+
+// dst is a (width x stride) matrix; column b receives row indices[b] of the
+// sample-major src. Each works through the output DATASET_GATHER_BLOCK rows
+// at a time, so reads are whole cache lines of a sample and writes stream
+// along the output rows.
+static void _gather_float(const float* src, int width, const int* indices,
+                          int count, float* dst, int stride) {
+    for (int r0 = 0; r0 < width; r0 += DATASET_GATHER_BLOCK) {
+        int r1 = r0 + DATASET_GATHER_BLOCK < width ? r0 + DATASET_GATHER_BLOCK
+                                                   : width;
+        for (int b = 0; b < count; b++) {
+            const float* sample = src + (size_t)indices[b] * width;
+            float* out = dst + b;
+            for (int r = r0; r < r1; r++) {
+                out[(size_t)r * stride] = sample[r];
+            }
+        }
+    }
+}
+
+static void _gather_uint8(const uint8_t* src, int width, float scale,
+                          float offset, const int* indices, int count,
+                          float* dst, int stride) {
+    for (int r0 = 0; r0 < width; r0 += DATASET_GATHER_BLOCK) {
+        int r1 = r0 + DATASET_GATHER_BLOCK < width ? r0 + DATASET_GATHER_BLOCK
+                                                   : width;
+        for (int b = 0; b < count; b++) {
+            const uint8_t* sample = src + (size_t)indices[b] * width;
+            float* out = dst + b;
+            for (int r = r0; r < r1; r++) {
+                out[(size_t)r * stride] = sample[r] * scale + offset;
+            }
+        }
+    }
+}
+
+static void _gather_half(const uint16_t* src, int width, float scale,
+                         float offset, const int* indices, int count,
+                         float* dst, int stride) {
+    for (int r0 = 0; r0 < width; r0 += DATASET_GATHER_BLOCK) {
+        int r1 = r0 + DATASET_GATHER_BLOCK < width ? r0 + DATASET_GATHER_BLOCK
+                                                   : width;
+        for (int b = 0; b < count; b++) {
+            const uint16_t* sample = src + (size_t)indices[b] * width;
+            float* out = dst + b;
+            for (int r = r0; r < r1; r++) {
+                out[(size_t)r * stride] =
+                    _half_to_float(sample[r]) * scale + offset;
+            }
+        }
+    }
+}
+
+// Checks the batch shape (inputs_rows x inputs_columns) and the indices.
+// Returns 0 or -1.
+static int _check_gather(const Dataset* d, const int* indices, int count,
+                         int inputs_rows, int inputs_columns,
+                         const Matrix* targets) {
+    if (inputs_rows != d->features || inputs_columns < count ||
+        (targets != NULL && (targets->rows != d->target_size ||
+                             targets->columns < count))) {
+        fprintf(stderr, "Error: a batch of %d samples needs %d x %d inputs and %d x %d targets\n",
+                count, d->features, count, d->target_size, count);
+        return -1;
+    }
+    for (int b = 0; b < count; b++) {
+        if (indices[b] < 0 || indices[b] >= d->count) {
+            fprintf(stderr, "Error: sample %d out of range (%d samples)\n",
+                    indices[b], d->count);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void _gather_targets(const Dataset* d, const int* indices, int count,
+                            Matrix* targets) {
+    if (d->labels != NULL) {
+        for (int r = 0; r < targets->rows; r++) {
+            memset(targets->data + (size_t)r * targets->columns, 0,
+                   sizeof(float) * count);
+        }
+        for (int b = 0; b < count; b++) {
+            targets->data[(size_t)d->labels[indices[b]] * targets->columns + b] =
+                1.0f;
+        }
+    } else if (d->targets != NULL) {
+        _gather_float(d->targets, d->target_size, indices, count,
+                      targets->data, targets->columns);
+    }
+}
+
+int dataset_gather(const Dataset* d, const int* indices, int count,
+                   Matrix* inputs, Matrix* targets) {
+    if (d == NULL || indices == NULL || inputs == NULL || count < 0) return -1;
+    if (_check_gather(d, indices, count, inputs->rows, inputs->columns,
+                      targets) != 0) {
+        return -1;
+    }
+
+    switch (d->type) {
+    case DATASET_FLOAT16:
+        _gather_half(d->inputs, d->features, d->scale, d->offset, indices,
+                     count, inputs->data, inputs->columns);
+        break;
+    case DATASET_UINT8:
+        _gather_uint8(d->inputs, d->features, d->scale, d->offset, indices,
+                      count, inputs->data, inputs->columns);
+        break;
+    default:
+        _gather_float(d->inputs, d->features, indices, count, inputs->data,
+                      inputs->columns);
+        break;
+    }
+
+    if (targets != NULL) {
+        _gather_targets(d, indices, count, targets);
+    }
+    return 0;
+}
+
+int dataset_gather_bytes(const Dataset* d, const int* indices, int count,
+                         ByteMatrix* inputs, Matrix* targets) {
+    if (d == NULL || indices == NULL || inputs == NULL || count < 0) return -1;
+    if (d->type != DATASET_UINT8) {
+        fprintf(stderr, "Error: byte batches need a uint8 dataset\n");
+        return -1;
+    }
+    if (_check_gather(d, indices, count, inputs->rows, inputs->columns,
+                      targets) != 0) {
+        return -1;
+    }
+
+    // Same blocked transpose as the float gather, a quarter of the bytes
+    const uint8_t* src = d->inputs;
+    int width = d->features;
+    int stride = inputs->columns;
+    for (int r0 = 0; r0 < width; r0 += DATASET_GATHER_BLOCK) {
+        int r1 = r0 + DATASET_GATHER_BLOCK < width ? r0 + DATASET_GATHER_BLOCK
+                                                   : width;
+        for (int b = 0; b < count; b++) {
+            const uint8_t* sample = src + (size_t)indices[b] * width;
+            unsigned char* out = inputs->data + b;
+            for (int r = r0; r < r1; r++) {
+                out[(size_t)r * stride] = sample[r];
+            }
+        }
+    }
+    inputs->scale = d->scale;
+    inputs->offset = d->offset;
+
+    if (targets != NULL) {
+        _gather_targets(d, indices, count, targets);
+    }
+    return 0;
+}
+
+static size_t _align(size_t offset) {
+    return (offset + DATASET_CACHE_ALIGN - 1) & ~(size_t)(DATASET_CACHE_ALIGN - 1);
+}
+
+// Writes zeros up to offset. Returns 0 or -1.
+static int _pad_to(FILE* f, size_t* position, size_t offset) {
+    static const char zeros[DATASET_CACHE_ALIGN] = {0};
+    size_t gap = offset - *position;
+    if (gap > 0 && fwrite(zeros, 1, gap, f) != gap) {
+        return -1;
+    }
+    *position = offset;
+    return 0;
+}
+
+// Encodes and writes the inputs sample by sample. Returns 0 or -1.
+static int _write_inputs(FILE* f, const Dataset* d, DatasetType type,
+                         float scale, float offset) {
+    size_t size = _type_size(type);
+    unsigned char* buffer = malloc(size * d->features);
+    if (buffer == NULL) {
+        perror("Error Allocating memory for dataset cache.\n");
+        return -1;
+    }
+    int result = 0;
+    for (int s = 0; s < d->count && result == 0; s++) {
+        for (int i = 0; i < d->features; i++) {
+            float v = dataset_input(d, s, i);
+            if (type == DATASET_FLOAT32) {
+                ((float*)buffer)[i] = v;
+                continue;
+            }
+            float stored = (v - offset) / scale;
+            if (type == DATASET_FLOAT16) {
+                ((uint16_t*)buffer)[i] = _float_to_half(stored);
+            } else {
+                float q = roundf(stored);
+                buffer[i] = (uint8_t)(q < 0.0f ? 0.0f : q > 255.0f ? 255.0f : q);
+            }
+        }
+        if (fwrite(buffer, size, d->features, f) != (size_t)d->features) {
+            result = -1;
+        }
+    }
+    free(buffer);
+    return result;
+}
+
+static int _save(const Dataset* d, const char* path, DatasetType type,
+                 float scale, float offset, const DatasetCacheSource* source) {
+    if (d == NULL || path == NULL || _type_size(type) == 0) return -1;
+    if (type == DATASET_FLOAT32) {
+        scale = 1.0f;
+        offset = 0.0f;
+    } else if (scale == 0.0f) {
+        fprintf(stderr, "Error: packed dataset cache needs a nonzero scale\n");
+        return -1;
+    }
+
+    DatasetCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, DATASET_CACHE_MAGIC, sizeof(h.magic));
+    h.version = DATASET_CACHE_VERSION;
+    h.byte_order = DATASET_CACHE_BYTE_ORDER;
+    h.type = type;
+    h.label_layout = d->labels != NULL    ? CACHE_LABELS_INDEX
+                     : d->targets != NULL ? CACHE_LABELS_DENSE
+                                          : CACHE_LABELS_NONE;
+    h.count = (uint32_t)d->count;
+    h.features = (uint32_t)d->features;
+    h.target_size = (uint32_t)d->target_size;
+    h.scale = scale;
+    h.offset = offset;
+    h.has_source = source != NULL;
+    h.inputs_offset = _align(sizeof(h) + (source != NULL ? sizeof(*source) : 0));
+    h.targets_offset =
+        _align(h.inputs_offset + _type_size(type) * (size_t)d->count * d->features);
+
+    // Written next to the target and renamed at the end, so a crash never
+    // leaves a truncated cache behind
+    size_t length = strlen(path);
+    char* temp = malloc(length + 5);
+    if (temp == NULL) {
+        perror("Error Allocating memory for dataset cache.\n");
+        return -1;
+    }
+    memcpy(temp, path, length);
+    memcpy(temp + length, ".tmp", 5);
+
+    FILE* f = fopen(temp, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "Error: could not create %s\n", temp);
+        free(temp);
+        return -1;
+    }
+    size_t position = sizeof(h);
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;
+    if (ok && source != NULL) {
+        ok = fwrite(source, sizeof(*source), 1, f) == 1;
+        position += sizeof(*source);
+    }
+    ok = ok && _pad_to(f, &position, h.inputs_offset) == 0 &&
+             _write_inputs(f, d, type, scale, offset) == 0;
+    position = h.inputs_offset + _type_size(type) * (size_t)d->count * d->features;
+    if (ok && h.label_layout != CACHE_LABELS_NONE) {
+        ok = _pad_to(f, &position, h.targets_offset) == 0;
+        if (ok && h.label_layout == CACHE_LABELS_INDEX) {
+            ok = fwrite(d->labels, sizeof(int32_t), d->count, f) ==
+                 (size_t)d->count;
+        } else if (ok) {
+            size_t values = (size_t)d->count * d->target_size;
+            ok = fwrite(d->targets, sizeof(float), values, f) == values;
+        }
+    }
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temp, path) != 0) {
+        fprintf(stderr, "Error: could not write dataset cache %s\n", path);
+        remove(temp);
+        free(temp);
+        return -1;
+    }
+    free(temp);
+    return 0;
+}
+
+int dataset_save(const Dataset* d, const char* path, DatasetType type,
+                 float scale, float offset) {
+    return _save(d, path, type, scale, offset, NULL);
+}
+
+int dataset_save_source(const Dataset* d, const char* path, DatasetType type,
+                        float scale, float offset, const char* source_path) {
+    DatasetCacheSource source;
+    if (source_path == NULL || _source_of(source_path, &source) != 0) {
+        fprintf(stderr, "Error: could not stat %s\n",
+                source_path != NULL ? source_path : "(null)");
+        return -1;
+    }
+    return _save(d, path, type, scale, offset, &source);
+}
+
+// Checks a header against the size of its file. Returns 0 or -1.
+static int _check_header(const DatasetCacheHeader* h, size_t file_size,
+                         const char* path) {
+    if (file_size < sizeof(*h) ||
+        memcmp(h->magic, DATASET_CACHE_MAGIC, sizeof(h->magic)) != 0) {
+        fprintf(stderr, "Error: %s is not a dataset cache\n", path);
+        return -1;
+    }
+    if (h->version != DATASET_CACHE_VERSION ||
+        h->byte_order != DATASET_CACHE_BYTE_ORDER) {
+        fprintf(stderr, "Error: %s was written by another version or byte order\n",
+                path);
+        return -1;
+    }
+
+    size_t size = _type_size((DatasetType)h->type);
+    size_t label_bytes = h->label_layout == CACHE_LABELS_INDEX
+                             ? sizeof(int32_t) * (size_t)h->count
+                         : h->label_layout == CACHE_LABELS_DENSE
+                             ? sizeof(float) * (size_t)h->count * h->target_size
+                             : 0;
+    if (size == 0 || h->label_layout > CACHE_LABELS_DENSE || h->count == 0 ||
+        h->features == 0 || h->count > 0x7fffffff || h->features > 0x7fffffff ||
+        h->target_size > 0x7fffffff ||
+        (h->label_layout != CACHE_LABELS_NONE && h->target_size == 0) ||
+        h->inputs_offset % DATASET_CACHE_ALIGN != 0 ||
+        h->targets_offset % DATASET_CACHE_ALIGN != 0 ||
+        h->inputs_offset < sizeof(*h) ||
+        (h->has_source &&
+         h->inputs_offset < sizeof(*h) + sizeof(DatasetCacheSource)) ||
+        h->inputs_offset > file_size ||
+        (file_size - h->inputs_offset) / size / h->count < h->features ||
+        (label_bytes > 0 && (h->targets_offset > file_size ||
+                             file_size - h->targets_offset < label_bytes))) {
+        fprintf(stderr, "Error: %s has an inconsistent header\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Points d into the mapped file after checking the header against its
+// size. Returns 0 or -1.
+static int _attach_cache(Dataset* d, const char* path) {
+    const DatasetCacheHeader* h = d->map;
+    if (_check_header(h, d->map_size, path) != 0) {
+        return -1;
+    }
+
+    char* base = d->map;
+    d->count = (int)h->count;
+    d->features = (int)h->features;
+    d->target_size = h->label_layout != CACHE_LABELS_NONE ? (int)h->target_size
+                                                           : 0;
+    d->type = (DatasetType)h->type;
+    d->scale = h->scale;
+    d->offset = h->offset;
+    d->inputs = base + h->inputs_offset;
+    if (h->label_layout == CACHE_LABELS_INDEX) {
+        d->labels = (int32_t*)(base + h->targets_offset);
+        for (int i = 0; i < d->count; i++) {
+            if (d->labels[i] < 0 || d->labels[i] >= d->target_size) {
+                fprintf(stderr, "Error: %s has label %d for sample %d\n", path,
+                        d->labels[i], i);
+                return -1;
+            }
+        }
+    } else if (h->label_layout == CACHE_LABELS_DENSE) {
+        d->targets = (float*)(base + h->targets_offset);
+    }
+    return 0;
+}
+
+Dataset* dataset_load(const char* path) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;    // no cache yet is the normal first run
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+
+    Dataset* d = calloc(1, sizeof(Dataset));
+    if (d == NULL) {
+        perror("Error Allocating memory for dataset.\n");
+        close(fd);
+        return NULL;
+    }
+    // Private and writable: samples can be edited in memory, the file never
+    // changes
+    d->map_size = (size_t)st.st_size;
+    d->map = mmap(NULL, d->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (d->map == MAP_FAILED) {
+        perror("Error mapping dataset cache.\n");
+        free(d);
+        return NULL;
+    }
+    if (_attach_cache(d, path) != 0) {
+        free_dataset(d);
+        return NULL;
+    }
+    return d;
+}
+
+Dataset* dataset_load_source(const char* path, const char* source_path) {
+    if (path == NULL || source_path == NULL) return NULL;
+
+    Dataset* d = dataset_load(path);
+    DatasetCacheSource now;
+    if (d == NULL || _source_of(source_path, &now) != 0) {
+        return d;   // nothing to compare against, or nothing to rebuild from
+    }
+    const DatasetCacheHeader* h = d->map;
+    DatasetCacheSource then;
+    memcpy(&then, (const char*)d->map + sizeof(*h), sizeof(then));
+    if (!h->has_source || then.size != now.size ||
+        then.mtime_ns != now.mtime_ns) {
+        fprintf(stderr, "Warning: %s is out of date, %s changed\n", path,
+                source_path);
+        free_dataset(d);
+        return NULL;
+    }
+    return d;
+}
+
+int dataset_cache_layout(const char* path, DatasetCacheLayout* layout) {
+    if (path == NULL || layout == NULL) return -1;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return -1;
+    }
+    struct stat st;
+    DatasetCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    int ok = fstat(fd, &st) == 0 && pread(fd, &h, sizeof(h), 0) >= 0;
+    close(fd);
+    if (!ok || _check_header(&h, (size_t)st.st_size, path) != 0) {
+        return -1;
+    }
+
+    memset(layout, 0, sizeof(DatasetCacheLayout));
+    layout->count = (int)h.count;
+    layout->features = (int)h.features;
+    layout->target_size = h.label_layout != CACHE_LABELS_NONE ? (int)h.target_size
+                                                              : 0;
+    layout->type = (DatasetType)h.type;
+    layout->scale = h.scale;
+    layout->offset = h.offset;
+    layout->has_labels = h.label_layout == CACHE_LABELS_INDEX;
+    layout->file_size = (uint64_t)st.st_size;
+    layout->inputs_offset = h.inputs_offset;
+    layout->targets_offset = h.targets_offset;
+    return 0;
+}
+
+// splitmix64
+static uint64_t _next_random(unsigned long long* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Fisher-Yates over values[0..count)
+static void _shuffle(unsigned long long* rng, int* values, int count) {
+    for (int i = count - 1; i > 0; i--) {
+        int j = (int)(((_next_random(rng) >> 32) * (uint64_t)(i + 1)) >> 32);
+        int tmp = values[i];
+        values[i] = values[j];
+        values[j] = tmp;
+    }
+}
+
+// Runs of block_size samples in a random order, then shuffled within
+// windows of window_blocks runs
+static void _block_shuffle(DatasetIterator* it) {
+    int count = it->dataset->count;
+    int block = it->block_size;     // at most count
+    int blocks = count / block + (count % block != 0);
+    for (int b = 0; b < blocks; b++) {
+        it->blocks[b] = b;
+    }
+    _shuffle(&it->rng, it->blocks, blocks);
+
+    int position = 0;
+    for (int b = 0; b < blocks; b++) {
+        int first = it->blocks[b] * block;
+        int last = count - first > block ? first + block : count;
+        for (int i = first; i < last; i++) {
+            it->order[position++] = i;
+        }
+    }
+
+    // Both factors can be up to count, so the product may not fit an int
+    size_t window = (size_t)block * (size_t)it->window_blocks;
+    int span = window < (size_t)count ? (int)window : count;
+    int first = 0;
+    while (first < count) {
+        int length = count - first < span ? count - first : span;
+        _shuffle(&it->rng, it->order + first, length);
+        first += length;
+    }
+}
+
+static void _start_epoch(DatasetIterator* it) {
+    if (it->shuffle && it->block_size > 0) {
+        _block_shuffle(it);
+    } else if (it->shuffle) {
+        // Over the previous order, which is as good a start
+        _shuffle(&it->rng, it->order, it->dataset->count);
+    }
+    it->next = 0;
+}
+
+DatasetIterator* create_dataset_iterator(Dataset* d, int batch_size,
+                                         int shuffle, unsigned int seed) {
+    if (d == NULL || batch_size < 1) {
+        fprintf(stderr, "Error: dataset iterator needs a dataset and a batch size\n");
+        return NULL;
+    }
+    DatasetIterator* it = calloc(1, sizeof(DatasetIterator));
+    if (it == NULL) {
+        perror("Error Allocating memory for dataset iterator.\n");
+        return NULL;
+    }
+    it->dataset = d;
+    it->batch_size = batch_size;
+    it->shuffle = shuffle;
+    it->rng = seed;
+    it->order = malloc(sizeof(int) * d->count);
+    it->inputs = create_matrix(d->features, batch_size);
+    if (d->target_size > 0) {
+        it->targets = create_matrix(d->target_size, batch_size);
+    }
+    if (it->order == NULL || it->inputs == NULL ||
+        (d->target_size > 0 && it->targets == NULL)) {
+        perror("Error Allocating memory for dataset iterator.\n");
+        free_dataset_iterator(it);
+        return NULL;
+    }
+    for (int i = 0; i < d->count; i++) {
+        it->order[i] = i;
+    }
+    _start_epoch(it);
+    return it;
+}
+
+int dataset_iterator_block_shuffle(DatasetIterator* it, int block_size,
+                                   int window_blocks) {
+    if (it == NULL || block_size < 0 || (block_size > 0 && window_blocks < 1)) {
+        fprintf(stderr, "Error: block shuffle needs a block size >= 0 and at least one block per window\n");
+        return -1;
+    }
+    if (block_size > 0) {
+        // A block larger than the dataset is the whole dataset
+        int count = it->dataset->count;
+        if (block_size > count) {
+            block_size = count > 0 ? count : 1;
+        }
+        int blocks = count / block_size + (count % block_size != 0);
+        int* resized = realloc(it->blocks, sizeof(int) * (blocks > 0 ? blocks : 1));
+        if (resized == NULL) {
+            perror("Error Allocating memory for dataset iterator.\n");
+            return -1;
+        }
+        it->blocks = resized;
+        if (window_blocks > blocks) {
+            window_blocks = blocks > 0 ? blocks : 1;
+        }
+    }
+    it->block_size = block_size;
+    it->window_blocks = window_blocks;
+    _start_epoch(it);
+    return 0;
+}
+
+void free_dataset_iterator(DatasetIterator* it) {
+    if (it == NULL) return;
+    free(it->order);
+    free(it->blocks);
+    free_matrix(it->inputs);
+    free_matrix(it->targets);
+    free(it);
+}
+
+void dataset_iterator_reset(DatasetIterator* it) {
+    if (it == NULL) return;
+    _start_epoch(it);
+}
+
+int dataset_produce_batch(void* ctx, Matrix* inputs, Matrix* targets) {
+    DatasetIterator* it = (DatasetIterator*)ctx;
+    int remaining = it->dataset->count - it->next;
+    int count = remaining < inputs->columns ? remaining : inputs->columns;
+    if (count > it->batch_size) {
+        count = it->batch_size;
+    }
+    if (count <= 0) {
+        return 0;
+    }
+    if (dataset_gather(it->dataset, it->order + it->next, count, inputs,
+                       targets) != 0) {
+        return -1;
+    }
+    it->next += count;
+    return count;
+}
+
+int dataset_next_batch(DatasetIterator* it, Matrix** inputs, Matrix** targets) {
+    if (it == NULL) return 0;
+    int remaining = it->dataset->count - it->next;
+    int count = remaining < it->batch_size ? remaining : it->batch_size;
+    if (count <= 0) {
+        return 0;
+    }
+
+    // The buffers hold batch_size columns; a short batch just uses fewer,
+    // packed at the front
+    it->inputs->columns = count;
+    if (it->targets != NULL) {
+        it->targets->columns = count;
+    }
+    int filled = dataset_produce_batch(it, it->inputs, it->targets);
+    if (filled <= 0) {
+        return filled;
+    }
+    *inputs = it->inputs;
+    if (targets != NULL) {
+        *targets = it->targets;
+    }
+    return filled;
+}
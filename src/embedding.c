@@ -0,0 +1,251 @@
+#include "../include/layer.h"
+
+#include <string.h>
+
+// Sparse gradient bookkeeping. Only rows whose id appeared in the last batch
+// are touched, so per step cost depends on batch size, not vocabulary size.
+typedef struct {
+  int vocab_size;
+  int embedding_dim;
+
+  unsigned int step;          // bumped every backward pass
+  unsigned int *seen_at;      // (vocab) step at which the row was last touched
+  int *slot_of;               // (vocab) row in grad_rows, valid if seen_at == step
+  int *touched;               // ids seen this step, in order of first use
+  float *grad_rows;           // (capacity x embedding_dim) compact gradients
+  int capacity;
+} EmbeddingState;
+
+static void _embedding_free_state(Layer *l) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  if (s == NULL) {
+    return;
+  }
+  free(s->seen_at);
+  free(s->slot_of);
+  free(s->touched);
+  free(s->grad_rows);
+  free(s);
+  l->state = NULL;
+}
+
+static int _embedding_reserve(EmbeddingState *s, int rows) {
+  if (rows <= s->capacity) {
+    return 0;
+  }
+  int *touched = realloc(s->touched, sizeof(int) * rows);
+  if (touched == NULL) {
+    perror("Error growing embedding touched list");
+    return -1;
+  }
+  s->touched = touched;
+
+  float *grad = realloc(s->grad_rows, sizeof(float) * rows * s->embedding_dim);
+  if (grad == NULL) {
+    perror("Error growing embedding gradient rows");
+    return -1;
+  }
+  s->grad_rows = grad;
+  s->capacity = rows;
+  return 0;
+}
+
+static int _embedding_id(Layer *l, float value) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  int id = (int)value;
+  if (id < 0 || id >= s->vocab_size) {
+    fprintf(stderr, "Error: embedding id %d out of range [0, %d)\n", id,
+            s->vocab_size);
+    return -1;
+  }
+  return id;
+}
+
+Matrix *_layer_forward_embedding(Layer *l, Matrix *input) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  if (input == NULL) {
+    fprintf(stderr, "Error: NULL input to forward_embedding\n");
+    return NULL;
+  }
+
+  int fields = input->rows;
+  int batch = input->columns;
+  int dim = s->embedding_dim;
+
+  // Each id row expands into dim output rows: (fields * dim x batch)
+  Matrix *out = create_matrix(fields * dim, batch);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  for (int f = 0; f < fields; f++) {
+    for (int b = 0; b < batch; b++) {
+      int id = _embedding_id(l, input->data[f * batch + b]);
+      if (id < 0) {
+        free_matrix(out);
+        return NULL;
+      }
+      const float *row = l->weights->data + id * dim;
+      float *dst = out->data + (f * dim) * batch + b;
+      for (int d = 0; d < dim; d++) {
+        dst[d * batch] = row[d];
+      }
+    }
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  // Ids are needed in backward to scatter the gradient
+  l->inputs = copy_matrix(input);
+
+  return out;
+}
+
+Matrix *_layer_backward_embedding(Layer *l, Matrix *error_gradient,
+                                  float learning_rate) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_embedding\n");
+    return NULL;
+  }
+
+  int fields = l->inputs->rows;
+  int batch = l->inputs->columns;
+  int dim = s->embedding_dim;
+
+  if (error_gradient->rows != fields * dim || error_gradient->columns != batch) {
+    fprintf(stderr,
+            "Error: embedding gradient (%d,%d) does not match output (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, fields * dim, batch);
+    return NULL;
+  }
+
+  if (_embedding_reserve(s, fields * batch) != 0) {
+    return NULL;
+  }
+
+  // A new step invalidates every seen_at entry without clearing the array
+  s->step++;
+  if (s->step == 0) {
+    memset(s->seen_at, 0, sizeof(unsigned int) * s->vocab_size);
+    s->step = 1;
+  }
+
+  // Accumulate the gradient of every occurrence into its row's slot
+  int touched_count = 0;
+  for (int f = 0; f < fields; f++) {
+    for (int b = 0; b < batch; b++) {
+      int id = (int)l->inputs->data[f * batch + b];
+
+      if (s->seen_at[id] != s->step) {
+        s->seen_at[id] = s->step;
+        s->slot_of[id] = touched_count;
+        s->touched[touched_count] = id;
+        memset(s->grad_rows + touched_count * dim, 0, sizeof(float) * dim);
+        touched_count++;
+      }
+
+      float *grad = s->grad_rows + s->slot_of[id] * dim;
+      const float *dy = error_gradient->data + (f * dim) * batch + b;
+      for (int d = 0; d < dim; d++) {
+        grad[d] += dy[d * batch];
+      }
+    }
+  }
+
+  // Sparse SGD: W[id] = W[id] - lr*dW[id] for the touched rows only
+  for (int t = 0; t < touched_count && learning_rate != 0.0f; t++) {
+    float *row = l->weights->data + s->touched[t] * dim;
+    const float *grad = s->grad_rows + t * dim;
+    for (int d = 0; d < dim; d++) {
+      row[d] -= learning_rate * grad[d];
+    }
+  }
+
+  // Ids are not differentiable, upstream receives zeros of the input shape
+  Matrix *input_grad = create_matrix(fields, batch);
+  if (input_grad != NULL) {
+    zero_matrix(input_grad);
+  }
+  return input_grad;
+}
+
+// Any number of id rows, each expands into embedding_dim rows
+static int _embedding_infer_shape(Layer *l, int rows, int columns,
+                                  int *out_rows, int *out_columns) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  *out_rows = rows * s->embedding_dim;
+  *out_columns = columns;
+  return 0;
+}
+
+// Stored ids plus the compact gradient rows and their id list, sized for
+// every id being distinct
+static size_t _embedding_workspace_size(Layer *l, int rows, int columns) {
+  EmbeddingState *s = (EmbeddingState *)l->state;
+  size_t ids = (size_t)rows * columns;
+  return sizeof(float) * ids * (1 + s->embedding_dim) + sizeof(int) * ids;
+}
+
+Layer *layer_create_embedding(int vocab_size, int embedding_dim) {
+  Layer *l = (Layer *)malloc(sizeof(Layer));
+
+  if (l == NULL) {
+    perror("Could Not allocate memory for layer. NULL");
+    return NULL;
+  }
+
+  EmbeddingState *s = (EmbeddingState *)calloc(1, sizeof(EmbeddingState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for embedding state. NULL");
+    free(l);
+    return NULL;
+  }
+  s->vocab_size = vocab_size;
+  s->embedding_dim = embedding_dim;
+  s->seen_at = calloc(vocab_size, sizeof(unsigned int));
+  s->slot_of = malloc(sizeof(int) * vocab_size);
+
+  l->forward = _layer_forward_embedding;
+  l->backward = _layer_backward_embedding;
+  l->infer_shape = _embedding_infer_shape;
+  l->workspace_size = _embedding_workspace_size;
+
+  // Table: (vocab_size × embedding_dim), one contiguous row per id
+  l->weights = create_matrix(vocab_size, embedding_dim);
+  l->bias = NULL;
+  // Gradients live in the compact per-step rows, never a dense vocab matrix
+  l->d_weight = NULL;
+  l->d_bias = NULL;
+
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+
+  l->state = s;
+  l->free_state = _embedding_free_state;
+
+  if (l->weights == NULL || s->seen_at == NULL || s->slot_of == NULL) {
+    perror("Could Not allocate memory for embedding table. NULL");
+    free_layer(l);
+    return NULL;
+  }
+
+  float scale = 1.0f / sqrtf((float)embedding_dim);
+  int weight_count = vocab_size * embedding_dim;
+  for (int i = 0; i < weight_count; i++) {
+    // Random value in [-scale, scale]
+    l->weights->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale;
+  }
+
+  // Any number of id rows (fields); add_layer fills these in once the rows
+  // before it are known
+  l->input_n = 0;
+  l->output_n = 0;
+
+  l->name = "Embedding";
+  return l;
+}
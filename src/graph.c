@@ -0,0 +1,550 @@
+#include "../include/graph.h"
+#include "../include/scheduler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static char* _graph_strdup(const char *s) {
+    char *copy = malloc(strlen(s) + 1);
+    if (copy != NULL) {
+        strcpy(copy, s);
+    }
+    return copy;
+}
+
+static void _graph_invalidate(Graph *g) {
+    free(g->schedule);
+    if (g->free_after != NULL) {
+        for (int i = 0; i < g->node_count; i++) {
+            free(g->free_after[i]);
+        }
+        free(g->free_after);
+    }
+    free(g->free_count);
+    free(g->level_start);
+    g->schedule = NULL;
+    g->level_start = NULL;
+    g->level_count = 0;
+    g->free_after = NULL;
+    g->free_count = NULL;
+    g->compiled = 0;
+}
+
+Graph* create_graph() {
+    Graph *g = (Graph*)calloc(1, sizeof(Graph));
+    if (g == NULL) {
+        perror("Error Assigning Memory for Graph.\n");
+        return NULL;
+    }
+    g->input_node = -1;
+    g->output_node = -1;
+    return g;
+}
+
+void free_graph(Graph *g) {
+    if (g == NULL) {
+        perror("Can't Find Graph to free from memory\n");
+        return;
+    }
+
+    _graph_invalidate(g);
+    for (int i = 0; i < g->node_count; i++) {
+        GraphNode *node = &g->nodes[i];
+        free_layer(node->layer);
+        for (int j = 0; j < node->input_count; j++) {
+            free(node->input_names[j]);
+        }
+        free(node->input_names);
+        free(node->inputs);
+        free(node->input_rows);
+        free(node->name);
+    }
+    free(g->nodes);
+    free(g->output_name);
+    free(g);
+}
+
+static int _graph_find(Graph *g, const char *name) {
+    for (int i = 0; i < g->node_count; i++) {
+        if (strcmp(g->nodes[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Frees what a node that was never added holds, except its layer
+static void _graph_free_node_parts(GraphNode *node) {
+    if (node->input_names != NULL) {
+        for (int i = 0; i < node->input_count; i++) {
+            free(node->input_names[i]);
+        }
+    }
+    free(node->input_names);
+    free(node->inputs);
+    free(node->input_rows);
+    free(node->name);
+}
+
+// The graph owns l from here on: it is freed if the node can't be added
+static int _graph_add_node(Graph *g, GraphNodeType type, const char *name,
+                           Layer *l, const char **inputs, int count) {
+    if (g == NULL || name == NULL) {
+        perror("Error Adding Node, Graph or name is NULL\n");
+        free_layer(l);
+        return -1;
+    }
+    if (_graph_find(g, name) >= 0) {
+        fprintf(stderr, "Error: graph already has a node named '%s'\n", name);
+        free_layer(l);
+        return -1;
+    }
+
+    GraphNode *temp = realloc(g->nodes, (g->node_count + 1) * sizeof(GraphNode));
+    if (temp == NULL) {
+        perror("Error Reallocating memory to the graph nodes.\n");
+        free_layer(l);
+        return -1;
+    }
+    g->nodes = temp;
+
+    GraphNode *node = &g->nodes[g->node_count];
+    memset(node, 0, sizeof(GraphNode));
+    node->type = type;
+    node->name = _graph_strdup(name);
+    node->input_count = count;
+    int ok = node->name != NULL;
+    if (ok && count > 0) {
+        node->input_names = calloc(count, sizeof(char*));
+        node->inputs = malloc(count * sizeof(int));
+        node->input_rows = calloc(count, sizeof(int));
+        ok = node->input_names != NULL && node->inputs != NULL &&
+             node->input_rows != NULL;
+        for (int i = 0; ok && i < count; i++) {
+            node->input_names[i] = _graph_strdup(inputs[i]);
+            ok = node->input_names[i] != NULL;
+        }
+    }
+    if (!ok) {
+        perror("Error Allocating graph node.\n");
+        _graph_free_node_parts(node);
+        free_layer(l);
+        return -1;
+    }
+    node->layer = l;
+
+    _graph_invalidate(g);
+    return g->node_count++;
+}
+
+int graph_add_input(Graph *g, const char *name) {
+    if (g != NULL && g->input_node >= 0) {
+        fprintf(stderr, "Error: graph already has an input node\n");
+        return -1;
+    }
+    int idx = _graph_add_node(g, GRAPH_NODE_INPUT, name, NULL, NULL, 0);
+    if (idx >= 0) {
+        g->input_node = idx;
+    }
+    return idx;
+}
+
+int graph_add_layer(Graph *g, const char *name, Layer *l, const char *input) {
+    if (l == NULL || input == NULL) {
+        perror("Error Adding Layer, Layer or input is NULL\n");
+        free_layer(l);
+        return -1;
+    }
+    return _graph_add_node(g, GRAPH_NODE_LAYER, name, l, &input, 1);
+}
+
+int graph_add_sum(Graph *g, const char *name, const char **inputs, int count) {
+    if (inputs == NULL || count < 1) {
+        perror("Error Adding Sum node, no inputs\n");
+        return -1;
+    }
+    return _graph_add_node(g, GRAPH_NODE_SUM, name, NULL, inputs, count);
+}
+
+int graph_add_concat(Graph *g, const char *name, const char **inputs, int count) {
+    if (inputs == NULL || count < 1) {
+        perror("Error Adding Concat node, no inputs\n");
+        return -1;
+    }
+    return _graph_add_node(g, GRAPH_NODE_CONCAT, name, NULL, inputs, count);
+}
+
+void graph_set_output(Graph *g, const char *name) {
+    if (g == NULL || name == NULL) {
+        return;
+    }
+    free(g->output_name);
+    g->output_name = _graph_strdup(name);
+    if (g->output_name == NULL) {
+        perror("Error Allocating graph output name.\n");
+    }
+    _graph_invalidate(g);
+}
+
+int graph_compile(Graph *g) {
+    if (g == NULL) {
+        return -1;
+    }
+    if (g->compiled) {
+        return 0;
+    }
+    if (g->input_node < 0) {
+        fprintf(stderr, "Error: graph has no input node\n");
+        return -1;
+    }
+
+    int n = g->node_count;
+    for (int i = 0; i < n; i++) {
+        GraphNode *node = &g->nodes[i];
+        for (int j = 0; j < node->input_count; j++) {
+            node->inputs[j] = _graph_find(g, node->input_names[j]);
+            if (node->inputs[j] < 0) {
+                fprintf(stderr, "Error: node '%s' reads unknown node '%s'\n",
+                        node->name, node->input_names[j]);
+                return -1;
+            }
+        }
+    }
+
+    g->output_node = (g->output_name != NULL) ? _graph_find(g, g->output_name)
+                                              : n - 1;
+    if (g->output_node < 0) {
+        fprintf(stderr, "Error: graph output '%s' not found\n", g->output_name);
+        return -1;
+    }
+
+    // Kahn's algorithm one wavefront at a time. Each level holds the nodes
+    // whose inputs are all in earlier levels, lowest index first, so the
+    // nodes of a level can run concurrently.
+    int *pending = calloc(n, sizeof(int));
+    g->schedule = malloc(n * sizeof(int));
+    g->level_start = malloc((n + 1) * sizeof(int));
+    g->free_after = calloc(n, sizeof(int*));
+    g->free_count = calloc(n, sizeof(int));
+    if (pending == NULL || g->schedule == NULL || g->level_start == NULL ||
+        g->free_after == NULL || g->free_count == NULL) {
+        perror("Error Allocating graph schedule.\n");
+        free(pending);
+        _graph_invalidate(g);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        pending[i] = g->nodes[i].input_count;
+    }
+
+    int scheduled = 0;
+    g->level_count = 0;
+    g->level_start[0] = 0;
+    while (scheduled < n) {
+        int level_begin = scheduled;
+        for (int i = 0; i < n; i++) {
+            if (pending[i] == 0) {
+                pending[i] = -1;
+                g->schedule[scheduled++] = i;
+            }
+        }
+        if (scheduled == level_begin) {
+            break;
+        }
+        for (int s = level_begin; s < scheduled; s++) {
+            int i = g->schedule[s];
+            for (int c = 0; c < n; c++) {
+                for (int j = 0; j < g->nodes[c].input_count; j++) {
+                    if (g->nodes[c].inputs[j] == i) {
+                        pending[c]--;
+                    }
+                }
+            }
+        }
+        g->level_start[++g->level_count] = scheduled;
+    }
+    free(pending);
+
+    if (scheduled < n) {
+        fprintf(stderr, "Error: graph contains a cycle\n");
+        _graph_invalidate(g);
+        return -1;
+    }
+
+    // A value dies after the last step that reads it. The graph input is
+    // borrowed from the caller and the output is returned, neither is freed.
+    for (int step = 0; step < n; step++) {
+        g->nodes[g->schedule[step]].last_use = step;
+    }
+    for (int step = 0; step < n; step++) {
+        GraphNode *node = &g->nodes[g->schedule[step]];
+        for (int j = 0; j < node->input_count; j++) {
+            GraphNode *src = &g->nodes[node->inputs[j]];
+            if (src->last_use < step) {
+                src->last_use = step;
+            }
+        }
+    }
+    for (int i = 0; i < n; i++) {
+        if (i == g->input_node || i == g->output_node) {
+            continue;
+        }
+        int step = g->nodes[i].last_use;
+        int *temp = realloc(g->free_after[step],
+                            (g->free_count[step] + 1) * sizeof(int));
+        if (temp == NULL) {
+            perror("Error Allocating graph free lists.\n");
+            _graph_invalidate(g);
+            return -1;
+        }
+        g->free_after[step] = temp;
+        g->free_after[step][g->free_count[step]++] = i;
+    }
+
+    g->compiled = 1;
+    return 0;
+}
+
+static Matrix* _graph_eval_node(GraphNode *node, Matrix **values) {
+    switch (node->type) {
+    case GRAPH_NODE_LAYER:
+        return layer_forward(node->layer, values[node->inputs[0]]);
+
+    case GRAPH_NODE_SUM: {
+        Matrix *out = copy_matrix(values[node->inputs[0]]);
+        for (int j = 1; j < node->input_count && out != NULL; j++) {
+            Matrix *in = values[node->inputs[j]];
+            if (in->rows != out->rows || in->columns != out->columns) {
+                fprintf(stderr, "Error: sum node '%s' input shapes differ\n",
+                        node->name);
+                free_matrix(out);
+                return NULL;
+            }
+            add_matrix(out, in);
+        }
+        return out;
+    }
+
+    case GRAPH_NODE_CONCAT: {
+        int rows = 0;
+        int columns = values[node->inputs[0]]->columns;
+        for (int j = 0; j < node->input_count; j++) {
+            Matrix *in = values[node->inputs[j]];
+            if (in->columns != columns) {
+                fprintf(stderr, "Error: concat node '%s' column counts differ\n",
+                        node->name);
+                return NULL;
+            }
+            node->input_rows[j] = in->rows;
+            rows += in->rows;
+        }
+        Matrix *out = create_matrix(rows, columns);
+        if (out == NULL) {
+            return NULL;
+        }
+        float *dst = out->data;
+        for (int j = 0; j < node->input_count; j++) {
+            Matrix *in = values[node->inputs[j]];
+            memcpy(dst, in->data, sizeof(float) * in->rows * in->columns);
+            dst += in->rows * in->columns;
+        }
+        return out;
+    }
+
+    default:
+        return NULL;
+    }
+}
+
+typedef struct {
+    Graph *g;
+    Matrix **values;
+} GraphLevelTask;
+
+static void _graph_eval_steps(void *ctx, int begin, int end) {
+    GraphLevelTask *task = (GraphLevelTask*)ctx;
+    for (int step = begin; step < end; step++) {
+        int idx = task->g->schedule[step];
+        GraphNode *node = &task->g->nodes[idx];
+        if (node->type != GRAPH_NODE_INPUT) {
+            task->values[idx] = _graph_eval_node(node, task->values);
+        }
+    }
+}
+
+// Runs the schedule level by level; the nodes of a level are independent
+// branches and go to the scheduler together. values[] must be node_count
+// long and NULL initialized. On return values[output_node] holds the
+// prediction, everything else that was produced here has been freed.
+static int _graph_forward(Graph *g, Matrix *input, Matrix **values) {
+    values[g->input_node] = input;
+    GraphLevelTask task = {g, values};
+
+    for (int level = 0; level < g->level_count; level++) {
+        int begin = g->level_start[level];
+        int end = g->level_start[level + 1];
+        parallel_for(begin, end, 1, _graph_eval_steps, &task);
+
+        for (int step = begin; step < end; step++) {
+            int idx = g->schedule[step];
+            if (g->nodes[idx].type == GRAPH_NODE_INPUT || values[idx] != NULL) {
+                continue;
+            }
+            fprintf(stderr, "Error: graph node '%s' failed\n", g->nodes[idx].name);
+            for (int i = 0; i < g->node_count; i++) {
+                if (i != g->input_node) {
+                    free_matrix(values[i]);
+                }
+                values[i] = NULL;
+            }
+            return -1;
+        }
+
+        // Free branch activations as soon as their last reader has run
+        for (int step = begin; step < end; step++) {
+            for (int k = 0; k < g->free_count[step]; k++) {
+                int dead = g->free_after[step][k];
+                free_matrix(values[dead]);
+                values[dead] = NULL;
+            }
+        }
+    }
+    return 0;
+}
+
+Matrix* predict_graph(Graph *g, Matrix *input) {
+    if (g == NULL) {
+        perror("Graph is NULL, Can't predict. \n");
+        return NULL;
+    }
+    if (input == NULL) {
+        perror("Input is Empty \n");
+        return NULL;
+    }
+    if (graph_compile(g) != 0) {
+        return NULL;
+    }
+
+    Matrix **values = calloc(g->node_count, sizeof(Matrix*));
+    if (values == NULL) {
+        perror("Error Allocating graph values.\n");
+        return NULL;
+    }
+
+    Matrix *out = NULL;
+    if (_graph_forward(g, input, values) == 0) {
+        out = values[g->output_node];
+        if (g->output_node == g->input_node) {
+            out = copy_matrix(input);
+        }
+    }
+    free(values);
+    return out;
+}
+
+// grads[idx] += g, taking ownership of g
+static void _graph_accumulate(Matrix **grads, int idx, Matrix *g) {
+    if (g == NULL) {
+        return;
+    }
+    if (grads[idx] == NULL) {
+        grads[idx] = g;
+        return;
+    }
+    add_matrix(grads[idx], g);
+    free_matrix(g);
+}
+
+void train_graph(Graph *g, Matrix *input, Matrix *target, float learning_rate) {
+    if (g == NULL || input == NULL || target == NULL) return;
+
+    Matrix *prediction = predict_graph(g, input);
+    if (prediction == NULL) {
+        return;
+    }
+
+    Matrix **grads = calloc(g->node_count, sizeof(Matrix*));
+    if (grads == NULL) {
+        perror("Error Allocating graph gradients.\n");
+        free_matrix(prediction);
+        return;
+    }
+    grads[g->output_node] = subtract_matrix(prediction, target);
+
+    // Reverse schedule: by the time a node is reached every consumer has
+    // already added its contribution, so its gradient is complete.
+    for (int step = g->node_count - 1; step >= 0; step--) {
+        int idx = g->schedule[step];
+        GraphNode *node = &g->nodes[idx];
+        Matrix *grad = grads[idx];
+        if (grad == NULL) {
+            continue;
+        }
+
+        switch (node->type) {
+        case GRAPH_NODE_LAYER:
+            _graph_accumulate(grads, node->inputs[0],
+                              layer_backward(node->layer, grad, learning_rate));
+            break;
+
+        case GRAPH_NODE_SUM:
+            for (int j = 0; j < node->input_count; j++) {
+                _graph_accumulate(grads, node->inputs[j], copy_matrix(grad));
+            }
+            break;
+
+        case GRAPH_NODE_CONCAT: {
+            const float *src = grad->data;
+            for (int j = 0; j < node->input_count; j++) {
+                Matrix *part = create_matrix(node->input_rows[j], grad->columns);
+                if (part == NULL) {
+                    break;
+                }
+                memcpy(part->data, src, sizeof(float) * part->rows * part->columns);
+                src += part->rows * part->columns;
+                _graph_accumulate(grads, node->inputs[j], part);
+            }
+            break;
+        }
+
+        default:
+            break;
+        }
+
+        free_matrix(grad);
+        grads[idx] = NULL;
+    }
+
+    free(grads);
+    free_matrix(prediction);
+}
+
+static const char* _graph_node_type_name(GraphNodeType type) {
+    switch (type) {
+    case GRAPH_NODE_INPUT: return "Input";
+    case GRAPH_NODE_LAYER: return "Layer";
+    case GRAPH_NODE_SUM: return "Sum";
+    case GRAPH_NODE_CONCAT: return "Concat";
+    }
+    return "?";
+}
+
+void print_graph_info(Graph *g) {
+    if (g == NULL) {
+        printf("Graph is NULL\n");
+        return;
+    }
+    int compiled = (graph_compile(g) == 0);
+    printf("Graph has %d nodes:\n", g->node_count);
+    for (int step = 0; step < g->node_count; step++) {
+        int idx = compiled ? g->schedule[step] : step;
+        GraphNode *node = &g->nodes[idx];
+        printf(" %s [%s]", node->name, node->layer != NULL
+                                           ? node->layer->name
+                                           : _graph_node_type_name(node->type));
+        for (int j = 0; j < node->input_count; j++) {
+            printf("%s%s", j == 0 ? " <- " : ", ", node->input_names[j]);
+        }
+        printf("\n");
+    }
+}
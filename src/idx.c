@@ -0,0 +1,235 @@
+#include "../include/idx.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static int _element_size(int type) {
+    switch (type) {
+    case IDX_UINT8:
+    case IDX_INT8:
+        return 1;
+    case IDX_INT16:
+        return 2;
+    case IDX_INT32:
+    case IDX_FLOAT32:
+        return 4;
+    case IDX_FLOAT64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static uint32_t _read_be32(const unsigned char* p) {
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+           ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+}
+
+// Fills in the header fields from the mapping. Returns 0 or -1.
+static int _parse_header(IdxFile* f, const char* path) {
+    const unsigned char* bytes = f->map;
+    if (f->map_size < 4 || bytes[0] != 0 || bytes[1] != 0) {
+        fprintf(stderr, "Error: %s is not an IDX file\n", path);
+        return -1;
+    }
+    f->type = (IdxType)bytes[2];
+    f->element_size = _element_size(bytes[2]);
+    f->dimension_count = bytes[3];
+    if (f->element_size == 0) {
+        fprintf(stderr, "Error: %s has unknown IDX type 0x%02x\n", path,
+                bytes[2]);
+        return -1;
+    }
+    if (f->dimension_count < 1 || f->dimension_count > IDX_MAX_DIMENSIONS) {
+        fprintf(stderr, "Error: %s has %d dimensions\n", path,
+                f->dimension_count);
+        return -1;
+    }
+
+    size_t header = 4 + 4 * (size_t)f->dimension_count;
+    if (f->map_size < header) {
+        fprintf(stderr, "Error: %s is truncated in the header\n", path);
+        return -1;
+    }
+
+    // The payload size is checked against the file size, so the products
+    // only need to stay below it to be free of overflow
+    size_t payload = (size_t)f->element_size;
+    f->sample_size = 1;
+    for (int d = 0; d < f->dimension_count; d++) {
+        uint32_t dim = _read_be32(bytes + 4 + 4 * d);
+        if (dim == 0 || dim > (uint32_t)0x7fffffff ||
+            dim > (f->map_size - header) / payload) {
+            fprintf(stderr, "Error: %s dimension %d (%u) doesn't fit the file\n",
+                    path, d, dim);
+            return -1;
+        }
+        f->dimensions[d] = (int)dim;
+        payload *= dim;
+        if (d > 0) {
+            f->sample_size *= dim;
+        }
+    }
+    if (header + payload != f->map_size) {
+        fprintf(stderr, "Error: %s has %zu payload bytes, header says %zu\n",
+                path, f->map_size - header, payload);
+        return -1;
+    }
+
+    f->count = f->dimensions[0];
+    f->data = bytes + header;
+    return 0;
+}
+
+IdxFile* idx_open(const char* path) {
+    if (path == NULL) return NULL;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        fprintf(stderr, "Error: %s is empty or unreadable\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    IdxFile* f = calloc(1, sizeof(IdxFile));
+    if (f == NULL) {
+        perror("Error Allocating memory for IDX file.\n");
+        close(fd);
+        return NULL;
+    }
+    f->map_size = (size_t)st.st_size;
+    f->map = mmap(NULL, f->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file referenced
+    close(fd);
+    if (f->map == MAP_FAILED) {
+        perror("Error mapping IDX file.\n");
+        free(f);
+        return NULL;
+    }
+
+    if (_parse_header(f, path) != 0) {
+        idx_close(f);
+        return NULL;
+    }
+    // Batches are usually read front to back, let the kernel read ahead
+    posix_madvise(f->map, f->map_size, POSIX_MADV_SEQUENTIAL);
+    return f;
+}
+
+void idx_close(IdxFile* f) {
+    if (f == NULL) return;
+    munmap(f->map, f->map_size);
+    free(f);
+}
+
+const uint8_t* idx_sample(const IdxFile* f, int index) {
+    if (f == NULL || f->type != IDX_UINT8 || index < 0 || index >= f->count) {
+        return NULL;
+    }
+    return f->data + (size_t)index * f->sample_size;
+}
+
+// out_columns is -1 without an output
+static int _check_copy(const IdxFile* f, int first, int count, int out_columns,
+                       int column) {
+    if (f == NULL || out_columns < 0 || f->type != IDX_UINT8) {
+        fprintf(stderr, "Error: IDX copies need a uint8 file and a matrix\n");
+        return -1;
+    }
+    if (first < 0 || count < 0 || first > f->count - count) {
+        fprintf(stderr, "Error: samples %d..%d out of range (%d samples)\n",
+                first, first + count - 1, f->count);
+        return -1;
+    }
+    if (column < 0 || column > out_columns - count) {
+        fprintf(stderr, "Error: %d samples don't fit at column %d of %d\n",
+                count, column, out_columns);
+        return -1;
+    }
+    return 0;
+}
+
+int idx_copy_columns(const IdxFile* f, int first, int count, float scale,
+                     Matrix* out, int column) {
+    if (_check_copy(f, first, count, out != NULL ? out->columns : -1,
+                    column) != 0) {
+        return -1;
+    }
+    if ((size_t)out->rows != f->sample_size) {
+        fprintf(stderr, "Error: samples have %zu values, matrix has %d rows\n",
+                f->sample_size, out->rows);
+        return -1;
+    }
+
+    // Row by row, so the writes stream along a matrix row and the reads stay
+    // within count mapped samples
+    for (int r = 0; r < out->rows; r++) {
+        float* row = out->data + (size_t)r * out->columns + column;
+        const uint8_t* src = f->data + (size_t)first * f->sample_size + r;
+        for (int b = 0; b < count; b++) {
+            row[b] = src[(size_t)b * f->sample_size] * scale;
+        }
+    }
+    return 0;
+}
+
+int idx_copy_byte_columns(const IdxFile* f, int first, int count,
+                          ByteMatrix* out, int column) {
+    if (_check_copy(f, first, count, out != NULL ? out->columns : -1,
+                    column) != 0) {
+        return -1;
+    }
+    if ((size_t)out->rows != f->sample_size) {
+        fprintf(stderr, "Error: samples have %zu values, matrix has %d rows\n",
+                f->sample_size, out->rows);
+        return -1;
+    }
+
+    for (int r = 0; r < out->rows; r++) {
+        unsigned char* row = out->data + (size_t)r * out->columns + column;
+        const uint8_t* src = f->data + (size_t)first * f->sample_size + r;
+        for (int b = 0; b < count; b++) {
+            row[b] = src[(size_t)b * f->sample_size];
+        }
+    }
+    return 0;
+}
+
+int idx_copy_one_hot(const IdxFile* labels, int first, int count,
+                     Matrix* out, int column) {
+    if (_check_copy(labels, first, count,
+                    out != NULL ? out->columns : -1, column) != 0) {
+        return -1;
+    }
+    if (labels->sample_size != 1) {
+        fprintf(stderr, "Error: label file has %zu values per sample\n",
+                labels->sample_size);
+        return -1;
+    }
+
+    for (int r = 0; r < out->rows; r++) {
+        float* row = out->data + (size_t)r * out->columns + column;
+        for (int b = 0; b < count; b++) {
+            row[b] = 0.0f;
+        }
+    }
+    for (int b = 0; b < count; b++) {
+        int label = labels->data[first + b];
+        if (label >= out->rows) {
+            fprintf(stderr, "Error: label %d of sample %d exceeds %d classes\n",
+                    label, first + b, out->rows);
+            return -1;
+        }
+        out->data[(size_t)label * out->columns + column + b] = 1.0f;
+    }
+    return 0;
+}
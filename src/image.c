@@ -1,7 +1,32 @@
+#define STB_IMAGE_IMPLEMENTATION
 #include "../include/image.h"
+#include "../include/scheduler.h"
+
+#include <ctype.h>
+#include <math.h>
+
+// Images resampled together by one batch task
+#define IMAGE_BATCH_BLOCK 8
 
 Image* read_image(char *path) {
-    Image *img = malloc(sizeof(Image));
+    if (path == NULL) {
+        return NULL;
+    }
+
+    int width, height, channels;
+    unsigned char *pixels = stbi_load(path, &width, &height, &channels, 0);
+    if (pixels == NULL) {
+        fprintf(stderr, "Error: could not decode %s: %s\n", path,
+                stbi_failure_reason());
+        return NULL;
+    }
+
+    Image *img = calloc(1, sizeof(Image));
+    if (img == NULL) {
+        perror("Error Allocating memory for image.\n");
+        stbi_image_free(pixels);
+        return NULL;
+    }
     char *last_slash = strrchr(path, '/');
     char *file_name;
 
@@ -10,7 +35,29 @@ Image* read_image(char *path) {
     } else {
         file_name = path;
     }
-    // TODO: implement image read functions from stb_image.h
+    char *extension = strrchr(file_name, '.');
+
+    img->width = width;
+    img->height = height;
+    img->channels = channels;
+    size_t count = (size_t)width * height * channels;
+    img->data = malloc(sizeof(float) * count);
+    img->name = strdup(file_name);
+    img->type = strdup(extension != NULL ? extension + 1 : "");
+    if (img->data == NULL || img->name == NULL || img->type == NULL) {
+        perror("Error Allocating memory for image.\n");
+        stbi_image_free(pixels);
+        free_image(img);
+        return NULL;
+    }
+    for (char *c = img->type; *c != '\0'; c++) {
+        *c = (char)toupper((unsigned char)*c);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        img->data[i] = pixels[i] / 255.0f;
+    }
+    stbi_image_free(pixels);
     return img;
 }
 
@@ -31,4 +78,385 @@ void free_image(Image *img) {
 
     free(img);
     return;
-}
\ No newline at end of file
+}
+
+// Taps of a separable resampling filter along one axis: output i reads
+// taps[i] source pixels from start[i] with weights[i * max_taps + t]
+typedef struct {
+    int *start;
+    int *taps;
+    float *weights;
+    int max_taps;
+} AxisFilter;
+
+static void _free_filter(AxisFilter *f) {
+    free(f->start);
+    free(f->taps);
+    free(f->weights);
+}
+
+// Filter for outputs [offset, offset + size) of a source axis of length
+// source scaled to length resized. Returns 0 or -1.
+static int _build_filter(AxisFilter *f, ImageResize mode, int source,
+                         int resized, int offset, int size) {
+    float scale = (float)source / resized;
+    f->max_taps = mode == IMAGE_RESIZE_AREA ? (int)ceilf(scale) + 1
+                  : mode == IMAGE_RESIZE_BILINEAR ? 2
+                  : 1;
+    f->start = malloc(sizeof(int) * size);
+    f->taps = malloc(sizeof(int) * size);
+    f->weights = malloc(sizeof(float) * size * f->max_taps);
+    if (f->start == NULL || f->taps == NULL || f->weights == NULL) {
+        perror("Error Allocating memory for resize filter.\n");
+        _free_filter(f);
+        return -1;
+    }
+
+    for (int o = 0; o < size; o++) {
+        int i = o + offset;
+        float *w = f->weights + (size_t)o * f->max_taps;
+        if (mode == IMAGE_RESIZE_NONE) {
+            f->start[o] = i;
+            f->taps[o] = 1;
+            w[0] = 1.0f;
+        } else if (mode == IMAGE_RESIZE_BILINEAR) {
+            // Pixel centers line up: output i sits at (i + 0.5) * scale
+            float x = (i + 0.5f) * scale - 0.5f;
+            x = x < 0.0f ? 0.0f : x > source - 1 ? source - 1 : x;
+            int x0 = (int)x;
+            f->start[o] = x0;
+            f->taps[o] = x0 + 1 < source ? 2 : 1;
+            w[0] = 1.0f - (x - x0);
+            w[1] = x - x0;
+            if (f->taps[o] == 1) {
+                w[0] = 1.0f;
+            }
+        } else {
+            // Average of the source span [lo, hi), edge pixels by coverage
+            float lo = i * scale;
+            float hi = lo + scale;
+            int first = (int)lo < source ? (int)lo : source - 1;
+            int last = (int)ceilf(hi);
+            if (last > source) {
+                last = source;
+            }
+            if (last - first > f->max_taps) {
+                last = first + f->max_taps;
+            }
+            float total = 0.0f;
+            for (int t = 0; t < last - first; t++) {
+                float a = first + t < lo ? lo : first + t;
+                float b = first + t + 1 > hi ? hi : first + t + 1;
+                w[t] = b - a;
+                total += w[t];
+            }
+            for (int t = 0; t < last - first; t++) {
+                w[t] /= total;
+            }
+            f->start[o] = first;
+            f->taps[o] = last - first;
+        }
+    }
+    return 0;
+}
+
+static unsigned int _crop_offset(int resized, int size, ImageCrop crop,
+                                 unsigned int *rng) {
+    if (crop != IMAGE_CROP_RANDOM || resized == size) {
+        return (resized - size) / 2;
+    }
+    // xorshift32, the state is never zero
+    *rng ^= *rng << 13;
+    *rng ^= *rng >> 17;
+    *rng ^= *rng << 5;
+    return *rng % (unsigned int)(resized - size + 1);
+}
+
+// One image in the fused pass
+typedef struct {
+    const unsigned char *pixels;
+    size_t stride;      // bytes per source row
+    AxisFilter fx;
+    AxisFilter fy;
+    int first;          // source row bytes [first, last) reached by the crop
+    int last;
+    float *row;         // vertically blended source row
+} Resampler;
+
+static void _free_resampler(Resampler *r) {
+    _free_filter(&r->fx);
+    _free_filter(&r->fy);
+    free(r->row);
+}
+
+// Fixes the scale and crop of one image and builds its filters.
+// Returns 0 or -1.
+static int _init_resampler(Resampler *r, const unsigned char *pixels,
+                           int width, int height, const ImageBatchOptions *o,
+                           unsigned int seed) {
+    memset(r, 0, sizeof(Resampler));
+
+    // Size of the scaled image the crop is cut from
+    int resized_w = width, resized_h = height;
+    if (o->resize != IMAGE_RESIZE_NONE && o->resize_short_side > 0) {
+        float scale = (float)o->resize_short_side /
+                      (width < height ? width : height);
+        if (scale * width < o->width) {
+            scale = (float)o->width / width;
+        }
+        if (scale * height < o->height) {
+            scale = (float)o->height / height;
+        }
+        resized_w = (int)(width * scale + 0.5f);
+        resized_h = (int)(height * scale + 0.5f);
+        resized_w = resized_w < o->width ? o->width : resized_w;
+        resized_h = resized_h < o->height ? o->height : resized_h;
+    } else if (o->resize != IMAGE_RESIZE_NONE) {
+        resized_w = o->width;
+        resized_h = o->height;
+    }
+    if (resized_w < o->width || resized_h < o->height) {
+        fprintf(stderr, "Error: a %dx%d image is too small for a %dx%d crop\n",
+                width, height, o->width, o->height);
+        return -1;
+    }
+    // Hash the seed so neighbouring images don't crop alike
+    unsigned int rng = seed * 2654435761u;
+    rng = (rng ^ (rng >> 16)) * 0x45d9f3bu;
+    rng = (rng ^ (rng >> 16)) | 1u;
+    int left = (int)_crop_offset(resized_w, o->width, o->crop, &rng);
+    int top = (int)_crop_offset(resized_h, o->height, o->crop, &rng);
+
+    r->pixels = pixels;
+    r->stride = (size_t)width * o->channels;
+    if (_build_filter(&r->fx, o->resize, width, resized_w, left, o->width) != 0) {
+        return -1;
+    }
+    if (_build_filter(&r->fy, o->resize, height, resized_h, top, o->height) != 0) {
+        _free_filter(&r->fx);
+        return -1;
+    }
+    r->first = r->fx.start[0] * o->channels;
+    r->last = (r->fx.start[o->width - 1] + r->fx.taps[o->width - 1]) *
+              o->channels;
+    r->row = malloc(sizeof(float) * r->stride);
+    if (r->row == NULL) {
+        perror("Error Allocating memory for image rows.\n");
+        _free_filter(&r->fx);
+        _free_filter(&r->fy);
+        return -1;
+    }
+    return 0;
+}
+
+// Output row y of the image as interleaved floats in line, normalized with
+// value * mul + add per channel
+static void _resample_row(Resampler *r, const ImageBatchOptions *o,
+                          const float *mul, const float *add, int y,
+                          float *line) {
+    int channels = o->channels;
+
+    // Vertical pass: contiguous over the row, vectorizes. restrict because
+    // the byte source could otherwise alias the row.
+    const float *wy = r->fy.weights + (size_t)y * r->fy.max_taps;
+    float *restrict acc = r->row;
+    const unsigned char *restrict src =
+        r->pixels + (size_t)r->fy.start[y] * r->stride;
+    float w = wy[0];
+    for (int i = r->first; i < r->last; i++) {
+        acc[i] = w * src[i];
+    }
+    for (int t = 1; t < r->fy.taps[y]; t++) {
+        src += r->stride;
+        w = wy[t];
+        for (int i = r->first; i < r->last; i++) {
+            acc[i] += w * src[i];
+        }
+    }
+
+    // Horizontal pass, normalized on the way out
+    for (int x = 0; x < o->width; x++) {
+        const float *wx = r->fx.weights + (size_t)x * r->fx.max_taps;
+        const float *p = acc + (size_t)r->fx.start[x] * channels;
+        int taps = r->fx.taps[x];
+        for (int c = 0; c < channels; c++) {
+            float v = wx[0] * p[c];
+            for (int t = 1; t < taps; t++) {
+                v += wx[t] * p[t * channels + c];
+            }
+            line[x * channels + c] = v * mul[c] + add[c];
+        }
+    }
+}
+
+// Runs n images through the fused pass, image k into column columns[k].
+// Each output row is computed for the whole group and written together,
+// so neighbouring columns share the cache lines of the batch matrix.
+static int _preprocess_group(Resampler *rs, int n, const int *columns,
+                             const ImageBatchOptions *o, Matrix *out) {
+    int channels = o->channels;
+    size_t line_size = (size_t)o->width * channels;
+    float *lines = malloc(sizeof(float) * line_size * n);
+    if (lines == NULL) {
+        perror("Error Allocating memory for image rows.\n");
+        return -1;
+    }
+
+    // (pixel / 255 - mean) / std folded into one multiply-add
+    float mul[4], add[4];
+    for (int c = 0; c < channels; c++) {
+        float inv_std = o->std[c] != 0.0f ? 1.0f / o->std[c] : 1.0f;
+        mul[c] = inv_std / 255.0f;
+        add[c] = -o->mean[c] * inv_std;
+    }
+
+    size_t plane = (size_t)o->width * o->height;
+    for (int y = 0; y < o->height; y++) {
+        for (int k = 0; k < n; k++) {
+            _resample_row(&rs[k], o, mul, add, y, lines + k * line_size);
+        }
+        // CHW scatter into the batch columns
+        for (int c = 0; c < channels; c++) {
+            float *dst = out->data +
+                         ((size_t)c * plane + (size_t)y * o->width) * out->columns;
+            for (int x = 0; x < o->width; x++) {
+                const float *v = lines + x * channels + c;
+                for (int k = 0; k < n; k++) {
+                    dst[columns[k]] = v[k * line_size];
+                }
+                dst += out->columns;
+            }
+        }
+    }
+    free(lines);
+    return 0;
+}
+
+int preprocess_image(const unsigned char *pixels, int width, int height,
+                     const ImageBatchOptions *options, unsigned int seed,
+                     Matrix *out, int column) {
+    const ImageBatchOptions *o = options;
+    if (pixels == NULL || o == NULL || out == NULL || width <= 0 ||
+        height <= 0 || o->width <= 0 || o->height <= 0 ||
+        o->channels < 1 || o->channels > 4 ||
+        out->rows != o->width * o->height * o->channels ||
+        column < 0 || column >= out->columns) {
+        return -1;
+    }
+    Resampler r;
+    if (_init_resampler(&r, pixels, width, height, o, seed) != 0) {
+        return -1;
+    }
+    int result = _preprocess_group(&r, 1, &column, o, out);
+    _free_resampler(&r);
+    return result;
+}
+
+typedef struct {
+    char **paths;
+    int count;
+    int block;          // images per task
+    const ImageBatchOptions *options;
+    Matrix *out;
+    unsigned char *status; // 1 or 0 per image, or NULL
+    int decoded;
+} ImageBatchJob;
+
+static void _zero_column(Matrix *out, int b) {
+    for (int r = 0; r < out->rows; r++) {
+        out->data[(size_t)r * out->columns + b] = 0.0f;
+    }
+}
+
+static void _set_status(ImageBatchJob *job, int b, int ok) {
+    if (job->status != NULL) {
+        job->status[b] = (unsigned char)ok;
+    }
+}
+
+static void _decode_images(void *ctx, int begin, int end) {
+    ImageBatchJob *job = (ImageBatchJob *)ctx;
+    const ImageBatchOptions *o = job->options;
+    unsigned char *pixels[IMAGE_BATCH_BLOCK];
+    Resampler rs[IMAGE_BATCH_BLOCK];
+    int columns[IMAGE_BATCH_BLOCK];
+
+    for (int block = begin; block < end; block++) {
+        int first = block * job->block;
+        int last = first + job->block < job->count ? first + job->block
+                                                   : job->count;
+        int n = 0;
+        for (int b = first; b < last; b++) {
+            int width, height, channels;
+            pixels[n] = stbi_load(job->paths[b], &width, &height, &channels,
+                                  o->channels);
+            if (pixels[n] == NULL) {
+                fprintf(stderr, "Error: could not decode %s: %s\n",
+                        job->paths[b], stbi_failure_reason());
+                _zero_column(job->out, b);
+                _set_status(job, b, 0);
+                continue;
+            }
+            if (_init_resampler(&rs[n], pixels[n], width, height, o,
+                                o->seed + (unsigned int)b) != 0) {
+                fprintf(stderr, "Error: could not preprocess %s\n",
+                        job->paths[b]);
+                stbi_image_free(pixels[n]);
+                _zero_column(job->out, b);
+                _set_status(job, b, 0);
+                continue;
+            }
+            columns[n++] = b;
+        }
+
+        int ok = n > 0 && _preprocess_group(rs, n, columns, o, job->out) == 0;
+        if (ok) {
+            __atomic_fetch_add(&job->decoded, n, __ATOMIC_RELAXED);
+        }
+        for (int k = 0; k < n; k++) {
+            if (!ok) {
+                _zero_column(job->out, columns[k]);
+            }
+            _set_status(job, columns[k], ok);
+        }
+        for (int k = 0; k < n; k++) {
+            _free_resampler(&rs[k]);
+            stbi_image_free(pixels[k]);
+        }
+    }
+}
+
+int read_image_batch(char **paths, int count, const ImageBatchOptions *options,
+                     Matrix *out) {
+    return read_image_batch_status(paths, count, options, out, NULL);
+}
+
+int read_image_batch_status(char **paths, int count,
+                            const ImageBatchOptions *options, Matrix *out,
+                            unsigned char *status) {
+    if (paths == NULL || options == NULL || out == NULL || count < 0) {
+        return -1;
+    }
+    if (options->width <= 0 || options->height <= 0 ||
+        options->channels < 1 || options->channels > 4) {
+        fprintf(stderr, "Error: invalid image batch %dx%dx%d\n",
+                options->width, options->height, options->channels);
+        return -1;
+    }
+    if (out->rows != options->width * options->height * options->channels ||
+        out->columns < count) {
+        fprintf(stderr, "Error: %d images of %dx%dx%d need a %d x %d matrix\n",
+                count, options->width, options->height, options->channels,
+                options->width * options->height * options->channels, count);
+        return -1;
+    }
+
+    // Small groups of images per task: decode time varies a lot between
+    // files and stealing evens it out, while a group shares the cache lines
+    // of its columns. Groups shrink until every thread has a few.
+    int block = count / (2 * scheduler_thread_count());
+    block = block < 1 ? 1 : block > IMAGE_BATCH_BLOCK ? IMAGE_BATCH_BLOCK : block;
+    ImageBatchJob job = {paths, count, block, options, out, status, 0};
+    parallel_for(0, (count + block - 1) / block, 1, _decode_images, &job);
+    return job.decoded;
+}
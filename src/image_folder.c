@@ -0,0 +1,683 @@
+#include "../include/image_folder.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+// Images decoded per read_image_batch call while building a cache
+#define IMAGE_CACHE_DECODE_BATCH 256
+#define IMAGE_CACHE_MAGIC "CNNIMGS"
+#define IMAGE_CACHE_VERSION 1
+#define IMAGE_CACHE_ALIGN 64
+
+// Extensions stb_image decodes
+static const char* _image_extensions[] = {
+    "jpg", "jpeg", "png", "bmp", "gif", "tga", "psd",
+    "hdr", "pic", "pnm", "ppm", "pgm",
+};
+
+static int _is_image_name(const char* name) {
+    const char* dot = strrchr(name, '.');
+    if (dot == NULL || dot == name) {
+        return 0;
+    }
+    size_t n = sizeof(_image_extensions) / sizeof(_image_extensions[0]);
+    for (size_t e = 0; e < n; e++) {
+        const char* a = dot + 1;
+        const char* b = _image_extensions[e];
+        while (*a != '\0' && tolower((unsigned char)*a) == *b) {
+            a++;
+            b++;
+        }
+        if (*a == '\0' && *b == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static char* _join_path(const char* dir, const char* name) {
+    size_t a = strlen(dir);
+    size_t b = strlen(name);
+    char* path = malloc(a + b + 2);
+    if (path == NULL) {
+        perror("Error Allocating memory for image path.\n");
+        return NULL;
+    }
+    memcpy(path, dir, a);
+    path[a] = '/';
+    memcpy(path + a + 1, name, b + 1);
+    return path;
+}
+
+static int _compare_strings(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Appends path (taking it) with label. Returns 0 or -1.
+static int _add_image(ImageFolder* f, int* capacity, char* path, int label) {
+    if (f->count == *capacity) {
+        int grown = *capacity > 0 ? *capacity * 2 : 256;
+        char** paths = realloc(f->paths, grown * sizeof(char*));
+        if (paths != NULL) {
+            f->paths = paths;
+        }
+        int32_t* labels = realloc(f->labels, grown * sizeof(int32_t));
+        if (labels != NULL) {
+            f->labels = labels;
+        }
+        if (paths == NULL || labels == NULL) {
+            perror("Error Allocating memory for image folder.\n");
+            free(path);
+            return -1;
+        }
+        *capacity = grown;
+    }
+    f->paths[f->count] = path;
+    f->labels[f->count] = label;
+    f->count++;
+    return 0;
+}
+
+// Adds every image below dir. Subdirectories are only followed when they
+// are real directories, so symlink loops can't trap the scan.
+static int _scan_class(ImageFolder* f, int* capacity, const char* dir,
+                       int label) {
+    DIR* d = opendir(dir);
+    if (d == NULL) {
+        fprintf(stderr, "Error: could not read %s\n", dir);
+        return -1;
+    }
+    int result = 0;
+    struct dirent* entry;
+    while (result == 0 && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char* path = _join_path(dir, entry->d_name);
+        if (path == NULL) {
+            result = -1;
+            break;
+        }
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            result = _scan_class(f, capacity, path, label);
+            free(path);
+        } else if (_is_image_name(entry->d_name) && stat(path, &st) == 0 &&
+                   S_ISREG(st.st_mode)) {
+            result = _add_image(f, capacity, path, label);
+        } else {
+            free(path);
+        }
+    }
+    closedir(d);
+    return result;
+}
+
+void free_image_folder(ImageFolder* f) {
+    if (f == NULL) return;
+    for (int i = 0; i < f->count; i++) {
+        free(f->paths[i]);
+    }
+    for (int c = 0; c < f->class_count; c++) {
+        free(f->classes[c]);
+    }
+    free(f->paths);
+    free(f->labels);
+    free(f->classes);
+    free(f);
+}
+
+ImageFolder* image_folder_scan(const char* root) {
+    if (root == NULL) return NULL;
+
+    DIR* d = opendir(root);
+    if (d == NULL) {
+        fprintf(stderr, "Error: could not read image folder %s\n", root);
+        return NULL;
+    }
+    ImageFolder* f = calloc(1, sizeof(ImageFolder));
+    if (f == NULL) {
+        perror("Error Allocating memory for image folder.\n");
+        closedir(d);
+        return NULL;
+    }
+
+    // Class directories first, so labels follow name order
+    int class_capacity = 0;
+    int ok = 1;
+    struct dirent* entry;
+    while (ok && (entry = readdir(d)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char* path = _join_path(root, entry->d_name);
+        struct stat st;
+        int is_dir = path != NULL && lstat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        free(path);
+        if (!is_dir) {
+            continue;
+        }
+        if (f->class_count == class_capacity) {
+            class_capacity = class_capacity > 0 ? class_capacity * 2 : 16;
+            char** classes = realloc(f->classes, class_capacity * sizeof(char*));
+            if (classes == NULL) {
+                perror("Error Allocating memory for image folder.\n");
+                ok = 0;
+                break;
+            }
+            f->classes = classes;
+        }
+        f->classes[f->class_count] = strdup(entry->d_name);
+        ok = f->classes[f->class_count] != NULL;
+        f->class_count += ok;
+    }
+    closedir(d);
+    if (!ok) {
+        free_image_folder(f);
+        return NULL;
+    }
+    qsort(f->classes, f->class_count, sizeof(char*), _compare_strings);
+
+    int capacity = 0;
+    for (int c = 0; c < f->class_count; c++) {
+        char* dir = _join_path(root, f->classes[c]);
+        int first = f->count;
+        if (dir == NULL || _scan_class(f, &capacity, dir, c) != 0) {
+            free(dir);
+            free_image_folder(f);
+            return NULL;
+        }
+        free(dir);
+        // readdir order is arbitrary, sort for the same labels every run
+        qsort(f->paths + first, f->count - first, sizeof(char*),
+              _compare_strings);
+    }
+    if (f->count == 0) {
+        fprintf(stderr, "Error: no images in class folders under %s\n", root);
+        free_image_folder(f);
+        return NULL;
+    }
+    return f;
+}
+
+// Cache file: a dataset cache followed by
+//   entries   one ImageCacheEntry per image of the folder, 64-byte aligned
+//   strings   the paths, back to back, padded to 64 bytes
+//   footer    ImageCacheFooter, the last 64 bytes of the file
+// dataset_load ignores what follows the labels.
+
+typedef struct {
+    int64_t mtime_ns;
+    int64_t size;
+    uint64_t path_offset;       // into the strings
+    uint32_t path_length;
+    int32_t sample;             // in the dataset, -1 if it failed to decode
+} ImageCacheEntry;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;             // entries
+    uint32_t width;
+    uint32_t height;
+    uint32_t channels;
+    uint32_t resize;
+    uint32_t resize_short_side;
+    uint32_t reserved;
+    uint64_t entries_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+} ImageCacheFooter;
+
+_Static_assert(sizeof(ImageCacheFooter) == 64, "image cache footer is 64 bytes");
+
+typedef struct {
+    int64_t mtime_ns;
+    int64_t size;
+} ImageKey;
+
+static int _image_key(const char* path, ImageKey* key) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return -1;
+    }
+    key->mtime_ns = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    key->size = (int64_t)st.st_size;
+    return 0;
+}
+
+static void _fill_footer(ImageCacheFooter* footer, const ImageBatchOptions* o) {
+    memset(footer, 0, sizeof(*footer));
+    memcpy(footer->magic, IMAGE_CACHE_MAGIC, sizeof(footer->magic));
+    footer->version = IMAGE_CACHE_VERSION;
+    footer->width = (uint32_t)o->width;
+    footer->height = (uint32_t)o->height;
+    footer->channels = (uint32_t)o->channels;
+    footer->resize = (uint32_t)o->resize;
+    footer->resize_short_side = (uint32_t)o->resize_short_side;
+}
+
+// The footer of a loaded cache made with the same options, or NULL if it
+// has none or its index doesn't fit in the file
+static const ImageCacheFooter* _cache_footer(const Dataset* d,
+                                             const ImageCacheFooter* key) {
+    if (d == NULL || d->map == NULL || d->map_size < sizeof(ImageCacheFooter) ||
+        d->map_size % IMAGE_CACHE_ALIGN != 0 || d->type != DATASET_UINT8 ||
+        d->labels == NULL) {
+        return NULL;
+    }
+    size_t end = d->map_size - sizeof(ImageCacheFooter);
+    const ImageCacheFooter* footer =
+        (const ImageCacheFooter*)((const char*)d->map + end);
+    if (memcmp(footer->magic, key->magic, sizeof(key->magic)) != 0 ||
+        footer->version != key->version || footer->width != key->width ||
+        footer->height != key->height || footer->channels != key->channels ||
+        footer->resize != key->resize ||
+        footer->resize_short_side != key->resize_short_side ||
+        (uint32_t)d->features != key->width * key->height * key->channels ||
+        footer->entries_offset % IMAGE_CACHE_ALIGN != 0 ||
+        footer->entries_offset > end ||
+        (end - footer->entries_offset) / sizeof(ImageCacheEntry) < footer->count ||
+        footer->strings_offset > end ||
+        end - footer->strings_offset < footer->strings_size) {
+        return NULL;
+    }
+    const ImageCacheEntry* entries =
+        (const ImageCacheEntry*)((const char*)d->map + footer->entries_offset);
+    for (uint32_t i = 0; i < footer->count; i++) {
+        if (entries[i].path_offset > footer->strings_size ||
+            footer->strings_size - entries[i].path_offset < entries[i].path_length ||
+            entries[i].sample < -1 || entries[i].sample >= d->count) {
+            return NULL;
+        }
+    }
+    return footer;
+}
+
+// FNV-1a
+static uint64_t _hash_path(const char* path, size_t length) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char)path[i]) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static const ImageCacheEntry* _entries(const Dataset* d,
+                                       const ImageCacheFooter* footer) {
+    return (const ImageCacheEntry*)((const char*)d->map + footer->entries_offset);
+}
+
+// For each image of f, the entry of the old cache with the same path, mtime
+// and size, or -1. Returns 0 or -1.
+static int _match_old(const ImageFolder* f, const ImageKey* keys,
+                      const Dataset* old, const ImageCacheFooter* footer,
+                      int* source) {
+    for (int i = 0; i < f->count; i++) {
+        source[i] = -1;
+    }
+    if (footer == NULL || footer->count == 0) {
+        return 0;
+    }
+
+    const ImageCacheEntry* entries = _entries(old, footer);
+    const char* strings = (const char*)old->map + footer->strings_offset;
+
+    // Open addressing over the old paths, slots hold index + 1
+    size_t slots = 16;
+    while (slots < 2 * (size_t)footer->count) {
+        slots *= 2;
+    }
+    int* table = calloc(slots, sizeof(int));
+    if (table == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        return -1;
+    }
+    for (uint32_t e = 0; e < footer->count; e++) {
+        size_t s = _hash_path(strings + entries[e].path_offset,
+                              entries[e].path_length) & (slots - 1);
+        while (table[s] != 0) {
+            s = (s + 1) & (slots - 1);
+        }
+        table[s] = (int)e + 1;
+    }
+
+    for (int i = 0; i < f->count; i++) {
+        if (keys[i].size < 0) {
+            continue;
+        }
+        size_t length = strlen(f->paths[i]);
+        size_t s = _hash_path(f->paths[i], length) & (slots - 1);
+        for (; table[s] != 0; s = (s + 1) & (slots - 1)) {
+            const ImageCacheEntry* e = &entries[table[s] - 1];
+            if (e->path_length == length &&
+                memcmp(strings + e->path_offset, f->paths[i], length) == 0) {
+                if (e->mtime_ns == keys[i].mtime_ns && e->size == keys[i].size) {
+                    source[i] = table[s] - 1;
+                }
+                break;
+            }
+        }
+    }
+    free(table);
+    return 0;
+}
+
+// Column b of a decoded batch back to bytes
+static void _quantize_column(const Matrix* batch, int b, uint8_t* out) {
+    for (int r = 0; r < batch->rows; r++) {
+        float v = roundf(batch->data[(size_t)r * batch->columns + b] * 255.0f);
+        out[r] = (uint8_t)(v < 0.0f ? 0.0f : v > 255.0f ? 255.0f : v);
+    }
+}
+
+// Decodes every image that isn't settled yet (ok[i] 0) and sets ok[i] to 1
+// for each one that worked, 2 for the rest. Returns 0 or -1.
+static int _decode_missing(const ImageFolder* f, const ImageBatchOptions* o,
+                           uint8_t* pixels, unsigned char* ok,
+                           ImageCacheStats* stats) {
+    int features = o->width * o->height * o->channels;
+    Matrix* batch = create_matrix(features, IMAGE_CACHE_DECODE_BATCH);
+    char** paths = malloc(IMAGE_CACHE_DECODE_BATCH * sizeof(char*));
+    int* index = malloc(IMAGE_CACHE_DECODE_BATCH * sizeof(int));
+    unsigned char status[IMAGE_CACHE_DECODE_BATCH];
+    if (batch == NULL || paths == NULL || index == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        free_matrix(batch);
+        free(paths);
+        free(index);
+        return -1;
+    }
+
+    int i = 0;
+    while (i < f->count) {
+        int n = 0;
+        for (; i < f->count && n < IMAGE_CACHE_DECODE_BATCH; i++) {
+            if (ok[i] == 0) {
+                paths[n] = f->paths[i];
+                index[n++] = i;
+            }
+        }
+        if (n == 0) {
+            break;
+        }
+        batch->columns = n;
+        if (read_image_batch_status(paths, n, o, batch, status) < 0) {
+            free_matrix(batch);
+            free(paths);
+            free(index);
+            return -1;
+        }
+        for (int b = 0; b < n; b++) {
+            if (status[b]) {
+                _quantize_column(batch, b, pixels + (size_t)index[b] * features);
+                stats->decoded++;
+            }
+            ok[index[b]] = status[b] ? 1 : 2;
+        }
+    }
+    batch->columns = IMAGE_CACHE_DECODE_BATCH;
+    free_matrix(batch);
+    free(paths);
+    free(index);
+    return 0;
+}
+
+// Appends the entries, strings and footer to path: every image of f, with
+// its sample when ok[i] is 1. Returns 0 or -1.
+static int _append_index(const char* path, const ImageFolder* f,
+                         const ImageKey* keys, const unsigned char* ok,
+                         const ImageCacheFooter* key) {
+    FILE* file = fopen(path, "ab");
+    if (file == NULL) {
+        return -1;
+    }
+    long position = fseek(file, 0, SEEK_END) == 0 ? ftell(file) : -1;
+    int result = position < 0 ? -1 : 0;
+
+    ImageCacheFooter footer = *key;
+    footer.count = (uint32_t)f->count;
+    footer.entries_offset = ((uint64_t)position + IMAGE_CACHE_ALIGN - 1) &
+                            ~(uint64_t)(IMAGE_CACHE_ALIGN - 1);
+    footer.strings_offset =
+        footer.entries_offset + (uint64_t)f->count * sizeof(ImageCacheEntry);
+    static const char zeros[IMAGE_CACHE_ALIGN] = {0};
+    size_t gap = footer.entries_offset - (uint64_t)position;
+    if (result == 0 && gap > 0 && fwrite(zeros, 1, gap, file) != gap) {
+        result = -1;
+    }
+
+    uint64_t strings_size = 0;
+    int sample = 0;
+    for (int i = 0; i < f->count && result == 0; i++) {
+        ImageCacheEntry e = {keys[i].mtime_ns, keys[i].size, strings_size,
+                             (uint32_t)strlen(f->paths[i]),
+                             ok[i] == 1 ? sample++ : -1};
+        strings_size += e.path_length;
+        if (fwrite(&e, sizeof(e), 1, file) != 1) {
+            result = -1;
+        }
+    }
+    for (int i = 0; i < f->count && result == 0; i++) {
+        size_t length = strlen(f->paths[i]);
+        if (fwrite(f->paths[i], 1, length, file) != length) {
+            result = -1;
+        }
+    }
+    footer.strings_size = strings_size;
+    // The footer ends the file on an aligned offset, so it is aligned too
+    gap = (size_t)(-(footer.strings_offset + strings_size) & (IMAGE_CACHE_ALIGN - 1));
+    if (result == 0 && gap > 0 && fwrite(zeros, 1, gap, file) != gap) {
+        result = -1;
+    }
+    if (result == 0 && fwrite(&footer, sizeof(footer), 1, file) != 1) {
+        result = -1;
+    }
+    if (fclose(file) != 0) {
+        result = -1;
+    }
+    return result;
+}
+
+// Writes the kept images as a dataset cache to temp, appends the index and
+// moves it over cache_path. Returns 0 or -1.
+static int _write_cache(const ImageFolder* f, const ImageKey* keys,
+                        uint8_t* pixels, const unsigned char* ok, int features,
+                        const ImageCacheFooter* key, const char* cache_path) {
+    // Failed images are dropped, the rest move up in place
+    int kept = 0;
+    int32_t* labels = malloc(sizeof(int32_t) * (f->count > 0 ? f->count : 1));
+    if (labels == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        return -1;
+    }
+    for (int i = 0; i < f->count; i++) {
+        if (ok[i] != 1) {
+            continue;
+        }
+        if (kept != i) {
+            memcpy(pixels + (size_t)kept * features,
+                   pixels + (size_t)i * features, features);
+        }
+        labels[kept++] = f->labels[i];
+    }
+    if (kept == 0) {
+        fprintf(stderr, "Error: none of the images could be decoded\n");
+        free(labels);
+        return -1;
+    }
+
+    Dataset d = {0};
+    d.count = kept;
+    d.features = features;
+    d.target_size = f->class_count;
+    d.type = DATASET_UINT8;
+    d.inputs = pixels;
+    d.scale = 1.0f / 255.0f;
+    d.labels = labels;
+
+    size_t length = strlen(cache_path);
+    char* temp = malloc(length + 5);
+    if (temp == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        free(labels);
+        return -1;
+    }
+    memcpy(temp, cache_path, length);
+    memcpy(temp + length, ".new", 5);
+
+    int result = dataset_save(&d, temp, DATASET_UINT8, d.scale, 0.0f);
+    if (result == 0) {
+        result = _append_index(temp, f, keys, ok, key);
+    }
+    // Readers of the old file keep their mapping; new ones see the new file
+    if (result == 0 && rename(temp, cache_path) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        fprintf(stderr, "Error: could not write image cache %s\n", cache_path);
+        remove(temp);
+    }
+    free(temp);
+    free(labels);
+    return result;
+}
+
+// The old cache has exactly these images, in order, with these labels
+static int _unchanged(const ImageFolder* f, const Dataset* old,
+                      const ImageCacheFooter* footer, const int* source) {
+    if (footer->count != (uint32_t)f->count ||
+        old->target_size != f->class_count) {
+        return 0;
+    }
+    const ImageCacheEntry* entries = _entries(old, footer);
+    int sample = 0;
+    for (int i = 0; i < f->count; i++) {
+        if (source[i] != i) {
+            return 0;
+        }
+        if (entries[i].sample < 0) {
+            continue;
+        }
+        if (entries[i].sample != sample ||
+            old->labels[sample] != f->labels[i]) {
+            return 0;
+        }
+        sample++;
+    }
+    return sample == old->count;
+}
+
+// Copies what the old cache has, decodes the rest and writes the new cache.
+// Images that failed before and haven't changed since aren't tried again.
+static Dataset* _rebuild(const ImageFolder* f, const ImageBatchOptions* o,
+                         const ImageKey* keys, const Dataset* old,
+                         const ImageCacheFooter* footer, const int* source,
+                         unsigned char* ok, const ImageCacheFooter* key,
+                         const char* cache_path, ImageCacheStats* stats) {
+    int features = o->width * o->height * o->channels;
+    uint8_t* pixels = malloc((size_t)f->count * features);
+    if (pixels == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        return NULL;
+    }
+    for (int i = 0; i < f->count; i++) {
+        if (keys[i].size < 0) {
+            ok[i] = 2;
+        } else if (source[i] >= 0) {
+            int sample = _entries(old, footer)[source[i]].sample;
+            if (sample >= 0) {
+                memcpy(pixels + (size_t)i * features,
+                       (const uint8_t*)old->inputs + (size_t)sample * features,
+                       features);
+                stats->reused++;
+            }
+            ok[i] = sample >= 0 ? 1 : 2;
+        }
+    }
+    int written = _decode_missing(f, o, pixels, ok, stats) == 0;
+    stats->failed = f->count - stats->reused - stats->decoded;
+    written = written && _write_cache(f, keys, pixels, ok, features, key,
+                                      cache_path) == 0;
+    free(pixels);
+    return written ? dataset_load(cache_path) : NULL;
+}
+
+Dataset* image_folder_cache(const ImageFolder* f,
+                            const ImageBatchOptions* options,
+                            const char* cache_path, ImageCacheStats* stats) {
+    if (f == NULL || options == NULL || cache_path == NULL) return NULL;
+    if (options->width <= 0 || options->height <= 0 || options->channels < 1 ||
+        options->channels > 4) {
+        fprintf(stderr, "Error: invalid cached image size %dx%dx%d\n",
+                options->width, options->height, options->channels);
+        return NULL;
+    }
+    if (options->crop == IMAGE_CROP_RANDOM) {
+        fprintf(stderr, "Error: random crops can't be cached\n");
+        return NULL;
+    }
+    ImageCacheStats local;
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+
+    // Plain pixels: no normalization
+    ImageBatchOptions o = *options;
+    memset(o.mean, 0, sizeof(o.mean));
+    memset(o.std, 0, sizeof(o.std));
+    ImageCacheFooter key;
+    _fill_footer(&key, &o);
+
+    ImageKey* keys = malloc(sizeof(ImageKey) * f->count);
+    int* source = malloc(sizeof(int) * f->count);
+    unsigned char* ok = calloc(f->count, 1);
+    if (keys == NULL || source == NULL || ok == NULL) {
+        perror("Error Allocating memory for image cache.\n");
+        free(keys);
+        free(source);
+        free(ok);
+        return NULL;
+    }
+    for (int i = 0; i < f->count; i++) {
+        if (_image_key(f->paths[i], &keys[i]) != 0) {
+            fprintf(stderr, "Error: could not read %s\n", f->paths[i]);
+            keys[i].mtime_ns = 0;
+            keys[i].size = -1;     // never decoded, left out
+        }
+    }
+
+    // A missing cache is the normal first run
+    Dataset* old = NULL;
+    FILE* probe = fopen(cache_path, "rb");
+    if (probe != NULL) {
+        fclose(probe);
+        old = dataset_load(cache_path);
+    }
+    const ImageCacheFooter* footer = _cache_footer(old, &key);
+
+    Dataset* result = NULL;
+    if (_match_old(f, keys, old, footer, source) == 0) {
+        if (footer != NULL && _unchanged(f, old, footer, source)) {
+            // Nothing to decode or write
+            stats->reused = old->count;
+            stats->failed = f->count - old->count;
+            result = old;
+            old = NULL;
+        } else {
+            result = _rebuild(f, &o, keys, old, footer, source, ok, &key,
+                              cache_path, stats);
+        }
+    }
+    free_dataset(old);
+    free(keys);
+    free(source);
+    free(ok);
+    return result;
+}
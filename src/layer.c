@@ -7,6 +7,8 @@ Matrix *_layer_forward_dense(Layer *l, Matrix *input) {
   }
   // Store a copy of input (not just pointer) for use in backward pass
   l->inputs = copy_matrix(input);
+  free_byte_matrix(l->byte_inputs);
+  l->byte_inputs = NULL;
 
   // Free previous output to prevent memory leak
   if (l->output != NULL) {
@@ -19,9 +21,17 @@ Matrix *_layer_forward_dense(Layer *l, Matrix *input) {
             "Error: multiply_mat failed in dense forward. weights: (%d, %d), "
             "input: (%d, %d)\n",
             l->weights->rows, l->weights->columns, input->rows, input->columns);
+    l->output = NULL;
     return NULL;
   }
-  add_matrix(out, l->bias);
+  // Bias is broadcast over the columns (samples) of the batch
+  for (int i = 0; i < out->rows; i++) {
+    float *row = out->data + i * out->columns;
+    float bias = l->bias->data[i];
+    for (int j = 0; j < out->columns; j++) {
+      row[j] += bias;
+    }
+  }
   l->output = out;
 
   // Return a copy so caller owns it
@@ -30,69 +40,82 @@ Matrix *_layer_forward_dense(Layer *l, Matrix *input) {
 
 Matrix *_layer_backward_dense(Layer *l, Matrix *error_gradient,
                               float learning_rate) {
-  if (l == NULL || l->inputs == NULL || error_gradient == NULL) {
+  if (l == NULL || error_gradient == NULL ||
+      (l->inputs == NULL && l->byte_inputs == NULL)) {
     fprintf(stderr, "Error: NULL input to backward_dense\n");
     return NULL;
   }
-
-  Matrix *input_t = transpose_mat(l->inputs);
-  if (input_t == NULL) {
-    fprintf(stderr, "Error: transpose_mat failed in backward_dense\n");
-    return NULL;
-  }
-
-  Matrix *d_weights = multiply_mat(error_gradient, input_t);
-  if (d_weights == NULL) {
+  ByteMatrix *bytes = l->byte_inputs;
+  int input_columns = bytes != NULL ? bytes->columns : l->inputs->columns;
+  if (error_gradient->rows != l->weights->rows ||
+      error_gradient->columns != input_columns) {
     fprintf(stderr,
-            "Error: d_weights multiply failed. error_grad: (%d,%d), input_t: "
-            "(%d,%d)\n",
-            error_gradient->rows, error_gradient->columns, input_t->rows,
-            input_t->columns);
-    free_matrix(input_t);
+            "Error: dense gradient (%d,%d) does not match output (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, l->weights->rows,
+            input_columns);
     return NULL;
   }
 
-  // W = w - lr*dW
-  scale_matrix(d_weights, -learning_rate);
-  add_matrix(l->weights, d_weights);
-
-  // Create a copy of error_gradient for bias update (don't mutate input)
-  Matrix *d_bias = copy_matrix(error_gradient);
-  if (d_bias == NULL) {
-    free_matrix(input_t);
-    free_matrix(d_weights);
-    return NULL;
+  int out_n = l->weights->rows;
+  int in_n = l->weights->columns;
+  int batch = error_gradient->columns;
+
+  // dW = dZ * X^T, kept in d_weight until the next backward
+  if (bytes != NULL) {
+    gemm_u8(0, 1, out_n, in_n, batch, 1.0f, error_gradient->data, batch,
+            bytes->data, batch, bytes->scale, bytes->offset, 0.0f,
+            l->d_weight->data, in_n);
+  } else {
+    gemm(0, 1, out_n, in_n, batch, 1.0f, error_gradient->data, batch,
+         l->inputs->data, batch, 0.0f, l->d_weight->data, in_n);
   }
-  scale_matrix(d_bias, -learning_rate);
-  add_matrix(l->bias, d_bias);
 
-  // B = b - lr*dB
-
-  Matrix *weights_t = transpose_mat(l->weights);
-  if (weights_t == NULL) {
-    free_matrix(input_t);
-    free_matrix(d_weights);
-    free_matrix(d_bias);
-    return NULL;
+  // dB = dZ summed over the batch
+  for (int i = 0; i < out_n; i++) {
+    const float *row = error_gradient->data + i * batch;
+    float sum = 0.0f;
+    for (int j = 0; j < batch; j++) {
+      sum += row[j];
+    }
+    l->d_bias->data[i] = sum;
   }
 
-  Matrix *input_gradient = multiply_mat(weights_t, error_gradient);
-  if (input_gradient == NULL) {
-    fprintf(stderr,
-            "Error: input_gradient multiply failed. weights_t: (%d,%d), "
-            "error_grad: (%d,%d)\n",
-            weights_t->rows, weights_t->columns, error_gradient->rows,
-            error_gradient->columns);
+  // dX = W^T * dZ, from the weights the forward pass used. Byte input
+  // comes from the data, nothing below takes a gradient.
+  Matrix *input_gradient = NULL;
+  if (bytes == NULL) {
+    input_gradient = create_matrix(in_n, batch);
+    if (input_gradient == NULL) {
+      return NULL;
+    }
+    gemm(1, 0, in_n, batch, out_n, 1.0f, l->weights->data, in_n,
+         error_gradient->data, batch, 0.0f, input_gradient->data, batch);
   }
 
-  free_matrix(input_t);
-  free_matrix(d_weights);
-  free_matrix(d_bias);
-  free_matrix(weights_t);
+  // W = w - lr*dW, B = b - lr*dB
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
 
   return input_gradient;
 }
 
+int _layer_shape_dense(Layer *l, int rows, int columns, int *out_rows,
+                       int *out_columns) {
+  if (rows != l->weights->columns) {
+    fprintf(stderr, "Error: %s layer expects %d input rows, got %d\n", l->name,
+            l->weights->columns, rows);
+    return -1;
+  }
+  *out_rows = l->weights->rows;
+  *out_columns = columns;
+  return 0;
+}
+
+// Stored copies of the input and the output
+size_t _layer_workspace_dense(Layer *l, int rows, int columns) {
+  return sizeof(float) * (size_t)(rows + l->weights->rows) * columns;
+}
+
 Layer *layer_create_dense(int input_n, int output_n) {
   Layer *l = (Layer *)malloc(sizeof(Layer));
 
@@ -103,6 +126,8 @@ Layer *layer_create_dense(int input_n, int output_n) {
 
   l->forward = _layer_forward_dense;
   l->backward = _layer_backward_dense;
+  l->infer_shape = _layer_shape_dense;
+  l->workspace_size = _layer_workspace_dense;
 
   // Weights: (output_n × input_n) for multiplication with input (input_n × 1)
   l->weights = create_matrix(output_n, input_n);
@@ -124,8 +149,12 @@ Layer *layer_create_dense(int input_n, int output_n) {
   zero_matrix(l->d_bias);
 
   l->inputs = NULL;
+  l->byte_inputs = NULL;
   l->output = NULL;
 
+  l->state = NULL;
+  l->free_state = NULL;
+
   l->input_n = input_n;
   l->output_n = output_n;
 
@@ -196,6 +225,19 @@ Matrix *_layer_backward_relu(Layer *l, Matrix *error_gradient, float learning) {
   return input_grad;
 }
 
+// Element-wise: any shape goes through unchanged
+int _layer_shape_elementwise(Layer *l, int rows, int columns, int *out_rows,
+                             int *out_columns) {
+  *out_rows = rows;
+  *out_columns = columns;
+  return 0;
+}
+
+// The stored output, used for the derivative
+size_t _layer_workspace_activation(Layer *l, int rows, int columns) {
+  return sizeof(float) * (size_t)rows * columns;
+}
+
 Layer *layer_create_sigmoid() {
   Layer *l = (Layer *)malloc(sizeof(Layer));
 
@@ -206,6 +248,8 @@ Layer *layer_create_sigmoid() {
 
   l->forward = _layer_forward_sigmoid;
   l->backward = _layer_backward_sigmoid;
+  l->infer_shape = _layer_shape_elementwise;
+  l->workspace_size = _layer_workspace_activation;
 
   l->weights = NULL;
   l->bias = NULL;
@@ -213,8 +257,12 @@ Layer *layer_create_sigmoid() {
   l->d_bias = NULL;
 
   l->inputs = NULL;
+  l->byte_inputs = NULL;
   l->output = NULL;
 
+  l->state = NULL;
+  l->free_state = NULL;
+
   l->input_n = 0;
   l->output_n = 0;
 
@@ -232,6 +280,8 @@ Layer *layer_create_relu() {
 
   l->forward = _layer_forward_relu;
   l->backward = _layer_backward_relu;
+  l->infer_shape = _layer_shape_elementwise;
+  l->workspace_size = _layer_workspace_activation;
 
   l->weights = NULL;
   l->bias = NULL;
@@ -239,8 +289,12 @@ Layer *layer_create_relu() {
   l->d_bias = NULL;
 
   l->inputs = NULL;
+  l->byte_inputs = NULL;
   l->output = NULL;
 
+  l->state = NULL;
+  l->free_state = NULL;
+
   l->input_n = 0;
   l->output_n = 0;
 
@@ -248,6 +302,149 @@ Layer *layer_create_relu() {
   return l;
 }
 
+// Fused Dense + activation. The row loop fills a row with its bias,
+// accumulates W*x into it and applies the activation while the row is still
+// in cache, so the output is written once instead of three passes.
+static Matrix *_layer_forward_dense_fused(Layer *l, Matrix *input,
+                                          int use_relu) {
+  if (input->rows != l->weights->columns) {
+    fprintf(stderr,
+            "Error: fused dense forward. weights: (%d, %d), input: (%d, %d)\n",
+            l->weights->rows, l->weights->columns, input->rows,
+            input->columns);
+    return NULL;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  // Store a copy of input (not just pointer) for use in backward pass
+  l->inputs = copy_matrix(input);
+  free_byte_matrix(l->byte_inputs);
+  l->byte_inputs = NULL;
+
+  // Free previous output to prevent memory leak
+  if (l->output != NULL) {
+    free_matrix(l->output);
+  }
+
+  int rows = l->weights->rows;
+  int k = l->weights->columns;
+  int cols = input->columns;
+  Matrix *out = create_matrix(rows, cols);
+  if (out == NULL) {
+    l->output = NULL;
+    return NULL;
+  }
+
+  for (int i = 0; i < rows; i++) {
+    float *row = out->data + i * cols;
+    float bias = l->bias->data[i];
+    for (int j = 0; j < cols; j++) {
+      row[j] = bias;
+    }
+    gemm(0, 0, 1, cols, k, 1.0f, l->weights->data + i * k, k, input->data,
+         cols, 1.0f, row, cols);
+    if (use_relu) {
+      for (int j = 0; j < cols; j++) {
+        row[j] = relu(row[j]);
+      }
+    } else {
+      for (int j = 0; j < cols; j++) {
+        row[j] = sigmoid(row[j]);
+      }
+    }
+  }
+  l->output = out;
+
+  // Return a copy so caller owns it
+  return copy_matrix(out);
+}
+
+Matrix *_layer_forward_dense_relu(Layer *l, Matrix *input) {
+  return _layer_forward_dense_fused(l, input, 1);
+}
+
+Matrix *_layer_forward_dense_sigmoid(Layer *l, Matrix *input) {
+  return _layer_forward_dense_fused(l, input, 0);
+}
+
+// Activation derivative from the stored output, then the plain dense
+// backward, so a fused network trains exactly like the unfused one.
+Matrix *_layer_backward_dense_relu(Layer *l, Matrix *error_gradient,
+                                   float learning_rate) {
+  Matrix *dz = _layer_backward_relu(l, error_gradient, learning_rate);
+  if (dz == NULL) {
+    return NULL;
+  }
+  Matrix *input_grad = _layer_backward_dense(l, dz, learning_rate);
+  free_matrix(dz);
+  return input_grad;
+}
+
+Matrix *_layer_backward_dense_sigmoid(Layer *l, Matrix *error_gradient,
+                                      float learning_rate) {
+  Matrix *dz = _layer_backward_sigmoid(l, error_gradient, learning_rate);
+  if (dz == NULL) {
+    return NULL;
+  }
+  Matrix *input_grad = _layer_backward_dense(l, dz, learning_rate);
+  free_matrix(dz);
+  return input_grad;
+}
+
+// Dense(W2, b2) after Dense(W1, b1) is Dense(W2*W1, W2*b1 + b2)
+static Layer *_layer_merge_dense(Layer *a, Layer *b) {
+  Layer *merged = layer_create_dense(a->input_n, b->output_n);
+  if (merged == NULL) {
+    return NULL;
+  }
+
+  gemm(0, 0, b->output_n, a->input_n, a->output_n, 1.0f, b->weights->data,
+       b->weights->columns, a->weights->data, a->weights->columns, 0.0f,
+       merged->weights->data, merged->weights->columns);
+  for (int i = 0; i < b->output_n; i++) {
+    merged->bias->data[i] = b->bias->data[i];
+  }
+  gemm(0, 0, b->output_n, 1, a->output_n, 1.0f, b->weights->data,
+       b->weights->columns, a->bias->data, 1, 1.0f, merged->bias->data, 1);
+
+  return merged;
+}
+
+Layer *layer_fuse(Layer *a, Layer *b, int inference_only) {
+  if (a == NULL || b == NULL || a->forward != _layer_forward_dense) {
+    return NULL;
+  }
+
+  if (b->forward == _layer_forward_relu ||
+      b->forward == _layer_forward_sigmoid) {
+    int use_relu = (b->forward == _layer_forward_relu);
+    a->forward =
+        use_relu ? _layer_forward_dense_relu : _layer_forward_dense_sigmoid;
+    a->backward =
+        use_relu ? _layer_backward_dense_relu : _layer_backward_dense_sigmoid;
+    a->name = use_relu ? "Dense+ReLU" : "Dense+Sigmoid";
+    free_layer(b);
+    return a;
+  }
+
+  // Merging changes what is trained, only do it for inference
+  if (inference_only && b->forward == _layer_forward_dense &&
+      b->input_n == a->output_n) {
+    Layer *merged = _layer_merge_dense(a, b);
+    if (merged == NULL) {
+      return NULL;
+    }
+    free_layer(a);
+    free_layer(b);
+    return merged;
+  }
+
+  return NULL;
+}
+
 void free_layer(Layer *layer) {
   if (layer == NULL) {
     return;
@@ -258,19 +455,110 @@ void free_layer(Layer *layer) {
   free_matrix(layer->d_weight);
   free_matrix(layer->d_bias);
 
+  if (layer->free_state != NULL) {
+    layer->free_state(layer);
+  }
+
   // Note: layer->name points to string literals ("Dense", "Sigmoid")
   // which are in read-only memory and must NOT be freed
 
   if (layer->inputs != NULL) {
     free_matrix(layer->inputs);
   }
+  free_byte_matrix(layer->byte_inputs);
   if (layer->output != NULL) {
     free_matrix(layer->output);
   }
   free(layer);
 }
 
+void layer_release_activations(Layer *l) {
+  if (l == NULL) {
+    return;
+  }
+  free_matrix(l->inputs);
+  free_byte_matrix(l->byte_inputs);
+  free_matrix(l->output);
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+}
+
+Layer *layer_create_replica(Layer *l) {
+  if (l == NULL) {
+    return NULL;
+  }
+  if (l->state != NULL) {
+    fprintf(stderr, "Error: %s layer keeps private state, can't replicate\n",
+            l->name);
+    return NULL;
+  }
+
+  Layer *r = (Layer *)malloc(sizeof(Layer));
+  if (r == NULL) {
+    perror("Could Not allocate memory for layer replica. NULL");
+    return NULL;
+  }
+
+  // Same kernels and parameters, private gradients and activations
+  *r = *l;
+  r->inputs = NULL;
+  r->byte_inputs = NULL;
+  r->output = NULL;
+  r->d_weight = NULL;
+  r->d_bias = NULL;
+  if (l->d_weight != NULL) {
+    r->d_weight = create_matrix(l->d_weight->rows, l->d_weight->columns);
+  }
+  if (l->d_bias != NULL) {
+    r->d_bias = create_matrix(l->d_bias->rows, l->d_bias->columns);
+  }
+  if ((l->d_weight != NULL && r->d_weight == NULL) ||
+      (l->d_bias != NULL && r->d_bias == NULL)) {
+    layer_free_replica(r);
+    return NULL;
+  }
+  return r;
+}
+
+void layer_free_replica(Layer *r) {
+  if (r == NULL) {
+    return;
+  }
+  // weights and bias belong to the original layer
+  free_matrix(r->d_weight);
+  free_matrix(r->d_bias);
+  layer_release_activations(r);
+  free(r);
+}
+
 // Wrapper functions that call the layer's function pointers
+int layer_infer_shape(Layer *l, int rows, int columns, int *out_rows,
+                      int *out_columns) {
+  if (l == NULL || out_rows == NULL || out_columns == NULL) {
+    return -1;
+  }
+  if (l->infer_shape != NULL) {
+    return l->infer_shape(l, rows, columns, out_rows, out_columns);
+  }
+  // Layers without the callback: trust input_n/output_n when they are set
+  if (l->input_n > 0 && rows != l->input_n) {
+    fprintf(stderr, "Error: %s layer expects %d input rows, got %d\n", l->name,
+            l->input_n, rows);
+    return -1;
+  }
+  *out_rows = l->output_n > 0 ? l->output_n : rows;
+  *out_columns = columns;
+  return 0;
+}
+
+size_t layer_workspace_size(Layer *l, int rows, int columns) {
+  if (l == NULL || l->workspace_size == NULL) {
+    return 0;
+  }
+  return l->workspace_size(l, rows, columns);
+}
+
 Matrix *layer_forward(Layer *l, Matrix *input) {
   if (l == NULL || l->forward == NULL) {
     return NULL;
@@ -278,6 +566,73 @@ Matrix *layer_forward(Layer *l, Matrix *input) {
   return l->forward(l, input);
 }
 
+Matrix *layer_forward_bytes(Layer *l, ByteMatrix *input) {
+  if (l == NULL || input == NULL) {
+    return NULL;
+  }
+  int use_relu = (l->forward == _layer_forward_dense_relu);
+  int use_sigmoid = (l->forward == _layer_forward_dense_sigmoid);
+  if (l->forward != _layer_forward_dense && !use_relu && !use_sigmoid) {
+    fprintf(stderr, "Error: %s layer can't take byte input\n", l->name);
+    return NULL;
+  }
+  if (input->rows != l->weights->columns) {
+    fprintf(stderr,
+            "Error: byte dense forward. weights: (%d, %d), input: (%d, %d)\n",
+            l->weights->rows, l->weights->columns, input->rows,
+            input->columns);
+    return NULL;
+  }
+
+  free_matrix(l->inputs);
+  l->inputs = NULL;
+  free_byte_matrix(l->byte_inputs);
+  l->byte_inputs = copy_byte_matrix(input);
+  free_matrix(l->output);
+  l->output = NULL;
+  if (l->byte_inputs == NULL) {
+    return NULL;
+  }
+
+  int rows = l->weights->rows;
+  int k = l->weights->columns;
+  int cols = input->columns;
+  Matrix *out = create_matrix(rows, cols);
+  if (out == NULL) {
+    return NULL;
+  }
+  // Bias added in the same order as the float forward of each layer type
+  // (before the products when fused, after them otherwise), so both give
+  // the same bits
+  int fused = use_relu || use_sigmoid;
+  for (int i = 0; fused && i < rows; i++) {
+    float *row = out->data + i * cols;
+    float bias = l->bias->data[i];
+    for (int j = 0; j < cols; j++) {
+      row[j] = bias;
+    }
+  }
+  // One multiply over the whole batch so it splits across the thread pool
+  gemm_u8(0, 0, rows, cols, k, 1.0f, l->weights->data, k, input->data, cols,
+          input->scale, input->offset, fused ? 1.0f : 0.0f, out->data, cols);
+  for (int i = 0; !fused && i < rows; i++) {
+    float *row = out->data + i * cols;
+    float bias = l->bias->data[i];
+    for (int j = 0; j < cols; j++) {
+      row[j] += bias;
+    }
+  }
+  if (fused) {
+    for (int i = 0; i < rows * cols; i++) {
+      out->data[i] = use_relu ? relu(out->data[i]) : sigmoid(out->data[i]);
+    }
+  }
+  l->output = out;
+
+  // Return a copy so caller owns it
+  return copy_matrix(out);
+}
+
 Matrix *layer_backward(Layer *l, Matrix *error_gradient, float learning_rate) {
   if (l == NULL || l->backward == NULL) {
     return NULL;
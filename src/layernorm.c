@@ -0,0 +1,250 @@
+#include "../include/layer.h"
+
+#define LAYERNORM_EPSILON 1e-5f
+
+// Per-column statistics saved by the forward pass. Backward recomputes the
+// normalized activations from l->inputs with these instead of keeping them.
+typedef struct {
+  Matrix *mean;   // (1 x batch)
+  Matrix *rstd;   // (1 x batch) 1 / sqrt(var + eps)
+  Matrix *sum_g;  // (1 x batch) backward scratch
+  Matrix *sum_gx; // (1 x batch) backward scratch
+} LayerNormState;
+
+static void _layernorm_free_state(Layer *l) {
+  LayerNormState *s = (LayerNormState *)l->state;
+  if (s == NULL) {
+    return;
+  }
+  free_matrix(s->mean);
+  free_matrix(s->rstd);
+  free_matrix(s->sum_g);
+  free_matrix(s->sum_gx);
+  free(s);
+  l->state = NULL;
+}
+
+// (Re)allocate the per-column buffers when the batch size changes.
+static int _layernorm_ensure_state(LayerNormState *s, int batch) {
+  if (s->mean != NULL && s->mean->columns == batch) {
+    return 0;
+  }
+  free_matrix(s->mean);
+  free_matrix(s->rstd);
+  free_matrix(s->sum_g);
+  free_matrix(s->sum_gx);
+  s->mean = create_matrix(1, batch);
+  s->rstd = create_matrix(1, batch);
+  s->sum_g = create_matrix(1, batch);
+  s->sum_gx = create_matrix(1, batch);
+  if (s->mean == NULL || s->rstd == NULL || s->sum_g == NULL ||
+      s->sum_gx == NULL) {
+    return -1;
+  }
+  return 0;
+}
+
+Matrix *_layer_forward_layernorm(Layer *l, Matrix *input) {
+  LayerNormState *s = (LayerNormState *)l->state;
+
+  if (input == NULL || input->rows != l->input_n) {
+    fprintf(stderr, "Error: layernorm expects %d rows, got %d\n", l->input_n,
+            input == NULL ? -1 : input->rows);
+    return NULL;
+  }
+
+  int features = input->rows;
+  int batch = input->columns;
+  if (_layernorm_ensure_state(s, batch) != 0) {
+    return NULL;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  // Backward recomputes x_hat from the inputs and the saved mean/rstd
+  l->inputs = copy_matrix(input);
+
+  Matrix *out = create_matrix(features, batch);
+  if (out == NULL) {
+    return NULL;
+  }
+
+  float *restrict mean = s->mean->data;
+  float *restrict m2 = s->rstd->data; // holds M2 until converted to rstd
+  for (int b = 0; b < batch; b++) {
+    mean[b] = 0.0f;
+    m2[b] = 0.0f;
+  }
+
+  // Welford over the feature rows. Walking row by row keeps the inner loop
+  // contiguous across the batch columns so it vectorizes.
+  for (int f = 0; f < features; f++) {
+    const float *restrict x = input->data + f * batch;
+    float inv_count = 1.0f / (float)(f + 1);
+    for (int b = 0; b < batch; b++) {
+      float delta = x[b] - mean[b];
+      mean[b] += delta * inv_count;
+      m2[b] += delta * (x[b] - mean[b]);
+    }
+  }
+
+  float inv_features = 1.0f / (float)features;
+  for (int b = 0; b < batch; b++) {
+    m2[b] = 1.0f / sqrtf(m2[b] * inv_features + LAYERNORM_EPSILON);
+  }
+  const float *restrict rstd = m2;
+
+  // Normalize, scale and shift in a single sweep
+  for (int f = 0; f < features; f++) {
+    const float *restrict x = input->data + f * batch;
+    float *restrict y = out->data + f * batch;
+    float gamma = l->weights->data[f];
+    float beta = l->bias->data[f];
+    for (int b = 0; b < batch; b++) {
+      y[b] = (x[b] - mean[b]) * rstd[b] * gamma + beta;
+    }
+  }
+
+  // Caller owns the output. Normalized activations are not kept.
+  return out;
+}
+
+Matrix *_layer_backward_layernorm(Layer *l, Matrix *error_gradient,
+                                  float learning_rate) {
+  LayerNormState *s = (LayerNormState *)l->state;
+
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_layernorm\n");
+    return NULL;
+  }
+  if (error_gradient->rows != l->inputs->rows ||
+      error_gradient->columns != l->inputs->columns) {
+    fprintf(stderr,
+            "Error: layernorm gradient (%d,%d) does not match input (%d,%d)\n",
+            error_gradient->rows, error_gradient->columns, l->inputs->rows,
+            l->inputs->columns);
+    return NULL;
+  }
+
+  int features = l->inputs->rows;
+  int batch = l->inputs->columns;
+
+  Matrix *input_grad = create_matrix(features, batch);
+  if (input_grad == NULL) {
+    return NULL;
+  }
+
+  const float *restrict mean = s->mean->data;
+  const float *restrict rstd = s->rstd->data;
+  float *restrict sum_g = s->sum_g->data;
+  float *restrict sum_gx = s->sum_gx->data;
+  for (int b = 0; b < batch; b++) {
+    sum_g[b] = 0.0f;
+    sum_gx[b] = 0.0f;
+  }
+
+  // First sweep: parameter gradients and the two per-column reductions
+  for (int f = 0; f < features; f++) {
+    const float *restrict x = l->inputs->data + f * batch;
+    const float *restrict dy = error_gradient->data + f * batch;
+    float gamma = l->weights->data[f];
+    float d_gamma = 0.0f;
+    float d_beta = 0.0f;
+    for (int b = 0; b < batch; b++) {
+      float x_hat = (x[b] - mean[b]) * rstd[b];
+      float g = dy[b] * gamma;
+      sum_g[b] += g;
+      sum_gx[b] += g * x_hat;
+      d_gamma += dy[b] * x_hat;
+      d_beta += dy[b];
+    }
+    l->d_weight->data[f] = d_gamma;
+    l->d_bias->data[f] = d_beta;
+  }
+
+  // Second sweep: dx = rstd * (g - (sum(g) + x_hat * sum(g * x_hat)) / N)
+  float inv_features = 1.0f / (float)features;
+  for (int f = 0; f < features; f++) {
+    const float *restrict x = l->inputs->data + f * batch;
+    const float *restrict dy = error_gradient->data + f * batch;
+    float *restrict dx = input_grad->data + f * batch;
+    float gamma = l->weights->data[f];
+    for (int b = 0; b < batch; b++) {
+      float x_hat = (x[b] - mean[b]) * rstd[b];
+      dx[b] = rstd[b] *
+              (dy[b] * gamma - (sum_g[b] + x_hat * sum_gx[b]) * inv_features);
+    }
+  }
+
+  // gamma = gamma - lr*dGamma, beta = beta - lr*dBeta
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
+
+  return input_grad;
+}
+
+static int _layernorm_infer_shape(Layer *l, int rows, int columns,
+                                  int *out_rows, int *out_columns) {
+  if (rows != l->input_n) {
+    fprintf(stderr, "Error: layernorm expects %d rows, got %d\n", l->input_n,
+            rows);
+    return -1;
+  }
+  *out_rows = rows;
+  *out_columns = columns;
+  return 0;
+}
+
+// Stored input plus the four per-column statistics/scratch rows
+static size_t _layernorm_workspace_size(Layer *l, int rows, int columns) {
+  return sizeof(float) * (size_t)(rows + 4) * columns;
+}
+
+Layer *layer_create_layernorm(int features) {
+  Layer *l = (Layer *)malloc(sizeof(Layer));
+
+  if (l == NULL) {
+    perror("Could Not allocate memory for layer. NULL");
+    return NULL;
+  }
+
+  LayerNormState *s = (LayerNormState *)calloc(1, sizeof(LayerNormState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for layernorm state. NULL");
+    free(l);
+    return NULL;
+  }
+
+  l->forward = _layer_forward_layernorm;
+  l->backward = _layer_backward_layernorm;
+  l->infer_shape = _layernorm_infer_shape;
+  l->workspace_size = _layernorm_workspace_size;
+
+  // Weights hold gamma, bias holds beta: one per feature
+  l->weights = create_matrix(features, 1);
+  l->bias = create_matrix(features, 1);
+  l->d_weight = create_matrix(features, 1);
+  l->d_bias = create_matrix(features, 1);
+
+  for (int i = 0; i < features; i++) {
+    l->weights->data[i] = 1.0f;
+  }
+  zero_matrix(l->bias);
+  zero_matrix(l->d_weight);
+  zero_matrix(l->d_bias);
+
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+
+  l->state = s;
+  l->free_state = _layernorm_free_state;
+
+  l->input_n = features;
+  l->output_n = features;
+
+  l->name = "LayerNorm";
+  return l;
+}
@@ -1,4 +1,7 @@
 #include "../include/matrix.h"
+#include "../include/scheduler.h"
+
+#include <string.h>
 
 Matrix *create_matrix(int rows, int columns) {
   Matrix *m = malloc(sizeof(Matrix));
@@ -26,6 +29,47 @@ void free_matrix(Matrix *m) {
   free(m);
 }
 
+ByteMatrix *create_byte_matrix(int rows, int columns, float scale,
+                               float offset) {
+  ByteMatrix *m = malloc(sizeof(ByteMatrix));
+  if (m == NULL) {
+    perror("Failed to allocate ByteMatrix struct");
+    return NULL;
+  }
+  m->rows = rows;
+  m->columns = columns;
+  m->scale = scale;
+  m->offset = offset;
+  m->data = malloc((size_t)rows * columns);
+  if (m->data == NULL) {
+    perror("Failed to allocate ByteMatrix data");
+    free(m);
+    return NULL;
+  }
+  return m;
+}
+
+void free_byte_matrix(ByteMatrix *m) {
+  if (m == NULL) {
+    return;
+  }
+  free(m->data);
+  free(m);
+}
+
+ByteMatrix *copy_byte_matrix(ByteMatrix *m) {
+  if (m == NULL) {
+    return NULL;
+  }
+  ByteMatrix *copy = create_byte_matrix(m->rows, m->columns, m->scale,
+                                        m->offset);
+  if (copy == NULL) {
+    return NULL;
+  }
+  memcpy(copy->data, m->data, (size_t)m->rows * m->columns);
+  return copy;
+}
+
 void randomize_matrix(Matrix *m) {
   if (m == NULL || m->data == NULL) {
     return;
@@ -61,23 +105,207 @@ Matrix *multiply_mat(Matrix *m1, Matrix *m2) {
     return NULL;
   }
 
-  for (int i = 0; i < m1->rows; i++) {
-    for (int j = 0; j < m2->columns; j++) {
-      float sum = 0;
+  gemm(0, 0, m1->rows, m2->columns, m1->columns, 1.0f, m1->data, m1->columns,
+       m2->data, m2->columns, 0.0f, result->data, result->columns);
+
+  return result;
+}
+
+// Below this many multiply-adds a GEMM runs on the calling thread
+#define GEMM_PARALLEL_MIN_WORK (1 << 16)
+// Work per scheduler task, in multiply-adds
+#define GEMM_TASK_WORK (1 << 14)
+// Columns of C per tile, so short and wide outputs still split
+#define GEMM_TILE_COLUMNS 64
+// gemm_u8: rows of C that share each dequantized piece of B, and the
+// length of those pieces
+#define GEMM_U8_ROWS 16
+#define GEMM_U8_CHUNK 256
 
-      for (int k = 0; k < m2->rows; k++) {
-        int a = i * m1->columns + k;
-        int b = k * m2->columns + j;
+typedef struct {
+  int trans_a, trans_b;
+  int m, n, k;
+  float alpha, beta;
+  const float *a, *b;
+  float *c;
+  int lda, ldb, ldc;
+  int column_tiles;
+  int row_block; // rows of C per tile
+  // Byte B (gemm_u8) instead of b: scale * b8 + b_offset
+  const unsigned char *b8;
+  float b_scale, b_offset;
+} GemmArgs;
 
-        sum += m1->data[a] * m2->data[b];
+// Byte B is dequantized a piece at a time into a float buffer that is
+// then used for a block of GEMM_U8_ROWS rows of C, so converting costs a
+// fraction of the multiply-adds and the inner loops are the float ones.
+static void _gemm_block_u8(const GemmArgs *g, int i0, int i1, int j0, int j1) {
+  float buf[GEMM_U8_CHUNK];
+  for (int ib = i0; ib < i1; ib += GEMM_U8_ROWS) {
+    int ie = ib + GEMM_U8_ROWS < i1 ? ib + GEMM_U8_ROWS : i1;
+
+    if (!g->trans_b) {
+      // p-i-j order: a piece of a byte row of B into the rows of the block
+      for (int jb = j0; jb < j1; jb += GEMM_U8_CHUNK) {
+        int w = j1 - jb < GEMM_U8_CHUNK ? j1 - jb : GEMM_U8_CHUNK;
+        for (int p = 0; p < g->k; p++) {
+          const unsigned char *b_row = g->b8 + p * g->ldb + jb;
+          for (int j = 0; j < w; j++) {
+            buf[j] = b_row[j] * g->b_scale + g->b_offset;
+          }
+          for (int i = ib; i < ie; i++) {
+            float a_ip = g->alpha * (g->trans_a ? g->a[p * g->lda + i]
+                                                : g->a[i * g->lda + p]);
+            float *restrict c_row = g->c + i * g->ldc + jb;
+            for (int j = 0; j < w; j++) {
+              c_row[j] += a_ip * buf[j];
+            }
+          }
+        }
       }
+      continue;
+    }
 
-      int r = i * result->columns + j;
-      result->data[r] = sum;
+    // B transposed: a piece of a byte row of B dotted with each row of the
+    // block. The sums run on across pieces, so each is the same single dot
+    // product over k as in the float path.
+    float sums[GEMM_U8_ROWS];
+    for (int j = j0; j < j1; j++) {
+      const unsigned char *b_row = g->b8 + j * g->ldb;
+      for (int i = ib; i < ie; i++) {
+        sums[i - ib] = 0.0f;
+      }
+      for (int pb = 0; pb < g->k; pb += GEMM_U8_CHUNK) {
+        int w = g->k - pb < GEMM_U8_CHUNK ? g->k - pb : GEMM_U8_CHUNK;
+        for (int p = 0; p < w; p++) {
+          buf[p] = b_row[pb + p] * g->b_scale + g->b_offset;
+        }
+        for (int i = ib; i < ie; i++) {
+          float sum = sums[i - ib];
+          if (!g->trans_a) {
+            const float *a_row = g->a + i * g->lda + pb;
+            for (int p = 0; p < w; p++) {
+              sum += a_row[p] * buf[p];
+            }
+          } else {
+            for (int p = 0; p < w; p++) {
+              sum += g->a[(pb + p) * g->lda + i] * buf[p];
+            }
+          }
+          sums[i - ib] = sum;
+        }
+      }
+      for (int i = ib; i < ie; i++) {
+        g->c[i * g->ldc + j] += g->alpha * sums[i - ib];
+      }
     }
   }
+}
 
-  return result;
+static void _gemm_block(const GemmArgs *g, int i0, int i1, int j0, int j1) {
+  for (int i = i0; i < i1; i++) {
+    float *c_row = g->c + i * g->ldc;
+    if (g->beta == 0.0f) {
+      for (int j = j0; j < j1; j++) {
+        c_row[j] = 0.0f;
+      }
+    } else if (g->beta != 1.0f) {
+      for (int j = j0; j < j1; j++) {
+        c_row[j] *= g->beta;
+      }
+    }
+  }
+
+  if (g->b8 != NULL) {
+    _gemm_block_u8(g, i0, i1, j0, j1);
+    return;
+  }
+  if (!g->trans_b) {
+    // i-p-j order: the inner loop streams a row of B into a row of C
+    for (int i = i0; i < i1; i++) {
+      float *restrict c_row = g->c + i * g->ldc;
+      for (int p = 0; p < g->k; p++) {
+        float a_ip = g->alpha * (g->trans_a ? g->a[p * g->lda + i]
+                                            : g->a[i * g->lda + p]);
+        const float *restrict b_row = g->b + p * g->ldb;
+        for (int j = j0; j < j1; j++) {
+          c_row[j] += a_ip * b_row[j];
+        }
+      }
+    }
+    return;
+  }
+
+  // B transposed: rows of B are columns of op(B), use dot products
+  for (int i = i0; i < i1; i++) {
+    float *c_row = g->c + i * g->ldc;
+    for (int j = j0; j < j1; j++) {
+      const float *b_row = g->b + j * g->ldb;
+      float sum = 0.0f;
+      if (!g->trans_a) {
+        const float *a_row = g->a + i * g->lda;
+        for (int p = 0; p < g->k; p++) {
+          sum += a_row[p] * b_row[p];
+        }
+      } else {
+        for (int p = 0; p < g->k; p++) {
+          sum += g->a[p * g->lda + i] * b_row[p];
+        }
+      }
+      c_row[j] += g->alpha * sum;
+    }
+  }
+}
+
+// Tiles are numbered row-major: tile t covers row_block rows from
+// (t / column_tiles) * row_block
+static void _gemm_tiles(void *ctx, int begin, int end) {
+  const GemmArgs *g = (const GemmArgs *)ctx;
+  for (int t = begin; t < end; t++) {
+    int i0 = (t / g->column_tiles) * g->row_block;
+    int i1 = i0 + g->row_block < g->m ? i0 + g->row_block : g->m;
+    int j0 = (t % g->column_tiles) * GEMM_TILE_COLUMNS;
+    int j1 = j0 + GEMM_TILE_COLUMNS < g->n ? j0 + GEMM_TILE_COLUMNS : g->n;
+    _gemm_block(g, i0, i1, j0, j1);
+  }
+}
+
+static void _gemm_run(GemmArgs *g) {
+  int m = g->m, n = g->n, k = g->k;
+  long work = (long)m * n * (k > 0 ? k : 1);
+  if (work < GEMM_PARALLEL_MIN_WORK) {
+    _gemm_block(g, 0, m, 0, n);
+    return;
+  }
+
+  // Every tile writes a disjoint block of C, so results don't depend on how
+  // the scheduler splits them
+  g->column_tiles = (n + GEMM_TILE_COLUMNS - 1) / GEMM_TILE_COLUMNS;
+  int row_tiles = (m + g->row_block - 1) / g->row_block;
+  long tile_work = (long)g->row_block * GEMM_TILE_COLUMNS * (k > 0 ? k : 1);
+  int grain = (int)((GEMM_TASK_WORK + tile_work - 1) / tile_work);
+  parallel_for(0, row_tiles * g->column_tiles, grain, _gemm_tiles, g);
+}
+
+void gemm(int trans_a, int trans_b, int m, int n, int k, float alpha,
+          const float *a, int lda, const float *b, int ldb, float beta,
+          float *c, int ldc) {
+  GemmArgs g = {.trans_a = trans_a, .trans_b = trans_b, .m = m, .n = n,
+                .k = k, .alpha = alpha, .beta = beta, .a = a, .b = b, .c = c,
+                .lda = lda, .ldb = ldb, .ldc = ldc, .column_tiles = 1,
+                .row_block = 1};
+  _gemm_run(&g);
+}
+
+void gemm_u8(int trans_a, int trans_b, int m, int n, int k, float alpha,
+             const float *a, int lda, const unsigned char *b, int ldb,
+             float scale, float offset, float beta, float *c, int ldc) {
+  GemmArgs g = {.trans_a = trans_a, .trans_b = trans_b, .m = m, .n = n,
+                .k = k, .alpha = alpha, .beta = beta, .a = a, .b8 = b,
+                .b_scale = scale, .b_offset = offset, .c = c, .lda = lda,
+                .ldb = ldb, .ldc = ldc, .column_tiles = 1,
+                .row_block = GEMM_U8_ROWS};
+  _gemm_run(&g);
 }
 
 void add_scaler(Matrix *m, float scaler) {
@@ -168,6 +396,20 @@ void scale_matrix(Matrix *m, float scaler) {
   }
 }
 
+void sgd_update(Matrix *param, Matrix *grad, float learning_rate) {
+  if (param == NULL || grad == NULL || learning_rate == 0.0f) {
+    return;
+  }
+  if (param->rows != grad->rows || param->columns != grad->columns) {
+    printf("Error: Incompatible dimensions for sgd update\n");
+    return;
+  }
+  int n = param->rows * param->columns;
+  for (int i = 0; i < n; i++) {
+    param->data[i] -= learning_rate * grad->data[i];
+  }
+}
+
 Matrix *copy_matrix(Matrix *m) {
   if (m == NULL || m->data == NULL) {
     perror("Error in Copying Matrix. Null Matrix Input.\n");
@@ -197,4 +439,17 @@ int argmax(Matrix *m) {
     }
   }
   return max_idx;
-}
\ No newline at end of file
+}
+
+int argmax_column(Matrix *m, int column) {
+  int max_idx = 0;
+  float max_val = m->data[column];
+
+  for (int r = 1; r < m->rows; r++) {
+    if (m->data[r * m->columns + column] > max_val) {
+      max_val = m->data[r * m->columns + column];
+      max_idx = r;
+    }
+  }
+  return max_idx;
+}
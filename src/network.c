@@ -1,6 +1,7 @@
 #include "../include/network.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
 
 Network* create_network() {
     Network* n = (Network*)malloc(sizeof(Network));
@@ -10,6 +11,10 @@ Network* create_network() {
     }
     n->layers = NULL;
     n->layer_count = 0;
+    n->input_rows = 0;
+    n->output_rows = 0;
+    n->checkpoints = NULL;
+    n->checkpoint_count = 0;
     return n;
 }
 
@@ -28,34 +33,83 @@ void free_network(Network* n) {
     if (n->layers != NULL) {
         free(n->layers);
     }
+    free(n->checkpoints);
 
     free(n);
     return;
 }
 
-void add_layer(Network* n, Layer* l) {
+int add_layer(Network* n, Layer* l) {
     if (l == NULL) {
         perror("Error Adding Layer, Layer is NULL\n");
-        return;
+        return -1;
     }
 
     if (n == NULL) {
         perror("Error Adding Layer, Network is NULL\n");
-        return;
+        return -1;
+    }
+
+    // Until some layer fixes the row count, the network input is whatever
+    // this layer takes
+    int rows = n->output_rows;
+    if (rows == 0) {
+        rows = l->input_n;
+    }
+
+    int out_rows = 0;
+    int out_columns = 0;
+    if (rows == 0 && n->input_rows == 0 &&
+        layer_infer_shape(l, 1, 0, &out_rows, &out_columns) == 0 &&
+        out_rows != 1) {
+        // A shape-agnostic layer that changes the row count (an Embedding
+        // over any number of fields): later layers no longer tell what the
+        // network takes
+        n->input_rows = -1;
+    }
+    out_rows = 0;
+    if (rows > 0) {
+        if (layer_infer_shape(l, rows, 0, &out_rows, &out_columns) != 0) {
+            fprintf(stderr, "Error: layer %d (%s) doesn't fit after %d rows, not added\n",
+                    n->layer_count + 1, l->name, rows);
+            free_layer(l);
+            return -1;
+        }
+        // Shape-agnostic layers (activations) learn their size here
+        if (l->input_n == 0) {
+            l->input_n = rows;
+            l->output_n = out_rows;
+        }
     }
 
     int nc = n->layer_count + 1;
     Layer** temp = realloc(n->layers, nc * sizeof(Layer*));
     if (temp == NULL) {
         perror("Error Reallocating memory to the layer pointer.\n");
-        return;
+        free_layer(l);
+        return -1;
     }
 
     n->layers = temp;
     n->layers[n->layer_count] = l;
     n->layer_count = nc;
 
-    return;
+    if (n->input_rows == 0 && n->output_rows == 0 && rows > 0) {
+        n->input_rows = rows;
+    }
+    n->output_rows = out_rows;
+
+    return 0;
+}
+
+// Runs layers 1.. on the output of the first one, consuming it
+static Matrix* _network_forward_rest(Network* n, Matrix* out) {
+    for (int i = 1; i < n->layer_count && out != NULL; i++) {
+        Matrix* next_out = layer_forward(n->layers[i], out);
+        free_matrix(out);  // Free the previous intermediate result
+        out = next_out;
+    }
+    return out;
 }
 
 Matrix* predict_network(Network* n, Matrix* input) {
@@ -71,22 +125,188 @@ Matrix* predict_network(Network* n, Matrix* input) {
     if (n->layer_count == 0) {
         return copy_matrix(input);
     }
+    if (n->input_rows > 0 && input->rows != n->input_rows) {
+        fprintf(stderr, "Error: network takes %d input rows, got %d\n",
+                n->input_rows, input->rows);
+        return NULL;
+    }
 
     Matrix* out = layer_forward(n->layers[0], input);
+    return _network_forward_rest(n, out);
+}
+
+Matrix* predict_network_bytes(Network* n, ByteMatrix* input) {
+    if (n == NULL || input == NULL || n->layer_count == 0) {
+        fprintf(stderr, "Error: byte prediction needs a network and input\n");
+        return NULL;
+    }
+    if (n->input_rows > 0 && input->rows != n->input_rows) {
+        fprintf(stderr, "Error: network takes %d input rows, got %d\n",
+                n->input_rows, input->rows);
+        return NULL;
+    }
+
+    Matrix* out = layer_forward_bytes(n->layers[0], input);
+    return _network_forward_rest(n, out);
+}
+
+void network_set_checkpoints(Network* n, const int* boundaries, int count) {
+    if (n == NULL) {
+        perror("Network is NULL, Can't set checkpoints. \n");
+        return;
+    }
+
+    free(n->checkpoints);
+    n->checkpoints = NULL;
+    n->checkpoint_count = 0;
+    if (boundaries == NULL || count <= 0) {
+        return;
+    }
+
+    n->checkpoints = malloc(count * sizeof(int));
+    if (n->checkpoints == NULL) {
+        perror("Error Allocating memory for checkpoints.\n");
+        return;
+    }
+
+    // Sorted, unique, inside (0, layer_count)
+    for (int i = 0; i < count; i++) {
+        int b = boundaries[i];
+        if (b <= 0 || b >= n->layer_count) {
+            fprintf(stderr, "Warning: ignoring checkpoint boundary %d\n", b);
+            continue;
+        }
+        int duplicate = 0;
+        for (int j = 0; j < n->checkpoint_count; j++) {
+            duplicate |= (n->checkpoints[j] == b);
+        }
+        if (duplicate) {
+            continue;
+        }
+        int j = n->checkpoint_count;
+        while (j > 0 && n->checkpoints[j - 1] > b) {
+            n->checkpoints[j] = n->checkpoints[j - 1];
+            j--;
+        }
+        n->checkpoints[j] = b;
+        n->checkpoint_count++;
+    }
+}
 
-    for (int i = 1; i < n->layer_count; i++) {
+void network_auto_checkpoints(Network* n) {
+    if (n == NULL) {
+        perror("Network is NULL, Can't set checkpoints. \n");
+        return;
+    }
+
+    int every = (int)ceilf(sqrtf((float)n->layer_count));
+    if (every < 1) {
+        every = 1;
+    }
+
+    int count = 0;
+    int* boundaries = malloc((n->layer_count + 1) * sizeof(int));
+    if (boundaries == NULL) {
+        perror("Error Allocating memory for checkpoints.\n");
+        return;
+    }
+    for (int b = every; b < n->layer_count; b += every) {
+        boundaries[count++] = b;
+    }
+    network_set_checkpoints(n, boundaries, count);
+    free(boundaries);
+}
+
+// Runs layers [from, to) on input. Returns a new matrix, input is not freed.
+// With release set every layer drops its stored activations right away.
+static Matrix* _network_forward_range(Network* n, Matrix* input, int from,
+                                      int to, int release) {
+    Matrix* out = copy_matrix(input);
+    for (int i = from; i < to && out != NULL; i++) {
         Matrix* next_out = layer_forward(n->layers[i], out);
-        free_matrix(out);  // Free the previous intermediate result
+        free_matrix(out);
         out = next_out;
+        if (release) {
+            layer_release_activations(n->layers[i]);
+        }
     }
-
     return out;
 }
 
-void train_network(Network* n, Matrix* input, Matrix* target, float learning_rate) {
-    if (n == NULL || input == NULL || target == NULL) return;
+// Backward through layers [from, to), consuming gradient
+static Matrix* _network_backward_range(Network* n, Matrix* gradient, int from,
+                                       int to, float learning_rate) {
+    for (int i = to - 1; i >= from && gradient != NULL; i--) {
+        Matrix* next_gradient = layer_backward(n->layers[i], gradient, learning_rate);
+        free_matrix(gradient);
+        gradient = next_gradient;
+    }
+    return gradient;
+}
+
+// Only the segment inputs at the checkpoints stay alive after forward. Each
+// segment is recomputed from its checkpoint right before its backward and
+// released again afterwards. The last segment is never released since its
+// backward runs immediately.
+static void _train_network_checkpointed(Network* n, Matrix* input,
+                                        Matrix* target, float learning_rate) {
+    int segments = n->checkpoint_count + 1;
+    int* start = malloc((segments + 1) * sizeof(int));
+    Matrix** saved = calloc(segments, sizeof(Matrix*));
+    if (start == NULL || saved == NULL) {
+        perror("Error Allocating memory for checkpointed training.\n");
+        free(start);
+        free(saved);
+        return;
+    }
+    // Boundaries that no longer fall inside the network are skipped
+    start[0] = 0;
+    segments = 1;
+    for (int c = 0; c < n->checkpoint_count; c++) {
+        int b = n->checkpoints[c];
+        if (b > start[segments - 1] && b < n->layer_count) {
+            start[segments++] = b;
+        }
+    }
+    start[segments] = n->layer_count;
+
+    Matrix* out = copy_matrix(input);
+    for (int s = 0; s < segments && out != NULL; s++) {
+        saved[s] = out;
+        out = _network_forward_range(n, out, start[s], start[s + 1],
+                                     s < segments - 1);
+    }
+
+    Matrix* gradient = (out != NULL) ? subtract_matrix(out, target) : NULL;
+    free_matrix(out);
+
+    for (int s = segments - 1; s >= 0 && gradient != NULL; s--) {
+        if (s < segments - 1) {
+            free_matrix(_network_forward_range(n, saved[s], start[s],
+                                               start[s + 1], 0));
+        }
+        gradient = _network_backward_range(n, gradient, start[s], start[s + 1],
+                                           learning_rate);
+        for (int i = start[s]; i < start[s + 1]; i++) {
+            layer_release_activations(n->layers[i]);
+        }
+        free_matrix(saved[s]);
+        saved[s] = NULL;
+    }
+
+    for (int s = 0; s < segments; s++) {
+        free_matrix(saved[s]);
+    }
+    free_matrix(gradient);
+    free(saved);
+    free(start);
+}
+
+// Backward from a prediction of the whole network, consuming it
+static void _train_network_from(Network* n, Matrix* prediction, Matrix* target,
+                                float learning_rate) {
+    if (prediction == NULL) return;
 
-    Matrix* prediction = predict_network(n, input);
     Matrix* loss_gradient = subtract_matrix(prediction, target);
     Matrix* current_gradient = loss_gradient;
 
@@ -105,6 +325,122 @@ void train_network(Network* n, Matrix* input, Matrix* target, float learning_rat
     free_matrix(prediction);
 }
 
+void train_network(Network* n, Matrix* input, Matrix* target, float learning_rate) {
+    if (n == NULL || input == NULL || target == NULL) return;
+
+    if (n->checkpoint_count > 0) {
+        _train_network_checkpointed(n, input, target, learning_rate);
+        return;
+    }
+
+    _train_network_from(n, predict_network(n, input), target, learning_rate);
+}
+
+void train_network_bytes(Network* n, ByteMatrix* input, Matrix* target,
+                         float learning_rate) {
+    if (n == NULL || input == NULL || target == NULL) return;
+
+    // Byte input only exists at the first layer, which has to keep it, so
+    // every activation is kept and checkpoints don't apply
+    _train_network_from(n, predict_network_bytes(n, input), target,
+                        learning_rate);
+}
+
+int optimize_network(Network* n, int inference_only) {
+    if (n == NULL) {
+        perror("Network is NULL, Can't optimize. \n");
+        return 0;
+    }
+
+    // Original layer numbers covered by each current position, for the report
+    int* first = malloc(n->layer_count * sizeof(int));
+    int* last = malloc(n->layer_count * sizeof(int));
+    if (first == NULL || last == NULL) {
+        perror("Error Allocating memory for fusion report.\n");
+        free(first);
+        free(last);
+        return 0;
+    }
+    for (int i = 0; i < n->layer_count; i++) {
+        first[i] = i + 1;
+        last[i] = i + 1;
+    }
+
+    int fused = 0;
+    int i = 0;
+    while (i < n->layer_count - 1) {
+        // Names are string literals, still valid after the layers are freed
+        const char* a = n->layers[i]->name;
+        const char* b = n->layers[i + 1]->name;
+
+        Layer* f = layer_fuse(n->layers[i], n->layers[i + 1], inference_only);
+        if (f == NULL) {
+            i++;
+            continue;
+        }
+
+        last[i] = last[i + 1];
+        printf("Fused layers %d-%d: %s -> %s => %s\n", first[i], last[i], a, b,
+               f->name);
+
+        // Stay on i, the fused layer may fuse again with the next one
+        n->layers[i] = f;
+        for (int j = i + 1; j < n->layer_count - 1; j++) {
+            n->layers[j] = n->layers[j + 1];
+            first[j] = first[j + 1];
+            last[j] = last[j + 1];
+        }
+        n->layer_count--;
+        fused++;
+    }
+
+    // A checkpoint follows the layer it starts at; one inside a fused
+    // layer is dropped
+    int kept = 0;
+    for (int c = 0; c < n->checkpoint_count; c++) {
+        for (int j = 1; j < n->layer_count; j++) {
+            if (first[j] - 1 == n->checkpoints[c]) {
+                n->checkpoints[kept++] = j;
+                break;
+            }
+        }
+    }
+    n->checkpoint_count = kept;
+
+    free(first);
+    free(last);
+    return fused;
+}
+
+size_t network_workspace_size(Network* n, int batch) {
+    if (n == NULL || n->input_rows <= 0 || batch <= 0) {
+        fprintf(stderr, "Error: network input shape is unknown\n");
+        return 0;
+    }
+
+    size_t total = 0;
+    size_t in_flight = 0;
+    int rows = n->input_rows;
+    int columns = batch;
+    for (int i = 0; i < n->layer_count; i++) {
+        int out_rows, out_columns;
+        if (layer_infer_shape(n->layers[i], rows, columns, &out_rows,
+                              &out_columns) != 0) {
+            return 0;
+        }
+        total += layer_workspace_size(n->layers[i], rows, columns);
+
+        size_t pair = sizeof(float) * ((size_t)rows * columns +
+                                       (size_t)out_rows * out_columns);
+        if (pair > in_flight) {
+            in_flight = pair;
+        }
+        rows = out_rows;
+        columns = out_columns;
+    }
+    return total + in_flight;
+}
+
 void print_network_info(Network *n) {
     if (n == NULL) {
         printf("Network is NULL\n");
@@ -115,4 +451,8 @@ void print_network_info(Network *n) {
         printf(" Layer %d: %s\n", i + 1, n->layers[i]->name);
         print_layer_info(n->layers[i]);
     }
-}
\ No newline at end of file
+    if (n->input_rows > 0) {
+        printf("Input rows: %d, output rows: %d\n", n->input_rows,
+               n->output_rows);
+    }
+}
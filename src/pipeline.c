@@ -0,0 +1,379 @@
+#ifdef __linux__
+#define _GNU_SOURCE // pthread_setaffinity_np
+#endif
+
+#include "../include/pipeline.h"
+#include "../include/scheduler.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PIPELINE_CACHE_LINE 64
+#define PIPELINE_PROFILE_RUNS 3
+
+typedef struct {
+    Matrix* m;      // NULL with stop unset: a layer failed on this sample
+    int stop;
+} PipelineSlot;
+
+// Lock-free ring for exactly one producer and one consumer. head and tail
+// count forever and are reduced modulo capacity; each sits on its own cache
+// line so the two sides don't invalidate each other on every operation.
+typedef struct {
+    PipelineSlot* slots;
+    unsigned long capacity;
+    char pad0[PIPELINE_CACHE_LINE];
+    unsigned long head;     // next slot to read, written by the consumer
+    char pad1[PIPELINE_CACHE_LINE];
+    unsigned long tail;     // next slot to write, written by the producer
+    char pad2[PIPELINE_CACHE_LINE];
+} SpscQueue;
+
+typedef struct {
+    Pipeline* pipeline;
+    int index;
+    int first_layer;
+    int last_layer;         // exclusive
+    double cost;            // measured seconds per sample input
+    SpscQueue* in;
+    SpscQueue* out;
+    pthread_t thread;
+} PipelineStage;
+
+struct Pipeline {
+    Network* network;
+    int stage_count;
+    PipelineStage* stages;
+    SpscQueue* queues;      // stage_count + 1: queue k feeds stage k
+    double* layer_cost;
+    long pending;           // submitted and not yet received
+};
+
+static int _queue_init(SpscQueue* q, int capacity) {
+    q->slots = malloc(sizeof(PipelineSlot) * capacity);
+    if (q->slots == NULL) {
+        perror("Error Allocating memory for pipeline queue.\n");
+        return -1;
+    }
+    q->capacity = capacity;
+    q->head = 0;
+    q->tail = 0;
+    return 0;
+}
+
+static void _queue_push(SpscQueue* q, PipelineSlot slot) {
+    unsigned long tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    // Wait for the consumer to free a slot
+    while (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == q->capacity) {
+        sched_yield();
+    }
+    q->slots[tail % q->capacity] = slot;
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static PipelineSlot _queue_pop(SpscQueue* q) {
+    unsigned long head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    while (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head) {
+        sched_yield();
+    }
+    PipelineSlot slot = q->slots[head % q->capacity];
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+    return slot;
+}
+
+static double _now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Best of a few forward runs per layer, on the activations the sample
+// actually produces at that depth.
+static int _profile_layers(Network* n, Matrix* sample, double* cost) {
+    Matrix* current = copy_matrix(sample);
+    for (int i = 0; i < n->layer_count && current != NULL; i++) {
+        Matrix* next = NULL;
+        cost[i] = -1.0;
+        for (int r = 0; r < PIPELINE_PROFILE_RUNS; r++) {
+            free_matrix(next);
+            double start = _now_seconds();
+            next = layer_forward(n->layers[i], current);
+            double elapsed = _now_seconds() - start;
+            if (cost[i] < 0.0 || elapsed < cost[i]) {
+                cost[i] = elapsed;
+            }
+        }
+        layer_release_activations(n->layers[i]);
+        free_matrix(current);
+        current = next;
+    }
+    if (current == NULL) {
+        fprintf(stderr, "Error: pipeline sample failed to run through the network\n");
+        return -1;
+    }
+    free_matrix(current);
+    return 0;
+}
+
+// Linear partition: split the costs into `parts` contiguous ranges so that
+// the largest range sum is minimal. O(parts * layers^2), layers are few.
+static int _balance_stages(const double* cost, int layers, int parts,
+                           int* bounds) {
+    double* prefix = malloc(sizeof(double) * (layers + 1));
+    double* best = malloc(sizeof(double) * (parts + 1) * (layers + 1));
+    int* cut = malloc(sizeof(int) * (parts + 1) * (layers + 1));
+    if (prefix == NULL || best == NULL || cut == NULL) {
+        perror("Error Allocating memory for stage balancing.\n");
+        free(prefix);
+        free(best);
+        free(cut);
+        return -1;
+    }
+
+    prefix[0] = 0.0;
+    for (int i = 0; i < layers; i++) {
+        prefix[i + 1] = prefix[i] + cost[i];
+    }
+
+    // best[k][j]: minimal max stage cost of the first j layers in k stages
+    for (int j = 0; j <= layers; j++) {
+        best[1 * (layers + 1) + j] = prefix[j];
+        cut[1 * (layers + 1) + j] = 0;
+    }
+    for (int k = 2; k <= parts; k++) {
+        for (int j = k; j <= layers; j++) {
+            double value = -1.0;
+            int where = k - 1;
+            for (int c = k - 1; c < j; c++) {
+                double left = best[(k - 1) * (layers + 1) + c];
+                double right = prefix[j] - prefix[c];
+                double worst = left > right ? left : right;
+                if (value < 0.0 || worst < value) {
+                    value = worst;
+                    where = c;
+                }
+            }
+            best[k * (layers + 1) + j] = value;
+            cut[k * (layers + 1) + j] = where;
+        }
+    }
+
+    bounds[parts] = layers;
+    for (int k = parts; k >= 1; k--) {
+        bounds[k - 1] = cut[k * (layers + 1) + bounds[k]];
+    }
+
+    free(prefix);
+    free(best);
+    free(cut);
+    return 0;
+}
+
+static void _pin_to_core(pthread_t thread, int core) {
+#ifdef __linux__
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cores < 1) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores, &set);
+    pthread_setaffinity_np(thread, sizeof(set), &set);
+#else
+    // No portable affinity API (macOS only takes hints); leave it to the OS
+    (void)thread;
+    (void)core;
+#endif
+}
+
+static void* _stage_main(void* arg) {
+    PipelineStage* s = (PipelineStage*)arg;
+    Network* n = s->pipeline->network;
+    // The stage owns its core, its layers run inline
+    scheduler_run_inline(1);
+
+    for (;;) {
+        PipelineSlot slot = _queue_pop(s->in);
+        if (slot.stop) {
+            _queue_push(s->out, slot);
+            break;
+        }
+        for (int i = s->first_layer; i < s->last_layer && slot.m != NULL; i++) {
+            Matrix* next = layer_forward(n->layers[i], slot.m);
+            free_matrix(slot.m);
+            slot.m = next;
+        }
+        _queue_push(s->out, slot);
+    }
+
+    for (int i = s->first_layer; i < s->last_layer; i++) {
+        layer_release_activations(n->layers[i]);
+    }
+    return NULL;
+}
+
+static void _free_pipeline_memory(Pipeline* p) {
+    if (p->queues != NULL) {
+        for (int k = 0; k <= p->stage_count; k++) {
+            free(p->queues[k].slots);
+        }
+    }
+    free(p->queues);
+    free(p->stages);
+    free(p->layer_cost);
+    free(p);
+}
+
+Pipeline* create_pipeline(Network* n, Matrix* sample, int stages,
+                          int queue_capacity) {
+    if (n == NULL || n->layer_count == 0 || sample == NULL || stages < 1 ||
+        queue_capacity < 1) {
+        fprintf(stderr, "Error: invalid arguments to create_pipeline\n");
+        return NULL;
+    }
+    if (stages > n->layer_count) {
+        stages = n->layer_count;
+    }
+
+    Pipeline* p = calloc(1, sizeof(Pipeline));
+    if (p == NULL) {
+        perror("Error Allocating memory for pipeline.\n");
+        return NULL;
+    }
+    p->network = n;
+    p->stage_count = stages;
+    p->stages = calloc(stages, sizeof(PipelineStage));
+    p->queues = calloc(stages + 1, sizeof(SpscQueue));
+    p->layer_cost = malloc(sizeof(double) * n->layer_count);
+    int* bounds = malloc(sizeof(int) * (stages + 1));
+    if (p->stages == NULL || p->queues == NULL || p->layer_cost == NULL ||
+        bounds == NULL) {
+        perror("Error Allocating memory for pipeline.\n");
+        free(bounds);
+        _free_pipeline_memory(p);
+        return NULL;
+    }
+
+    if (_profile_layers(n, sample, p->layer_cost) != 0 ||
+        _balance_stages(p->layer_cost, n->layer_count, stages, bounds) != 0) {
+        free(bounds);
+        _free_pipeline_memory(p);
+        return NULL;
+    }
+
+    for (int k = 0; k <= stages; k++) {
+        if (_queue_init(&p->queues[k], queue_capacity) != 0) {
+            free(bounds);
+            _free_pipeline_memory(p);
+            return NULL;
+        }
+    }
+
+    for (int k = 0; k < stages; k++) {
+        PipelineStage* s = &p->stages[k];
+        s->pipeline = p;
+        s->index = k;
+        s->first_layer = bounds[k];
+        s->last_layer = bounds[k + 1];
+        s->cost = 0.0;
+        for (int i = s->first_layer; i < s->last_layer; i++) {
+            s->cost += p->layer_cost[i];
+        }
+        s->in = &p->queues[k];
+        s->out = &p->queues[k + 1];
+    }
+    free(bounds);
+
+    for (int k = 0; k < stages; k++) {
+        if (pthread_create(&p->stages[k].thread, NULL, _stage_main,
+                           &p->stages[k]) != 0) {
+            perror("Error starting pipeline stage.\n");
+            // Stop the stages already running; the stop slot flows through
+            // them and lands in the queue feeding stage k
+            PipelineSlot stop = {NULL, 1};
+            _queue_push(&p->queues[0], stop);
+            for (int j = 0; j < k; j++) {
+                pthread_join(p->stages[j].thread, NULL);
+            }
+            _free_pipeline_memory(p);
+            return NULL;
+        }
+        _pin_to_core(p->stages[k].thread, k);
+    }
+    return p;
+}
+
+void free_pipeline(Pipeline* p) {
+    if (p == NULL) return;
+
+    PipelineSlot stop = {NULL, 1};
+    _queue_push(&p->queues[0], stop);
+
+    // Drain unreceived results until the stop slot comes out the other end
+    SpscQueue* out = &p->queues[p->stage_count];
+    for (;;) {
+        PipelineSlot slot = _queue_pop(out);
+        if (slot.stop) {
+            break;
+        }
+        free_matrix(slot.m);
+    }
+
+    for (int k = 0; k < p->stage_count; k++) {
+        pthread_join(p->stages[k].thread, NULL);
+    }
+    _free_pipeline_memory(p);
+}
+
+int pipeline_submit(Pipeline* p, Matrix* input) {
+    if (p == NULL || input == NULL) {
+        fprintf(stderr, "Error: NULL input to pipeline_submit\n");
+        return -1;
+    }
+    PipelineSlot slot = {input, 0};
+    _queue_push(&p->queues[0], slot);
+    __atomic_fetch_add(&p->pending, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+Matrix* pipeline_receive(Pipeline* p) {
+    if (p == NULL) return NULL;
+    if (__atomic_load_n(&p->pending, __ATOMIC_RELAXED) == 0) {
+        fprintf(stderr, "Error: pipeline_receive with nothing submitted\n");
+        return NULL;
+    }
+    PipelineSlot slot = _queue_pop(&p->queues[p->stage_count]);
+    __atomic_fetch_sub(&p->pending, 1, __ATOMIC_RELAXED);
+    return slot.m;
+}
+
+void print_pipeline_info(Pipeline* p) {
+    if (p == NULL) {
+        printf("Pipeline is NULL\n");
+        return;
+    }
+    double slowest = 0.0;
+    for (int k = 0; k < p->stage_count; k++) {
+        if (p->stages[k].cost > slowest) {
+            slowest = p->stages[k].cost;
+        }
+    }
+    printf("Pipeline: %d stages\n", p->stage_count);
+    for (int k = 0; k < p->stage_count; k++) {
+        PipelineStage* s = &p->stages[k];
+        printf("  Stage %d: layers %d-%d, %.1f us", k, s->first_layer + 1,
+               s->last_layer, s->cost * 1e6);
+        if (s->cost == slowest) {
+            printf(" (bottleneck)");
+        }
+        printf("\n");
+        for (int i = s->first_layer; i < s->last_layer; i++) {
+            printf("    %2d %-12s %.1f us\n", i + 1, p->network->layers[i]->name,
+                   p->layer_cost[i] * 1e6);
+        }
+    }
+}
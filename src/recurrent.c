@@ -0,0 +1,574 @@
+#include "../include/layer.h"
+
+// Sequences are laid out time-major across the columns: an input of
+// (input_n x seq_len*batch) holds step t of sample b in column t*batch + b.
+// That lets the input projection for every step run as one GEMM, and each
+// step is a column slice (row stride seq_len*batch) that gemm() reads in
+// place.
+//
+// Gate weights are stacked into single matrices: weights (gates*H x input_n)
+// for the input side, w_hidden (gates*H x H) for the recurrent side.
+// LSTM gate order is i, f, g, o. GRU gate order is r, z, n.
+
+typedef struct {
+  int gates;
+  int hidden_n;
+  int seq_len;
+  int return_sequences;
+  int batch; // batch size the buffers below are sized for
+
+  Matrix *w_hidden;   // (gates*H x H)
+  Matrix *d_w_hidden; // (gates*H x H)
+
+  Matrix *gate_act; // (gates*H x T*B) input projection, then gate activations
+  Matrix *cell;     // (H x T*B) LSTM cell states, GRU W_hn*h_{t-1}
+  Matrix *hidden;   // (H x T*B) hidden state of every step
+
+  Matrix *d_gate_in;  // (gates*H x T*B) gradient wrt the input projection
+  Matrix *d_gate_rec; // GRU only: gradient wrt the recurrent projection
+  Matrix *rec;        // (gates*H x B) per step W_h*h_{t-1} scratch
+  Matrix *d_h;        // (H x B) gradient carried to the previous step
+  Matrix *d_c;        // (H x B) LSTM cell gradient carried to previous step
+} RecurrentState;
+
+static void _recurrent_free_buffers(RecurrentState *s) {
+  free_matrix(s->gate_act);
+  free_matrix(s->cell);
+  free_matrix(s->hidden);
+  free_matrix(s->d_gate_in);
+  free_matrix(s->d_gate_rec);
+  free_matrix(s->rec);
+  free_matrix(s->d_h);
+  free_matrix(s->d_c);
+  s->gate_act = NULL;
+  s->cell = NULL;
+  s->hidden = NULL;
+  s->d_gate_in = NULL;
+  s->d_gate_rec = NULL;
+  s->rec = NULL;
+  s->d_h = NULL;
+  s->d_c = NULL;
+  s->batch = 0;
+}
+
+static void _recurrent_free_state(Layer *l) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (s == NULL) {
+    return;
+  }
+  _recurrent_free_buffers(s);
+  free_matrix(s->w_hidden);
+  free_matrix(s->d_w_hidden);
+  free(s);
+  l->state = NULL;
+}
+
+// Forward and backward buffers for the whole sequence are allocated once per
+// batch size and reused by every step and every call.
+static int _recurrent_ensure_buffers(RecurrentState *s, int batch) {
+  if (s->batch == batch) {
+    return 0;
+  }
+  _recurrent_free_buffers(s);
+
+  int gh = s->gates * s->hidden_n;
+  int tb = s->seq_len * batch;
+  s->gate_act = create_matrix(gh, tb);
+  s->cell = create_matrix(s->hidden_n, tb);
+  s->hidden = create_matrix(s->hidden_n, tb);
+  s->d_gate_in = create_matrix(gh, tb);
+  // LSTM reuses d_gate_in, its recurrent term adds straight into the gates
+  s->d_gate_rec = (s->gates == 3) ? create_matrix(gh, tb) : NULL;
+  s->rec = create_matrix(gh, batch);
+  s->d_h = create_matrix(s->hidden_n, batch);
+  s->d_c = create_matrix(s->hidden_n, batch);
+
+  if (s->gate_act == NULL || s->cell == NULL || s->hidden == NULL ||
+      s->d_gate_in == NULL || (s->gates == 3 && s->d_gate_rec == NULL) ||
+      s->rec == NULL || s->d_h == NULL || s->d_c == NULL) {
+    _recurrent_free_buffers(s);
+    return -1;
+  }
+  s->batch = batch;
+  return 0;
+}
+
+static float _sigmoid_grad(float s) { return s * (1.0f - s); }
+
+// Validates the input, sizes the buffers and computes the input projection
+// W_x * X + b for every step in one GEMM. Returns the batch size or -1.
+static int _recurrent_project_inputs(Layer *l, Matrix *input) {
+  RecurrentState *s = (RecurrentState *)l->state;
+
+  if (input == NULL || input->rows != l->input_n ||
+      input->columns % s->seq_len != 0) {
+    fprintf(stderr,
+            "Error: %s expects (%d x seq_len*batch) input with seq_len %d, "
+            "got (%d, %d)\n",
+            l->name, l->input_n, s->seq_len, input == NULL ? -1 : input->rows,
+            input == NULL ? -1 : input->columns);
+    return -1;
+  }
+
+  int batch = input->columns / s->seq_len;
+  if (_recurrent_ensure_buffers(s, batch) != 0) {
+    return -1;
+  }
+
+  // Free previous inputs to prevent memory leak
+  if (l->inputs != NULL) {
+    free_matrix(l->inputs);
+  }
+  l->inputs = copy_matrix(input);
+
+  int gh = s->gates * s->hidden_n;
+  int tb = input->columns;
+  gemm(0, 0, gh, tb, l->input_n, 1.0f, l->weights->data, l->input_n,
+       input->data, tb, 0.0f, s->gate_act->data, tb);
+  for (int r = 0; r < gh; r++) {
+    float bias = l->bias->data[r];
+    float *row = s->gate_act->data + r * tb;
+    for (int c = 0; c < tb; c++) {
+      row[c] += bias;
+    }
+  }
+  return batch;
+}
+
+static Matrix *_recurrent_output(RecurrentState *s) {
+  if (s->return_sequences) {
+    return copy_matrix(s->hidden);
+  }
+
+  // Only the last step: (H x B)
+  int tb = s->seq_len * s->batch;
+  Matrix *out = create_matrix(s->hidden_n, s->batch);
+  if (out == NULL) {
+    return NULL;
+  }
+  for (int j = 0; j < s->hidden_n; j++) {
+    const float *src = s->hidden->data + j * tb + (s->seq_len - 1) * s->batch;
+    for (int b = 0; b < s->batch; b++) {
+      out->data[j * s->batch + b] = src[b];
+    }
+  }
+  return out;
+}
+
+static int _recurrent_check_gradient(Layer *l, Matrix *error_gradient) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (l->inputs == NULL || error_gradient == NULL) {
+    fprintf(stderr, "Error: NULL input to backward_%s\n", l->name);
+    return -1;
+  }
+  int columns = s->return_sequences ? s->seq_len * s->batch : s->batch;
+  if (error_gradient->rows != s->hidden_n ||
+      error_gradient->columns != columns) {
+    fprintf(stderr, "Error: %s gradient (%d,%d) does not match output (%d,%d)\n",
+            l->name, error_gradient->rows, error_gradient->columns,
+            s->hidden_n, columns);
+    return -1;
+  }
+  return 0;
+}
+
+// Gradient of step t's output and its row stride, or NULL when only the last
+// step is returned
+static const float *_recurrent_step_gradient(RecurrentState *s,
+                                             Matrix *error_gradient, int t,
+                                             int *stride) {
+  *stride = error_gradient->columns;
+  if (s->return_sequences) {
+    return error_gradient->data + t * s->batch;
+  }
+  return (t == s->seq_len - 1) ? error_gradient->data : NULL;
+}
+
+// Weight gradients for the whole sequence as three large GEMMs, the input
+// gradient from the pre-update weights, then the SGD step.
+static Matrix *_recurrent_finish_backward(Layer *l, const float *d_rec,
+                                          float learning_rate) {
+  RecurrentState *s = (RecurrentState *)l->state;
+
+  int gh = s->gates * s->hidden_n;
+  int h = s->hidden_n;
+  int batch = s->batch;
+  int tb = s->seq_len * batch;
+  const float *d_in = s->d_gate_in->data;
+
+  // dW_x = dP * X^T
+  gemm(0, 1, gh, l->input_n, tb, 1.0f, d_in, tb, l->inputs->data, tb, 0.0f,
+       l->d_weight->data, l->input_n);
+
+  // dW_h = dU[:, t >= 1] * H[:, t <= T-2]^T, the first step had h = 0
+  gemm(0, 1, gh, h, tb - batch, 1.0f, d_rec + batch, tb,
+       s->hidden->data, tb, 0.0f, s->d_w_hidden->data, h);
+
+  for (int r = 0; r < gh; r++) {
+    const float *row = d_in + r * tb;
+    float sum = 0.0f;
+    for (int c = 0; c < tb; c++) {
+      sum += row[c];
+    }
+    l->d_bias->data[r] = sum;
+  }
+
+  // dX = W_x^T * dP
+  Matrix *input_grad = create_matrix(l->input_n, tb);
+  if (input_grad == NULL) {
+    return NULL;
+  }
+  gemm(1, 0, l->input_n, tb, gh, 1.0f, l->weights->data, l->input_n, d_in, tb,
+       0.0f, input_grad->data, tb);
+
+  sgd_update(l->weights, l->d_weight, learning_rate);
+  sgd_update(s->w_hidden, s->d_w_hidden, learning_rate);
+  sgd_update(l->bias, l->d_bias, learning_rate);
+
+  return input_grad;
+}
+
+Matrix *_layer_forward_lstm(Layer *l, Matrix *input) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (_recurrent_project_inputs(l, input) < 0) {
+    return NULL;
+  }
+
+  int h = s->hidden_n;
+  int batch = s->batch;
+  int tb = s->seq_len * batch;
+  float *act = s->gate_act->data;
+  float *cell = s->cell->data;
+  float *hidden = s->hidden->data;
+
+  for (int t = 0; t < s->seq_len; t++) {
+    int col = t * batch;
+
+    // Gates_t += W_h * h_{t-1}: one GEMM for all four gates
+    if (t > 0) {
+      gemm(0, 0, 4 * h, batch, h, 1.0f, s->w_hidden->data, h,
+           hidden + col - batch, tb, 1.0f, act + col, tb);
+    }
+
+    for (int j = 0; j < h; j++) {
+      float *gi = act + j * tb + col;
+      float *gf = act + (h + j) * tb + col;
+      float *gg = act + (2 * h + j) * tb + col;
+      float *go = act + (3 * h + j) * tb + col;
+      float *c = cell + j * tb + col;
+      float *hs = hidden + j * tb + col;
+      for (int b = 0; b < batch; b++) {
+        float c_prev = (t > 0) ? c[b - batch] : 0.0f;
+        gi[b] = sigmoid(gi[b]);
+        gf[b] = sigmoid(gf[b]);
+        gg[b] = tanhf(gg[b]);
+        go[b] = sigmoid(go[b]);
+        c[b] = gf[b] * c_prev + gi[b] * gg[b];
+        hs[b] = go[b] * tanhf(c[b]);
+      }
+    }
+  }
+
+  return _recurrent_output(s);
+}
+
+Matrix *_layer_backward_lstm(Layer *l, Matrix *error_gradient,
+                             float learning_rate) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (_recurrent_check_gradient(l, error_gradient) != 0) {
+    return NULL;
+  }
+
+  int h = s->hidden_n;
+  int batch = s->batch;
+  int tb = s->seq_len * batch;
+  const float *act = s->gate_act->data;
+  const float *cell = s->cell->data;
+  float *dz = s->d_gate_in->data;
+  float *d_h = s->d_h->data;
+  float *d_c = s->d_c->data;
+
+  zero_matrix(s->d_h);
+  zero_matrix(s->d_c);
+
+  for (int t = s->seq_len - 1; t >= 0; t--) {
+    int col = t * batch;
+    int dy_stride;
+    const float *dy =
+        _recurrent_step_gradient(s, error_gradient, t, &dy_stride);
+
+    for (int j = 0; j < h; j++) {
+      const float *gi = act + j * tb + col;
+      const float *gf = act + (h + j) * tb + col;
+      const float *gg = act + (2 * h + j) * tb + col;
+      const float *go = act + (3 * h + j) * tb + col;
+      const float *c = cell + j * tb + col;
+      float *dzi = dz + j * tb + col;
+      float *dzf = dz + (h + j) * tb + col;
+      float *dzg = dz + (2 * h + j) * tb + col;
+      float *dzo = dz + (3 * h + j) * tb + col;
+      for (int b = 0; b < batch; b++) {
+        float dh = d_h[j * batch + b] + (dy != NULL ? dy[j * dy_stride + b] : 0.0f);
+        float c_prev = (t > 0) ? c[b - batch] : 0.0f;
+        float tanh_c = tanhf(c[b]);
+        float dc = dh * go[b] * (1.0f - tanh_c * tanh_c) + d_c[j * batch + b];
+
+        dzo[b] = dh * tanh_c * _sigmoid_grad(go[b]);
+        dzi[b] = dc * gg[b] * _sigmoid_grad(gi[b]);
+        dzg[b] = dc * gi[b] * (1.0f - gg[b] * gg[b]);
+        dzf[b] = dc * c_prev * _sigmoid_grad(gf[b]);
+        d_c[j * batch + b] = dc * gf[b];
+      }
+    }
+
+    // dh_{t-1} = W_h^T * dGates_t
+    if (t > 0) {
+      gemm(1, 0, h, batch, 4 * h, 1.0f, s->w_hidden->data, h, dz + col, tb,
+           0.0f, d_h, batch);
+    }
+  }
+
+  // The LSTM recurrent projection feeds the gates directly, dU == dP
+  return _recurrent_finish_backward(l, s->d_gate_in->data, learning_rate);
+}
+
+Matrix *_layer_forward_gru(Layer *l, Matrix *input) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (_recurrent_project_inputs(l, input) < 0) {
+    return NULL;
+  }
+
+  int h = s->hidden_n;
+  int batch = s->batch;
+  int tb = s->seq_len * batch;
+  float *act = s->gate_act->data;
+  float *hn = s->cell->data;
+  float *hidden = s->hidden->data;
+  float *rec = s->rec->data;
+
+  for (int t = 0; t < s->seq_len; t++) {
+    int col = t * batch;
+
+    // W_h * h_{t-1} for all three gates in one GEMM
+    if (t > 0) {
+      gemm(0, 0, 3 * h, batch, h, 1.0f, s->w_hidden->data, h,
+           hidden + col - batch, tb, 0.0f, rec, batch);
+    } else {
+      zero_matrix(s->rec);
+    }
+
+    for (int j = 0; j < h; j++) {
+      float *gr = act + j * tb + col;
+      float *gz = act + (h + j) * tb + col;
+      float *gn = act + (2 * h + j) * tb + col;
+      float *hn_t = hn + j * tb + col;
+      float *hs = hidden + j * tb + col;
+      const float *rr = rec + j * batch;
+      const float *rz = rec + (h + j) * batch;
+      const float *rn = rec + (2 * h + j) * batch;
+      for (int b = 0; b < batch; b++) {
+        float h_prev = (t > 0) ? hs[b - batch] : 0.0f;
+        gr[b] = sigmoid(gr[b] + rr[b]);
+        gz[b] = sigmoid(gz[b] + rz[b]);
+        hn_t[b] = rn[b];
+        gn[b] = tanhf(gn[b] + gr[b] * rn[b]);
+        hs[b] = (1.0f - gz[b]) * gn[b] + gz[b] * h_prev;
+      }
+    }
+  }
+
+  return _recurrent_output(s);
+}
+
+Matrix *_layer_backward_gru(Layer *l, Matrix *error_gradient,
+                            float learning_rate) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (_recurrent_check_gradient(l, error_gradient) != 0) {
+    return NULL;
+  }
+
+  int h = s->hidden_n;
+  int batch = s->batch;
+  int tb = s->seq_len * batch;
+  const float *act = s->gate_act->data;
+  const float *hn = s->cell->data;
+  const float *hidden = s->hidden->data;
+  float *dp = s->d_gate_in->data;
+  float *du = s->d_gate_rec->data;
+  float *d_h = s->d_h->data;
+
+  zero_matrix(s->d_h);
+
+  for (int t = s->seq_len - 1; t >= 0; t--) {
+    int col = t * batch;
+    int dy_stride;
+    const float *dy =
+        _recurrent_step_gradient(s, error_gradient, t, &dy_stride);
+
+    for (int j = 0; j < h; j++) {
+      const float *gr = act + j * tb + col;
+      const float *gz = act + (h + j) * tb + col;
+      const float *gn = act + (2 * h + j) * tb + col;
+      const float *hn_t = hn + j * tb + col;
+      const float *hs = hidden + j * tb + col;
+      for (int b = 0; b < batch; b++) {
+        float dh = d_h[j * batch + b] + (dy != NULL ? dy[j * dy_stride + b] : 0.0f);
+        float h_prev = (t > 0) ? hs[b - batch] : 0.0f;
+
+        float dzn = dh * (1.0f - gz[b]) * (1.0f - gn[b] * gn[b]);
+        float dzz = dh * (h_prev - gn[b]) * _sigmoid_grad(gz[b]);
+        float dzr = dzn * hn_t[b] * _sigmoid_grad(gr[b]);
+
+        dp[j * tb + col + b] = dzr;
+        dp[(h + j) * tb + col + b] = dzz;
+        dp[(2 * h + j) * tb + col + b] = dzn;
+        du[j * tb + col + b] = dzr;
+        du[(h + j) * tb + col + b] = dzz;
+        du[(2 * h + j) * tb + col + b] = dzn * gr[b];
+
+        // Direct path through h_t = ... + z * h_{t-1}
+        d_h[j * batch + b] = dh * gz[b];
+      }
+    }
+
+    // dh_{t-1} += W_h^T * dU_t
+    if (t > 0) {
+      gemm(1, 0, h, batch, 3 * h, 1.0f, s->w_hidden->data, h, du + col, tb,
+           1.0f, d_h, batch);
+    }
+  }
+
+  return _recurrent_finish_backward(l, s->d_gate_rec->data, learning_rate);
+}
+
+static int _recurrent_infer_shape(Layer *l, int rows, int columns,
+                                  int *out_rows, int *out_columns) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  if (rows != l->input_n) {
+    fprintf(stderr, "Error: %s expects %d input rows, got %d\n", l->name,
+            l->input_n, rows);
+    return -1;
+  }
+  if (columns % s->seq_len != 0) {
+    fprintf(stderr, "Error: %s columns %d are not a multiple of seq_len %d\n",
+            l->name, columns, s->seq_len);
+    return -1;
+  }
+  *out_rows = s->hidden_n;
+  *out_columns = s->return_sequences ? columns : columns / s->seq_len;
+  return 0;
+}
+
+// Stored input and the per-batch buffers of _recurrent_ensure_buffers
+static size_t _recurrent_workspace_size(Layer *l, int rows, int columns) {
+  RecurrentState *s = (RecurrentState *)l->state;
+  size_t tb = (size_t)columns;
+  size_t batch = tb / s->seq_len;
+  size_t gh = (size_t)s->gates * s->hidden_n;
+  size_t floats = rows * tb;
+  floats += (gh + 2 * s->hidden_n) * tb; // gate_act, cell, hidden
+  floats += gh * tb;                     // d_gate_in
+  if (s->gates == 3) {
+    floats += gh * tb; // d_gate_rec
+  }
+  floats += (gh + 2 * s->hidden_n) * batch; // rec, d_h, d_c
+  return sizeof(float) * floats;
+}
+
+static Layer *_layer_create_recurrent(int input_n, int hidden_n, int seq_len,
+                                      int return_sequences, int gates) {
+  Layer *l = (Layer *)malloc(sizeof(Layer));
+
+  if (l == NULL) {
+    perror("Could Not allocate memory for layer. NULL");
+    return NULL;
+  }
+
+  RecurrentState *s = (RecurrentState *)calloc(1, sizeof(RecurrentState));
+  if (s == NULL) {
+    perror("Could Not allocate memory for recurrent state. NULL");
+    free(l);
+    return NULL;
+  }
+  s->gates = gates;
+  s->hidden_n = hidden_n;
+  s->seq_len = seq_len;
+  s->return_sequences = return_sequences;
+
+  int gh = gates * hidden_n;
+  l->weights = create_matrix(gh, input_n);
+  l->bias = create_matrix(gh, 1);
+  l->d_weight = create_matrix(gh, input_n);
+  l->d_bias = create_matrix(gh, 1);
+  s->w_hidden = create_matrix(gh, hidden_n);
+  s->d_w_hidden = create_matrix(gh, hidden_n);
+
+  l->inputs = NULL;
+  l->byte_inputs = NULL;
+  l->output = NULL;
+
+  l->state = s;
+  l->free_state = _recurrent_free_state;
+  l->infer_shape = _recurrent_infer_shape;
+  l->workspace_size = _recurrent_workspace_size;
+
+  if (l->weights == NULL || l->bias == NULL || l->d_weight == NULL ||
+      l->d_bias == NULL || s->w_hidden == NULL || s->d_w_hidden == NULL) {
+    perror("Could Not allocate memory for recurrent weights. NULL");
+    free_layer(l);
+    return NULL;
+  }
+
+  // Xavier initialization per gate block, centered at 0
+  float scale_in = sqrtf(2.0f / (float)(input_n + hidden_n));
+  for (int i = 0; i < gh * input_n; i++) {
+    l->weights->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale_in;
+  }
+  float scale_h = sqrtf(1.0f / (float)hidden_n);
+  for (int i = 0; i < gh * hidden_n; i++) {
+    s->w_hidden->data[i] =
+        ((float)rand() / (float)RAND_MAX * 2.0f - 1.0f) * scale_h;
+  }
+  zero_matrix(l->bias);
+  zero_matrix(l->d_weight);
+  zero_matrix(l->d_bias);
+  zero_matrix(s->d_w_hidden);
+
+  l->input_n = input_n;
+  l->output_n = hidden_n;
+  return l;
+}
+
+Layer *layer_create_lstm(int input_n, int hidden_n, int seq_len,
+                         int return_sequences) {
+  Layer *l =
+      _layer_create_recurrent(input_n, hidden_n, seq_len, return_sequences, 4);
+  if (l == NULL) {
+    return NULL;
+  }
+  l->forward = _layer_forward_lstm;
+  l->backward = _layer_backward_lstm;
+
+  // Forget gate starts open so early gradients flow through the cell
+  for (int j = 0; j < hidden_n; j++) {
+    l->bias->data[hidden_n + j] = 1.0f;
+  }
+
+  l->name = "LSTM";
+  return l;
+}
+
+Layer *layer_create_gru(int input_n, int hidden_n, int seq_len,
+                        int return_sequences) {
+  Layer *l =
+      _layer_create_recurrent(input_n, hidden_n, seq_len, return_sequences, 3);
+  if (l == NULL) {
+    return NULL;
+  }
+  l->forward = _layer_forward_gru;
+  l->backward = _layer_backward_gru;
+
+  l->name = "GRU";
+  return l;
+}
@@ -0,0 +1,299 @@
+#include "../include/scheduler.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define SCHEDULER_DEQUE_SIZE 1024
+#define SCHEDULER_IDLE_SPINS 64
+
+typedef struct {
+    ParallelForFunction fn;
+    void* ctx;
+    int begin;
+    int end;
+    int grain;
+    long* remaining;    // iterations of the region not yet run
+} SchedulerTask;
+
+// Ring of tasks. The owner pushes and pops at bottom, thieves take from top.
+// A lock per deque keeps it simple; contention is only between the owner
+// and the occasional thief.
+typedef struct {
+    pthread_mutex_t lock;
+    SchedulerTask tasks[SCHEDULER_DEQUE_SIZE];
+    long top;
+    long bottom;
+} TaskDeque;
+
+typedef struct {
+    int thread_count;   // including the calling thread
+    int started;        // pool threads actually created, for joining
+    int running;
+    TaskDeque* deques;  // [0] is shared by threads outside the pool
+    pthread_t* threads;
+
+    // Idle workers sleep until the epoch moves
+    pthread_mutex_t idle_lock;
+    pthread_cond_t idle_cond;
+    unsigned long epoch;
+    int sleepers;
+    int stop;
+} Scheduler;
+
+static Scheduler _scheduler = {
+    .idle_lock = PTHREAD_MUTEX_INITIALIZER,
+    .idle_cond = PTHREAD_COND_INITIALIZER,
+};
+static pthread_mutex_t _scheduler_init_lock = PTHREAD_MUTEX_INITIALIZER;
+static int _deterministic = 0;
+
+// Deque of the current thread: 1..N-1 for pool workers, 0 for anyone else
+static _Thread_local int _worker_index = 0;
+static _Thread_local int _run_inline = 0;
+
+static int _deque_push(TaskDeque* d, SchedulerTask* t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom - d->top < SCHEDULER_DEQUE_SIZE;
+    if (ok) {
+        d->tasks[d->bottom % SCHEDULER_DEQUE_SIZE] = *t;
+        d->bottom++;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int _deque_pop(TaskDeque* d, SchedulerTask* t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom > d->top;
+    if (ok) {
+        d->bottom--;
+        *t = d->tasks[d->bottom % SCHEDULER_DEQUE_SIZE];
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static int _deque_steal(TaskDeque* d, SchedulerTask* t) {
+    pthread_mutex_lock(&d->lock);
+    int ok = d->bottom > d->top;
+    if (ok) {
+        *t = d->tasks[d->top % SCHEDULER_DEQUE_SIZE];
+        d->top++;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return ok;
+}
+
+static void _notify_idle() {
+    __atomic_fetch_add(&_scheduler.epoch, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&_scheduler.sleepers, __ATOMIC_SEQ_CST) > 0) {
+        pthread_mutex_lock(&_scheduler.idle_lock);
+        pthread_cond_broadcast(&_scheduler.idle_cond);
+        pthread_mutex_unlock(&_scheduler.idle_lock);
+    }
+}
+
+// Own deque first (newest, cache warm work), then steal the oldest task of
+// the others starting after ourselves so thieves spread out.
+static int _find_task(SchedulerTask* t) {
+    int self = _worker_index;
+    if (_deque_pop(&_scheduler.deques[self], t)) {
+        return 1;
+    }
+    for (int k = 1; k < _scheduler.thread_count; k++) {
+        int victim = (self + k) % _scheduler.thread_count;
+        if (_deque_steal(&_scheduler.deques[victim], t)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Split off the upper half onto our deque until the chunk is down to grain,
+// then run it. Thieves pick up the halves, largest first.
+static void _run_task(SchedulerTask t) {
+    TaskDeque* own = &_scheduler.deques[_worker_index];
+    while (t.end - t.begin > t.grain) {
+        SchedulerTask right = t;
+        right.begin = t.begin + (t.end - t.begin) / 2;
+        if (!_deque_push(own, &right)) {
+            break;  // deque full: run the rest here
+        }
+        t.end = right.begin;
+        _notify_idle();
+    }
+    t.fn(t.ctx, t.begin, t.end);
+    __atomic_fetch_sub(t.remaining, (long)(t.end - t.begin), __ATOMIC_RELEASE);
+}
+
+static void* _worker_main(void* arg) {
+    _worker_index = (int)(long)arg;
+    int idle = 0;
+    for (;;) {
+        unsigned long epoch = __atomic_load_n(&_scheduler.epoch, __ATOMIC_SEQ_CST);
+        SchedulerTask t;
+        if (_find_task(&t)) {
+            _run_task(t);
+            idle = 0;
+            continue;
+        }
+        if (++idle < SCHEDULER_IDLE_SPINS) {
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&_scheduler.idle_lock);
+        __atomic_fetch_add(&_scheduler.sleepers, 1, __ATOMIC_SEQ_CST);
+        while (!_scheduler.stop &&
+               __atomic_load_n(&_scheduler.epoch, __ATOMIC_SEQ_CST) == epoch) {
+            pthread_cond_wait(&_scheduler.idle_cond, &_scheduler.idle_lock);
+        }
+        __atomic_fetch_sub(&_scheduler.sleepers, 1, __ATOMIC_SEQ_CST);
+        int stop = _scheduler.stop;
+        pthread_mutex_unlock(&_scheduler.idle_lock);
+        if (stop) {
+            break;
+        }
+        idle = 0;
+    }
+    return NULL;
+}
+
+static void _scheduler_stop_locked() {
+    if (!_scheduler.running) {
+        return;
+    }
+    pthread_mutex_lock(&_scheduler.idle_lock);
+    _scheduler.stop = 1;
+    pthread_cond_broadcast(&_scheduler.idle_cond);
+    pthread_mutex_unlock(&_scheduler.idle_lock);
+
+    for (int w = 1; w <= _scheduler.started; w++) {
+        pthread_join(_scheduler.threads[w], NULL);
+    }
+    for (int d = 0; d < _scheduler.thread_count; d++) {
+        pthread_mutex_destroy(&_scheduler.deques[d].lock);
+    }
+    free(_scheduler.deques);
+    free(_scheduler.threads);
+    _scheduler.deques = NULL;
+    _scheduler.threads = NULL;
+    _scheduler.thread_count = 0;
+    _scheduler.started = 0;
+    __atomic_store_n(&_scheduler.running, 0, __ATOMIC_RELEASE);
+    _scheduler.stop = 0;
+}
+
+static int _scheduler_start_locked(int threads) {
+    if (threads <= 0) {
+        long cores = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cores > 0 ? (int)cores : 1;
+    }
+
+    _scheduler.deques = calloc(threads, sizeof(TaskDeque));
+    _scheduler.threads = calloc(threads, sizeof(pthread_t));
+    if (_scheduler.deques == NULL || _scheduler.threads == NULL) {
+        perror("Error Allocating memory for scheduler.\n");
+        free(_scheduler.deques);
+        free(_scheduler.threads);
+        _scheduler.deques = NULL;
+        _scheduler.threads = NULL;
+        return 0;
+    }
+    for (int d = 0; d < threads; d++) {
+        pthread_mutex_init(&_scheduler.deques[d].lock, NULL);
+    }
+
+    // A worker that fails to start leaves an empty deque behind, which is
+    // harmless: only its owner would ever push to it
+    _scheduler.thread_count = threads;
+    _scheduler.started = 0;
+    for (int w = 1; w < threads; w++) {
+        if (pthread_create(&_scheduler.threads[w], NULL, _worker_main,
+                           (void*)(long)w) != 0) {
+            perror("Error starting scheduler thread.\n");
+            break;
+        }
+        _scheduler.started = w;
+    }
+    __atomic_store_n(&_scheduler.running, 1, __ATOMIC_RELEASE);
+    return _scheduler.thread_count;
+}
+
+int scheduler_init(int threads) {
+    pthread_mutex_lock(&_scheduler_init_lock);
+    _scheduler_stop_locked();
+    int count = _scheduler_start_locked(threads);
+    pthread_mutex_unlock(&_scheduler_init_lock);
+    return count;
+}
+
+void scheduler_shutdown() {
+    pthread_mutex_lock(&_scheduler_init_lock);
+    _scheduler_stop_locked();
+    pthread_mutex_unlock(&_scheduler_init_lock);
+}
+
+int scheduler_thread_count() {
+    if (!__atomic_load_n(&_scheduler.running, __ATOMIC_ACQUIRE)) {
+        return scheduler_init(0);
+    }
+    return _scheduler.thread_count;
+}
+
+int scheduler_run_inline(int enable) {
+    int previous = _run_inline;
+    _run_inline = enable;
+    return previous;
+}
+
+int scheduler_set_deterministic(int enable) {
+    return __atomic_exchange_n(&_deterministic, enable != 0, __ATOMIC_SEQ_CST);
+}
+
+int scheduler_deterministic() {
+    return __atomic_load_n(&_deterministic, __ATOMIC_SEQ_CST);
+}
+
+void parallel_for(int begin, int end, int grain, ParallelForFunction fn,
+                  void* ctx) {
+    if (end <= begin) {
+        return;
+    }
+    if (grain < 1) {
+        grain = 1;
+    }
+    if (_run_inline || end - begin <= grain) {
+        fn(ctx, begin, end);
+        return;
+    }
+    if (!__atomic_load_n(&_scheduler.running, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&_scheduler_init_lock);
+        if (!_scheduler.running) {
+            _scheduler_start_locked(0);
+        }
+        pthread_mutex_unlock(&_scheduler_init_lock);
+    }
+    if (_scheduler.thread_count <= 1) {
+        fn(ctx, begin, end);
+        return;
+    }
+
+    long remaining = end - begin;
+    SchedulerTask root = {fn, ctx, begin, end, grain, &remaining};
+    _run_task(root);
+
+    // Help with whatever is queued until our own region is finished. Tasks
+    // of other regions are fair game, they finish in bounded time as well.
+    while (__atomic_load_n(&remaining, __ATOMIC_ACQUIRE) > 0) {
+        SchedulerTask t;
+        if (_find_task(&t)) {
+            _run_task(t);
+        } else {
+            sched_yield();
+        }
+    }
+}
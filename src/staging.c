@@ -0,0 +1,248 @@
+#include "../include/staging.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+typedef struct {
+    Matrix* inputs;
+    Matrix* targets;    // NULL without targets
+    int columns;
+} StagingSlot;
+
+struct BatchStager {
+    BatchProducer produce;
+    void* ctx;
+    int batch_size;
+
+    StagingSlot* slots;
+    int depth;
+
+    // Batches consumed..produced-1 are staged in slots [k % depth], the one
+    // the caller holds included. Both counters only grow.
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long produced;
+    long consumed;
+    int held;           // the caller holds slots[consumed % depth]
+    int done;           // producer returned 0 or -1
+    int failed;
+    int stop;
+
+    double wait_seconds;
+    pthread_t thread;
+};
+
+static double _now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Pack a short batch so it is a proper (rows x count) matrix
+static void _compact_columns(Matrix* m, int count) {
+    if (m == NULL || count == m->columns) {
+        return;
+    }
+    for (int r = 1; r < m->rows; r++) {
+        memmove(m->data + r * count, m->data + r * m->columns,
+                sizeof(float) * count);
+    }
+    m->columns = count;
+}
+
+static void* _stager_main(void* arg) {
+    BatchStager* s = (BatchStager*)arg;
+
+    for (;;) {
+        pthread_mutex_lock(&s->lock);
+        while (!s->stop && s->produced - s->consumed == s->depth) {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+        if (s->stop) {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+        StagingSlot* slot = &s->slots[s->produced % s->depth];
+        pthread_mutex_unlock(&s->lock);
+
+        // Filled outside the lock, the caller never touches this slot
+        slot->inputs->columns = s->batch_size;
+        if (slot->targets != NULL) {
+            slot->targets->columns = s->batch_size;
+        }
+        int count = s->produce(s->ctx, slot->inputs, slot->targets);
+        if (count > s->batch_size) {
+            count = s->batch_size;
+        }
+        if (count > 0) {
+            _compact_columns(slot->inputs, count);
+            _compact_columns(slot->targets, count);
+            slot->columns = count;
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (count > 0) {
+            s->produced++;
+        } else {
+            s->done = 1;
+            s->failed = count < 0;
+        }
+        pthread_cond_broadcast(&s->changed);
+        pthread_mutex_unlock(&s->lock);
+        if (count <= 0) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void _free_slots(BatchStager* s) {
+    for (int k = 0; k < s->depth; k++) {
+        free_matrix(s->slots[k].inputs);
+        free_matrix(s->slots[k].targets);
+    }
+    free(s->slots);
+}
+
+BatchStager* create_batch_stager(int input_rows, int target_rows, int batch_size,
+                                 int depth, BatchProducer produce, void* ctx) {
+    if (input_rows <= 0 || target_rows < 0 || batch_size <= 0 || produce == NULL) {
+        fprintf(stderr, "Error: invalid arguments to create_batch_stager\n");
+        return NULL;
+    }
+    if (depth < 2) {
+        depth = 2;
+    }
+
+    BatchStager* s = calloc(1, sizeof(BatchStager));
+    if (s == NULL) {
+        perror("Error Allocating memory for batch stager.\n");
+        return NULL;
+    }
+    s->produce = produce;
+    s->ctx = ctx;
+    s->batch_size = batch_size;
+    s->depth = depth;
+    s->slots = calloc(depth, sizeof(StagingSlot));
+    if (s->slots == NULL) {
+        perror("Error Allocating memory for batch stager.\n");
+        free(s);
+        return NULL;
+    }
+    for (int k = 0; k < depth; k++) {
+        s->slots[k].inputs = create_matrix(input_rows, batch_size);
+        s->slots[k].targets =
+            target_rows > 0 ? create_matrix(target_rows, batch_size) : NULL;
+        if (s->slots[k].inputs == NULL ||
+            (target_rows > 0 && s->slots[k].targets == NULL)) {
+            _free_slots(s);
+            free(s);
+            return NULL;
+        }
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    if (pthread_create(&s->thread, NULL, _stager_main, s) != 0) {
+        perror("Error starting staging thread.\n");
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->changed);
+        _free_slots(s);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void free_batch_stager(BatchStager* s) {
+    if (s == NULL) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->changed);
+    _free_slots(s);
+    free(s);
+}
+
+int batch_stager_next(BatchStager* s, Matrix** inputs, Matrix** targets) {
+    if (s == NULL) return -1;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->held) {
+        s->held = 0;
+        s->consumed++;
+        pthread_cond_broadcast(&s->changed);
+    }
+
+    double start = _now_seconds();
+    int waited = 0;
+    while (s->produced == s->consumed && !s->done) {
+        waited = 1;
+        pthread_cond_wait(&s->changed, &s->lock);
+    }
+    if (waited) {
+        s->wait_seconds += _now_seconds() - start;
+    }
+
+    int columns = 0;
+    if (s->produced > s->consumed) {
+        StagingSlot* slot = &s->slots[s->consumed % s->depth];
+        s->held = 1;
+        columns = slot->columns;
+        if (inputs != NULL) *inputs = slot->inputs;
+        if (targets != NULL) *targets = slot->targets;
+    } else if (s->failed) {
+        columns = -1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return columns;
+}
+
+void batch_stager_release(BatchStager* s) {
+    if (s == NULL) return;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->held) {
+        s->held = 0;
+        s->consumed++;
+        pthread_cond_broadcast(&s->changed);
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+double batch_stager_wait_seconds(BatchStager* s) {
+    if (s == NULL) return 0.0;
+
+    pthread_mutex_lock(&s->lock);
+    double seconds = s->wait_seconds;
+    pthread_mutex_unlock(&s->lock);
+    return seconds;
+}
+
+int train_network_staged(Network* n, BatchStager* s, float learning_rate) {
+    if (n == NULL || s == NULL) return 0;
+
+    int samples = 0;
+    Matrix* inputs;
+    Matrix* targets;
+    int columns;
+    while ((columns = batch_stager_next(s, &inputs, &targets)) > 0) {
+        if (targets == NULL) {
+            fprintf(stderr, "Error: stager has no targets to train on\n");
+            batch_stager_release(s);
+            return samples;
+        }
+        train_network(n, inputs, targets, learning_rate);
+        batch_stager_release(s);
+        samples += columns;
+    }
+    return samples;
+}
@@ -0,0 +1,510 @@
+#ifdef __linux__
+#define _GNU_SOURCE // O_DIRECT
+#endif
+
+#include "../include/stream.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Default read size: large enough that a disk streams at full speed, small
+// enough that a few of them in flight are cheap
+#define STREAM_CHUNK_BYTES (4 << 20)
+#define STREAM_PREFETCH 4
+#define STREAM_WINDOW_CHUNKS 4
+// O_DIRECT offsets, sizes and buffers must be multiples of the device's
+// logical block size, which 4096 covers
+#define STREAM_DIRECT_ALIGN 4096
+
+typedef struct {
+    unsigned char* input_buffer;
+    unsigned char* target_buffer;
+    const unsigned char* inputs;    // the chunk's samples within the buffers
+    const unsigned char* targets;
+    int count;
+    int last;                       // last chunk of its epoch
+} StreamChunk;
+
+struct DatasetStream {
+    DatasetCacheLayout layout;
+    int fd;
+    int direct;
+    size_t sample_bytes;
+    size_t target_bytes;    // per sample: an int32 label, dense floats or 0
+    int batch_size;
+    int shuffle;
+
+    // Chunks consumed..produced-1 are read into ring[k % prefetch], the one
+    // the producer drains included. Both counters only grow.
+    int chunk_samples;
+    int chunk_count;
+    int* chunk_order;
+    unsigned long long reader_rng;
+    StreamChunk* ring;
+    int prefetch;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    long produced;
+    long consumed;
+    int failed;
+    int stop;
+    double wait_seconds;
+    pthread_t thread;
+
+    // Producer side. slots is a permutation of the window's slot numbers;
+    // the first filled of them hold samples.
+    StreamChunk* current;   // ring[consumed % prefetch] while drained
+    int position;
+    int epoch_over;         // no more chunks in this epoch
+    int capacity;
+    int filled;
+    unsigned char* window_inputs;
+    unsigned char* window_targets;
+    int* slots;
+    Dataset view;           // the window, for dataset_gather
+    unsigned long long rng;
+};
+
+static double _now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// splitmix64
+static uint64_t _next_random(unsigned long long* state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, n)
+static int _random_below(unsigned long long* state, int n) {
+    return (int)(((_next_random(state) >> 32) * (uint64_t)n) >> 32);
+}
+
+static size_t _value_size(DatasetType type) {
+    return type == DATASET_FLOAT16 ? 2 : type == DATASET_UINT8 ? 1 : 4;
+}
+
+// Reads size bytes at offset into buffer and returns where they start in
+// it. Direct reads take the enclosing aligned blocks. NULL on error.
+static const unsigned char* _read_range(DatasetStream* s, uint64_t offset,
+                                        size_t size, unsigned char* buffer) {
+    uint64_t start = offset;
+    uint64_t end = offset + size;
+    if (s->direct) {
+        start &= ~(uint64_t)(STREAM_DIRECT_ALIGN - 1);
+        end = (end + STREAM_DIRECT_ALIGN - 1) & ~(uint64_t)(STREAM_DIRECT_ALIGN - 1);
+    }
+    size_t want = (size_t)(end - start);
+    size_t done = 0;
+    while (done < want) {
+        ssize_t n = pread(s->fd, buffer + done, want - done, (off_t)(start + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;  // the aligned tail may run past the end of the file
+        }
+        done += (size_t)n;
+    }
+    if (done < (size_t)(offset - start) + size) {
+        return NULL;
+    }
+    return buffer + (offset - start);
+}
+
+// Reads chunk k into c. Returns 0 or -1.
+static int _read_chunk(DatasetStream* s, int k, StreamChunk* c) {
+    int first = k * s->chunk_samples;
+    int count = s->layout.count - first < s->chunk_samples
+                    ? s->layout.count - first
+                    : s->chunk_samples;
+    c->inputs = _read_range(s, s->layout.inputs_offset + (uint64_t)first * s->sample_bytes,
+                            (size_t)count * s->sample_bytes, c->input_buffer);
+    if (c->inputs == NULL) {
+        fprintf(stderr, "Error: could not read samples %d..%d of the stream\n",
+                first, first + count - 1);
+        return -1;
+    }
+    if (s->target_bytes > 0) {
+        c->targets = _read_range(s, s->layout.targets_offset + (uint64_t)first * s->target_bytes,
+                                 (size_t)count * s->target_bytes, c->target_buffer);
+        if (c->targets == NULL) {
+            fprintf(stderr, "Error: could not read targets %d..%d of the stream\n",
+                    first, first + count - 1);
+            return -1;
+        }
+    }
+    if (s->layout.has_labels) {
+        const int32_t* labels = (const int32_t*)c->targets;
+        for (int i = 0; i < count; i++) {
+            if (labels[i] < 0 || labels[i] >= s->layout.target_size) {
+                fprintf(stderr, "Error: the stream has label %d for sample %d\n",
+                        labels[i], first + i);
+                return -1;
+            }
+        }
+    }
+    c->count = count;
+    return 0;
+}
+
+static void* _reader_main(void* arg) {
+    DatasetStream* s = (DatasetStream*)arg;
+
+    // Epoch after epoch until stopped; the ring bounds how far ahead
+    for (;;) {
+        if (s->shuffle) {
+            for (int i = s->chunk_count - 1; i > 0; i--) {
+                int j = _random_below(&s->reader_rng, i + 1);
+                int tmp = s->chunk_order[i];
+                s->chunk_order[i] = s->chunk_order[j];
+                s->chunk_order[j] = tmp;
+            }
+        }
+        for (int k = 0; k < s->chunk_count; k++) {
+            pthread_mutex_lock(&s->lock);
+            while (!s->stop && s->produced - s->consumed == s->prefetch) {
+                pthread_cond_wait(&s->changed, &s->lock);
+            }
+            if (s->stop) {
+                pthread_mutex_unlock(&s->lock);
+                return NULL;
+            }
+            StreamChunk* c = &s->ring[s->produced % s->prefetch];
+            pthread_mutex_unlock(&s->lock);
+
+            // Read outside the lock, the producer never touches this chunk
+            int ok = _read_chunk(s, s->chunk_order[k], c) == 0;
+            c->last = k == s->chunk_count - 1;
+
+            pthread_mutex_lock(&s->lock);
+            if (ok) {
+                s->produced++;
+            } else {
+                s->failed = 1;
+            }
+            pthread_cond_broadcast(&s->changed);
+            pthread_mutex_unlock(&s->lock);
+            if (!ok) {
+                return NULL;
+            }
+        }
+    }
+}
+
+// Next sample of the epoch into window slot. Returns 1, 0 at the end of the
+// epoch or -1 if reading failed.
+static int _take_sample(DatasetStream* s, int slot) {
+    if (s->epoch_over) {
+        return 0;
+    }
+    while (s->current == NULL || s->position == s->current->count) {
+        if (s->current != NULL) {
+            int last = s->current->last;
+            pthread_mutex_lock(&s->lock);
+            s->consumed++;
+            pthread_cond_broadcast(&s->changed);
+            pthread_mutex_unlock(&s->lock);
+            s->current = NULL;
+            if (last) {
+                s->epoch_over = 1;
+                return 0;
+            }
+        }
+
+        pthread_mutex_lock(&s->lock);
+        if (s->produced == s->consumed && !s->failed) {
+            double start = _now_seconds();
+            while (s->produced == s->consumed && !s->failed) {
+                pthread_cond_wait(&s->changed, &s->lock);
+            }
+            s->wait_seconds += _now_seconds() - start;
+        }
+        if (s->produced > s->consumed) {
+            s->current = &s->ring[s->consumed % s->prefetch];
+        }
+        pthread_mutex_unlock(&s->lock);
+        if (s->current == NULL) {
+            return -1;
+        }
+        s->position = 0;
+    }
+
+    memcpy(s->window_inputs + (size_t)slot * s->sample_bytes,
+           s->current->inputs + (size_t)s->position * s->sample_bytes,
+           s->sample_bytes);
+    if (s->target_bytes > 0) {
+        memcpy(s->window_targets + (size_t)slot * s->target_bytes,
+               s->current->targets + (size_t)s->position * s->target_bytes,
+               s->target_bytes);
+    }
+    s->position++;
+    return 1;
+}
+
+// Moves slots [from, from + count) to [to, to + count)
+static void _move_slots(DatasetStream* s, int from, int to, int count) {
+    memmove(s->window_inputs + (size_t)to * s->sample_bytes,
+            s->window_inputs + (size_t)from * s->sample_bytes,
+            (size_t)count * s->sample_bytes);
+    if (s->target_bytes > 0) {
+        memmove(s->window_targets + (size_t)to * s->target_bytes,
+                s->window_targets + (size_t)from * s->target_bytes,
+                (size_t)count * s->target_bytes);
+    }
+}
+
+int dataset_stream_produce_batch(void* ctx, Matrix* inputs, Matrix* targets) {
+    DatasetStream* s = (DatasetStream*)ctx;
+    if (s == NULL || inputs == NULL) return -1;
+
+    while (s->filled < s->capacity) {
+        int taken = _take_sample(s, s->slots[s->filled]);
+        if (taken < 0) {
+            return -1;
+        }
+        if (taken == 0) {
+            break;
+        }
+        s->filled++;
+    }
+    if (s->filled == 0) {
+        s->epoch_over = 0;  // the next call starts the next epoch
+        return 0;
+    }
+
+    int count = inputs->columns < s->batch_size ? inputs->columns
+                                                : s->batch_size;
+    count = count < s->filled ? count : s->filled;
+    if (s->shuffle) {
+        // A random draw from the window. Only slot numbers move.
+        for (int b = 0; b < count; b++) {
+            int j = b + _random_below(&s->rng, s->filled - b);
+            int tmp = s->slots[b];
+            s->slots[b] = s->slots[j];
+            s->slots[j] = tmp;
+        }
+    }
+    s->view.count = s->capacity;
+    if (dataset_gather(&s->view, s->slots, count, inputs, targets) != 0) {
+        return -1;
+    }
+
+    if (!s->shuffle) {
+        // File order: the rest shifts down, slots stay in order
+        _move_slots(s, count, 0, s->filled - count);
+        s->filled -= count;
+        return count;
+    }
+    // Shuffled: new samples go straight into the used slots. Once the epoch
+    // runs dry a used slot swaps with the last one in use instead, going
+    // backwards so that one is never a used slot still to be handled.
+    for (int b = count - 1; b >= 0; b--) {
+        int taken = _take_sample(s, s->slots[b]);
+        if (taken < 0) {
+            return -1;
+        }
+        if (taken == 0) {
+            s->filled--;
+            int tmp = s->slots[b];
+            s->slots[b] = s->slots[s->filled];
+            s->slots[s->filled] = tmp;
+        }
+    }
+    return count;
+}
+
+// Everything but the thread and its lock
+static void _free_buffers(DatasetStream* s) {
+    if (s->ring != NULL) {
+        for (int k = 0; k < s->prefetch; k++) {
+            free(s->ring[k].input_buffer);
+            free(s->ring[k].target_buffer);
+        }
+        free(s->ring);
+    }
+    free(s->chunk_order);
+    free(s->window_inputs);
+    free(s->window_targets);
+    free(s->slots);
+    if (s->fd >= 0) {
+        close(s->fd);
+    }
+}
+
+static unsigned char* _alloc_aligned(size_t size) {
+    void* p = NULL;
+    if (size == 0 || posix_memalign(&p, STREAM_DIRECT_ALIGN, size) != 0) {
+        return NULL;
+    }
+    return p;
+}
+
+// Opens the file, with O_DIRECT if asked and the filesystem takes it.
+// Returns 0 or -1.
+static int _open_stream(DatasetStream* s, const char* path, int direct) {
+#ifdef O_DIRECT
+    if (direct) {
+        s->fd = open(path, O_RDONLY | O_DIRECT);
+        if (s->fd >= 0) {
+            s->direct = 1;
+            return 0;
+        }
+    }
+#else
+    (void)direct;
+#endif
+    s->fd = open(path, O_RDONLY);
+    if (s->fd < 0) {
+        fprintf(stderr, "Error: could not open %s\n", path);
+        return -1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(s->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    return 0;
+}
+
+DatasetStream* create_dataset_stream(const char* path, int batch_size,
+                                     int shuffle, unsigned int seed,
+                                     const DatasetStreamOptions* options) {
+    if (path == NULL || batch_size < 1) {
+        fprintf(stderr, "Error: dataset stream needs a file and a batch size\n");
+        return NULL;
+    }
+    DatasetStreamOptions o;
+    memset(&o, 0, sizeof(o));
+    if (options != NULL) {
+        o = *options;
+    }
+
+    DatasetStream* s = calloc(1, sizeof(DatasetStream));
+    if (s == NULL) {
+        perror("Error Allocating memory for dataset stream.\n");
+        return NULL;
+    }
+    s->fd = -1;
+    if (dataset_cache_layout(path, &s->layout) != 0 ||
+        _open_stream(s, path, o.direct) != 0) {
+        _free_buffers(s);
+        free(s);
+        return NULL;
+    }
+
+    const DatasetCacheLayout* l = &s->layout;
+    s->batch_size = batch_size;
+    s->shuffle = shuffle;
+    s->sample_bytes = _value_size(l->type) * (size_t)l->features;
+    s->target_bytes = l->has_labels ? sizeof(int32_t)
+                                    : sizeof(float) * (size_t)l->target_size;
+    s->chunk_samples = o.chunk_samples > 0
+                           ? o.chunk_samples
+                           : (int)(STREAM_CHUNK_BYTES / s->sample_bytes);
+    s->chunk_samples = s->chunk_samples < 1 ? 1
+                       : s->chunk_samples > l->count ? l->count
+                       : s->chunk_samples;
+    s->chunk_count = (l->count + s->chunk_samples - 1) / s->chunk_samples;
+    s->prefetch = o.prefetch > 0 ? o.prefetch : STREAM_PREFETCH;
+    s->capacity = !shuffle ? batch_size
+                  : o.window > 0 ? o.window
+                  : STREAM_WINDOW_CHUNKS * s->chunk_samples;
+    s->capacity = s->capacity < batch_size ? batch_size : s->capacity;
+    s->rng = seed;
+    s->reader_rng = (unsigned long long)seed ^ 0x5DEECE66DULL;
+
+    // Room for a chunk plus the aligned blocks around it
+    size_t slack = s->direct ? 2 * STREAM_DIRECT_ALIGN : 0;
+    size_t input_capacity = (size_t)s->chunk_samples * s->sample_bytes + slack;
+    size_t target_capacity = (size_t)s->chunk_samples * s->target_bytes + slack;
+    s->ring = calloc(s->prefetch, sizeof(StreamChunk));
+    s->chunk_order = malloc(sizeof(int) * s->chunk_count);
+    s->window_inputs = malloc(s->sample_bytes * s->capacity);
+    s->window_targets = s->target_bytes > 0
+                            ? malloc(s->target_bytes * s->capacity)
+                            : NULL;
+    s->slots = malloc(sizeof(int) * s->capacity);
+    int ok = s->ring != NULL && s->chunk_order != NULL &&
+             s->window_inputs != NULL && s->slots != NULL &&
+             (s->target_bytes == 0 || s->window_targets != NULL);
+    for (int k = 0; ok && k < s->prefetch; k++) {
+        s->ring[k].input_buffer = _alloc_aligned(input_capacity);
+        s->ring[k].target_buffer =
+            s->target_bytes > 0 ? _alloc_aligned(target_capacity) : NULL;
+        ok = s->ring[k].input_buffer != NULL &&
+             (s->target_bytes == 0 || s->ring[k].target_buffer != NULL);
+    }
+    if (!ok) {
+        perror("Error Allocating memory for dataset stream.\n");
+        _free_buffers(s);
+        free(s);
+        return NULL;
+    }
+    for (int k = 0; k < s->chunk_count; k++) {
+        s->chunk_order[k] = k;
+    }
+    for (int k = 0; k < s->capacity; k++) {
+        s->slots[k] = k;
+    }
+
+    s->view.features = l->features;
+    s->view.target_size = l->target_size;
+    s->view.type = l->type;
+    s->view.inputs = s->window_inputs;
+    s->view.scale = l->scale;
+    s->view.offset = l->offset;
+    if (l->has_labels) {
+        s->view.labels = (int32_t*)s->window_targets;
+    } else if (l->target_size > 0) {
+        s->view.targets = (float*)s->window_targets;
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->changed, NULL);
+    if (pthread_create(&s->thread, NULL, _reader_main, s) != 0) {
+        perror("Error starting stream reader thread.\n");
+        pthread_mutex_destroy(&s->lock);
+        pthread_cond_destroy(&s->changed);
+        _free_buffers(s);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void free_dataset_stream(DatasetStream* s) {
+    if (s == NULL) return;
+
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->thread, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->changed);
+    _free_buffers(s);
+    free(s);
+}
+
+const DatasetCacheLayout* dataset_stream_layout(const DatasetStream* s) {
+    return s != NULL ? &s->layout : NULL;
+}
+
+double dataset_stream_wait_seconds(DatasetStream* s) {
+    if (s == NULL) return 0.0;
+    pthread_mutex_lock(&s->lock);
+    double seconds = s->wait_seconds;
+    pthread_mutex_unlock(&s->lock);
+    return seconds;
+}
@@ -0,0 +1,669 @@
+#include "../include/trainer.h"
+#include "../include/scheduler.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// pthread_barrier_t is missing on macOS, so a generation counted one is used
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+    int waiting;
+    unsigned int generation;
+} TrainerBarrier;
+
+static void _barrier_init(TrainerBarrier* b, int count) {
+    pthread_mutex_init(&b->lock, NULL);
+    pthread_cond_init(&b->cond, NULL);
+    b->count = count;
+    b->waiting = 0;
+    b->generation = 0;
+}
+
+static void _barrier_destroy(TrainerBarrier* b) {
+    pthread_mutex_destroy(&b->lock);
+    pthread_cond_destroy(&b->cond);
+}
+
+static void _barrier_wait(TrainerBarrier* b) {
+    pthread_mutex_lock(&b->lock);
+    unsigned int generation = b->generation;
+    if (++b->waiting == b->count) {
+        b->waiting = 0;
+        b->generation++;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (generation == b->generation) {
+            pthread_cond_wait(&b->cond, &b->lock);
+        }
+    }
+    pthread_mutex_unlock(&b->lock);
+}
+
+// One weights or bias matrix, placed in the flattened parameter space
+typedef struct {
+    int layer;
+    int is_bias;
+    long offset;
+    long length;
+} ParamSegment;
+
+typedef struct {
+    DataParallelTrainer* trainer;
+    int index;
+    Layer** layers;     // worker 0 uses the network's own layers
+    float loss;
+    pthread_t thread;
+} TrainerWorker;
+
+struct DataParallelTrainer {
+    Network* network;
+    int thread_count;
+    TrainerWorker* workers;
+    TrainerBarrier barrier;
+
+    ParamSegment* segments;
+    int segment_count;
+    long param_count;
+
+    // Deterministic mode: per-shard gradients, TRAINER_DETERMINISTIC_SHARDS
+    // blocks of param_count floats, allocated on the first such step
+    int deterministic;
+    float* shard_grads;
+    float shard_loss[TRAINER_DETERMINISTIC_SHARDS];
+
+    // Current step, published to the workers by the start barrier
+    Matrix* inputs;
+    Matrix* targets;
+    float learning_rate;
+    int stop;
+};
+
+static Matrix* _copy_columns(Matrix* m, int first, int count) {
+    Matrix* out = create_matrix(m->rows, count);
+    if (out == NULL) {
+        return NULL;
+    }
+    for (int r = 0; r < m->rows; r++) {
+        memcpy(out->data + r * count, m->data + r * m->columns + first,
+               sizeof(float) * count);
+    }
+    return out;
+}
+
+static Matrix* _segment_grad(TrainerWorker* w, ParamSegment* s) {
+    Layer* l = w->layers[s->layer];
+    return s->is_bias ? l->d_bias : l->d_weight;
+}
+
+// Forward and backward on columns [first, last) with learning rate 0, which
+// leaves the gradient of those columns in the layers' d_weight/d_bias.
+// Returns their summed squared error.
+static float _shard_gradients(TrainerWorker* w, int first, int last) {
+    DataParallelTrainer* t = w->trainer;
+    int layer_count = t->network->layer_count;
+    float loss = 0.0f;
+
+    if (last == first) {
+        for (int s = 0; s < t->segment_count; s++) {
+            zero_matrix(_segment_grad(w, &t->segments[s]));
+        }
+        return loss;
+    }
+
+    Matrix* out = _copy_columns(t->inputs, first, last - first);
+    for (int i = 0; i < layer_count && out != NULL; i++) {
+        Matrix* next = layer_forward(w->layers[i], out);
+        free_matrix(out);
+        out = next;
+    }
+    Matrix* target = _copy_columns(t->targets, first, last - first);
+    Matrix* gradient = (out != NULL && target != NULL)
+                           ? subtract_matrix(out, target)
+                           : NULL;
+    free_matrix(out);
+    free_matrix(target);
+
+    if (gradient != NULL) {
+        int count = gradient->rows * gradient->columns;
+        for (int i = 0; i < count; i++) {
+            loss += gradient->data[i] * gradient->data[i];
+        }
+    }
+
+    for (int i = layer_count - 1; i >= 0 && gradient != NULL; i--) {
+        Matrix* next = layer_backward(w->layers[i], gradient, 0.0f);
+        free_matrix(gradient);
+        gradient = next;
+    }
+    free_matrix(gradient);
+    return loss;
+}
+
+// Fast mode splits the batch into one shard per worker. Deterministic mode
+// always cuts it into TRAINER_DETERMINISTIC_SHARDS shards, dealt round-robin
+// to the workers, and keeps every shard's gradient for the reduction tree.
+// A shard's gradient doesn't depend on which worker computed it.
+static void _worker_gradients(TrainerWorker* w) {
+    DataParallelTrainer* t = w->trainer;
+    int batch = t->inputs->columns;
+
+    if (!t->deterministic) {
+        int first = (int)((long)batch * w->index / t->thread_count);
+        int last = (int)((long)batch * (w->index + 1) / t->thread_count);
+        w->loss = _shard_gradients(w, first, last);
+        return;
+    }
+
+    for (int k = w->index; k < TRAINER_DETERMINISTIC_SHARDS;
+         k += t->thread_count) {
+        int first = (int)((long)batch * k / TRAINER_DETERMINISTIC_SHARDS);
+        int last = (int)((long)batch * (k + 1) / TRAINER_DETERMINISTIC_SHARDS);
+        t->shard_loss[k] = _shard_gradients(w, first, last);
+
+        float* shard = t->shard_grads + k * t->param_count;
+        for (int s = 0; s < t->segment_count; s++) {
+            ParamSegment* seg = &t->segments[s];
+            memcpy(shard + seg->offset, _segment_grad(w, seg)->data,
+                   sizeof(float) * seg->length);
+        }
+    }
+}
+
+// Part of seg inside the flattened range [begin, end), in segment
+// coordinates. Returns 0 if they don't overlap.
+static int _segment_range(ParamSegment* seg, long begin, long end, long* lo,
+                          long* hi) {
+    *lo = begin > seg->offset ? begin : seg->offset;
+    *hi = end < seg->offset + seg->length ? end : seg->offset + seg->length;
+    if (*lo >= *hi) {
+        return 0;
+    }
+    *lo -= seg->offset;
+    *hi -= seg->offset;
+    return 1;
+}
+
+// Reduce-scatter: each worker owns a slice of the flattened parameters, sums
+// that slice over the replicas in a fixed order and applies the update. The
+// summed gradient is left in the network's own d_weight/d_bias.
+static void _worker_reduce_update(TrainerWorker* w) {
+    DataParallelTrainer* t = w->trainer;
+    long begin = t->param_count * w->index / t->thread_count;
+    long end = t->param_count * (w->index + 1) / t->thread_count;
+
+    for (int s = 0; s < t->segment_count; s++) {
+        ParamSegment* seg = &t->segments[s];
+        long lo, hi;
+        if (!_segment_range(seg, begin, end, &lo, &hi)) {
+            continue;
+        }
+
+        Layer* l = t->network->layers[seg->layer];
+        float* param = seg->is_bias ? l->bias->data : l->weights->data;
+        float* sum = _segment_grad(&t->workers[0], seg)->data;
+        for (int r = 1; r < t->thread_count; r++) {
+            const float* grad = _segment_grad(&t->workers[r], seg)->data;
+            for (long i = lo; i < hi; i++) {
+                sum[i] += grad[i];
+            }
+        }
+        for (long i = lo; i < hi; i++) {
+            param[i] -= t->learning_rate * sum[i];
+        }
+    }
+}
+
+// Deterministic reduce-scatter: the shard gradients are summed pairwise,
+// (0+1)+(2+3) and so on, in a tree that only depends on the shard count.
+// Each element is added up the same way whatever slice it falls in, so the
+// result is bitwise identical for any thread count.
+static void _worker_reduce_update_deterministic(TrainerWorker* w) {
+    DataParallelTrainer* t = w->trainer;
+    long begin = t->param_count * w->index / t->thread_count;
+    long end = t->param_count * (w->index + 1) / t->thread_count;
+    float* grads = t->shard_grads;
+
+    for (int width = 1; width < TRAINER_DETERMINISTIC_SHARDS; width *= 2) {
+        for (int k = 0; k + width < TRAINER_DETERMINISTIC_SHARDS;
+             k += 2 * width) {
+            float* dst = grads + k * t->param_count;
+            const float* src = grads + (k + width) * t->param_count;
+            for (long i = begin; i < end; i++) {
+                dst[i] += src[i];
+            }
+        }
+    }
+
+    for (int s = 0; s < t->segment_count; s++) {
+        ParamSegment* seg = &t->segments[s];
+        long lo, hi;
+        if (!_segment_range(seg, begin, end, &lo, &hi)) {
+            continue;
+        }
+
+        Layer* l = t->network->layers[seg->layer];
+        float* param = seg->is_bias ? l->bias->data : l->weights->data;
+        float* grad = seg->is_bias ? l->d_bias->data : l->d_weight->data;
+        const float* sum = grads + seg->offset;
+        for (long i = lo; i < hi; i++) {
+            grad[i] = sum[i];
+            param[i] -= t->learning_rate * sum[i];
+        }
+    }
+}
+
+static void _worker_step(TrainerWorker* w) {
+    _worker_gradients(w);
+    _barrier_wait(&w->trainer->barrier);
+    if (w->trainer->deterministic) {
+        _worker_reduce_update_deterministic(w);
+    } else {
+        _worker_reduce_update(w);
+    }
+    _barrier_wait(&w->trainer->barrier);
+}
+
+static void* _worker_main(void* arg) {
+    TrainerWorker* w = (TrainerWorker*)arg;
+    DataParallelTrainer* t = w->trainer;
+    // Every replica has a core already, don't fan out into the pool too
+    scheduler_run_inline(1);
+    for (;;) {
+        _barrier_wait(&t->barrier);
+        if (t->stop) {
+            break;
+        }
+        _worker_step(w);
+    }
+    return NULL;
+}
+
+static void _free_replicas(DataParallelTrainer* t, int from, int to) {
+    for (int r = from; r < to; r++) {
+        if (t->workers[r].layers == NULL) {
+            continue;
+        }
+        for (int i = 0; i < t->network->layer_count; i++) {
+            layer_free_replica(t->workers[r].layers[i]);
+        }
+        free(t->workers[r].layers);
+        t->workers[r].layers = NULL;
+    }
+}
+
+DataParallelTrainer* create_data_parallel_trainer(Network* n, int threads) {
+    if (n == NULL || n->layer_count == 0 || threads < 1) {
+        fprintf(stderr, "Error: data parallel trainer needs a network and at least one thread\n");
+        return NULL;
+    }
+    if (n->checkpoint_count > 0) {
+        fprintf(stderr, "Warning: checkpoints are ignored by the data parallel trainer\n");
+    }
+
+    DataParallelTrainer* t = calloc(1, sizeof(DataParallelTrainer));
+    if (t == NULL) {
+        perror("Error Allocating memory for trainer.\n");
+        return NULL;
+    }
+    t->network = n;
+    t->thread_count = threads;
+    t->workers = calloc(threads, sizeof(TrainerWorker));
+    t->segments = calloc(2 * n->layer_count, sizeof(ParamSegment));
+    if (t->workers == NULL || t->segments == NULL) {
+        perror("Error Allocating memory for trainer.\n");
+        free(t->workers);
+        free(t->segments);
+        free(t);
+        return NULL;
+    }
+
+    for (int i = 0; i < n->layer_count; i++) {
+        Layer* l = n->layers[i];
+        if (l->state != NULL) {
+            fprintf(stderr, "Error: layer %d (%s) keeps private state, not supported by the data parallel trainer\n",
+                    i + 1, l->name);
+            free(t->workers);
+            free(t->segments);
+            free(t);
+            return NULL;
+        }
+        Matrix* params[2] = {l->weights, l->bias};
+        for (int b = 0; b < 2; b++) {
+            if (params[b] == NULL) {
+                continue;
+            }
+            ParamSegment* s = &t->segments[t->segment_count++];
+            s->layer = i;
+            s->is_bias = b;
+            s->offset = t->param_count;
+            s->length = (long)params[b]->rows * params[b]->columns;
+            t->param_count += s->length;
+        }
+    }
+
+    t->workers[0].trainer = t;
+    t->workers[0].index = 0;
+    t->workers[0].layers = n->layers;
+    for (int r = 1; r < threads; r++) {
+        TrainerWorker* w = &t->workers[r];
+        w->trainer = t;
+        w->index = r;
+        w->layers = calloc(n->layer_count, sizeof(Layer*));
+        int ok = w->layers != NULL;
+        for (int i = 0; ok && i < n->layer_count; i++) {
+            w->layers[i] = layer_create_replica(n->layers[i]);
+            ok = w->layers[i] != NULL;
+        }
+        if (!ok) {
+            _free_replicas(t, 1, r + 1);
+            free(t->workers);
+            free(t->segments);
+            free(t);
+            return NULL;
+        }
+    }
+
+    _barrier_init(&t->barrier, threads);
+    for (int r = 1; r < threads; r++) {
+        if (pthread_create(&t->workers[r].thread, NULL, _worker_main,
+                           &t->workers[r]) != 0) {
+            perror("Error starting trainer thread.\n");
+            // Shrink to the threads that did start
+            pthread_mutex_lock(&t->barrier.lock);
+            t->thread_count = r;
+            t->barrier.count = r;
+            pthread_mutex_unlock(&t->barrier.lock);
+            _free_replicas(t, r, threads);
+            break;
+        }
+    }
+    return t;
+}
+
+void free_data_parallel_trainer(DataParallelTrainer* t) {
+    if (t == NULL) return;
+
+    t->stop = 1;
+    _barrier_wait(&t->barrier);
+    for (int r = 1; r < t->thread_count; r++) {
+        pthread_join(t->workers[r].thread, NULL);
+    }
+    _barrier_destroy(&t->barrier);
+
+    _free_replicas(t, 1, t->thread_count);
+    free(t->workers);
+    free(t->segments);
+    free(t->shard_grads);
+    free(t);
+}
+
+float train_data_parallel(DataParallelTrainer* t, Matrix* inputs,
+                          Matrix* targets, float learning_rate) {
+    if (t == NULL || inputs == NULL || targets == NULL) return 0.0f;
+    if (inputs->columns != targets->columns) {
+        fprintf(stderr, "Error: %d input columns but %d target columns\n",
+                inputs->columns, targets->columns);
+        return 0.0f;
+    }
+
+    t->deterministic = scheduler_deterministic();
+    if (t->deterministic && t->shard_grads == NULL) {
+        t->shard_grads = malloc(sizeof(float) * TRAINER_DETERMINISTIC_SHARDS *
+                                t->param_count);
+        if (t->shard_grads == NULL) {
+            perror("Error Allocating memory for deterministic shards.\n");
+            return 0.0f;
+        }
+    }
+
+    t->inputs = inputs;
+    t->targets = targets;
+    t->learning_rate = learning_rate;
+
+    // The caller's thread is worker 0
+    int was_inline = scheduler_run_inline(t->thread_count > 1);
+    _barrier_wait(&t->barrier);
+    _worker_step(&t->workers[0]);
+    scheduler_run_inline(was_inline);
+
+    float loss = 0.0f;
+    if (t->deterministic) {
+        for (int width = 1; width < TRAINER_DETERMINISTIC_SHARDS; width *= 2) {
+            for (int k = 0; k + width < TRAINER_DETERMINISTIC_SHARDS;
+                 k += 2 * width) {
+                t->shard_loss[k] += t->shard_loss[k + width];
+            }
+        }
+        loss = t->shard_loss[0];
+    } else {
+        for (int r = 0; r < t->thread_count; r++) {
+            loss += t->workers[r].loss;
+        }
+    }
+    t->inputs = NULL;
+    t->targets = NULL;
+    return loss;
+}
+
+// Relaxed atomic access to plain floats. The generic builtins accept any
+// 4-byte type, so the weights stay ordinary Matrix data.
+static inline float _load_relaxed(const float* p) {
+    float v;
+    __atomic_load(p, &v, __ATOMIC_RELAXED);
+    return v;
+}
+
+static inline void _store_relaxed(float* p, float v) {
+    __atomic_store(p, &v, __ATOMIC_RELAXED);
+}
+
+typedef struct {
+    Network* network;
+    Matrix* inputs;
+    Matrix* targets;
+    int batch_size;
+    float learning_rate;
+    int threads;
+    int next_column;    // claimed with an atomic fetch-add
+} HogwildRun;
+
+typedef struct {
+    HogwildRun* run;
+    Layer** layers;     // replicas with private weight snapshots
+    float loss;
+    pthread_t thread;
+} HogwildWorker;
+
+static void _hogwild_snapshot(Matrix* dst, Matrix* shared) {
+    int count = shared->rows * shared->columns;
+    for (int i = 0; i < count; i++) {
+        dst->data[i] = _load_relaxed(&shared->data[i]);
+    }
+}
+
+static void _hogwild_apply(Matrix* shared, Matrix* grad, float learning_rate) {
+    int count = shared->rows * shared->columns;
+    for (int i = 0; i < count; i++) {
+        // Zero gradients (inputs that were 0) are never written, which keeps
+        // sparse models from contending on the same cache lines
+        if (grad->data[i] == 0.0f) {
+            continue;
+        }
+        float w = _load_relaxed(&shared->data[i]);
+        _store_relaxed(&shared->data[i], w - learning_rate * grad->data[i]);
+    }
+}
+
+static void* _hogwild_main(void* arg) {
+    HogwildWorker* w = (HogwildWorker*)arg;
+    HogwildRun* run = w->run;
+    Network* n = run->network;
+    int columns = run->inputs->columns;
+    // With several Hogwild threads each one already has a core
+    int was_inline = scheduler_run_inline(run->threads > 1);
+
+    w->loss = 0.0f;
+    for (;;) {
+        int first = __atomic_fetch_add(&run->next_column, run->batch_size,
+                                       __ATOMIC_RELAXED);
+        if (first >= columns) {
+            break;
+        }
+        int count = columns - first < run->batch_size ? columns - first
+                                                      : run->batch_size;
+
+        for (int i = 0; i < n->layer_count; i++) {
+            if (w->layers[i]->weights != NULL) {
+                _hogwild_snapshot(w->layers[i]->weights, n->layers[i]->weights);
+            }
+            if (w->layers[i]->bias != NULL) {
+                _hogwild_snapshot(w->layers[i]->bias, n->layers[i]->bias);
+            }
+        }
+
+        Matrix* out = _copy_columns(run->inputs, first, count);
+        for (int i = 0; i < n->layer_count && out != NULL; i++) {
+            Matrix* next = layer_forward(w->layers[i], out);
+            free_matrix(out);
+            out = next;
+        }
+        Matrix* target = _copy_columns(run->targets, first, count);
+        Matrix* gradient = (out != NULL && target != NULL)
+                               ? subtract_matrix(out, target)
+                               : NULL;
+        free_matrix(out);
+        free_matrix(target);
+        if (gradient == NULL) {
+            break;
+        }
+        for (int i = 0; i < gradient->rows * gradient->columns; i++) {
+            w->loss += gradient->data[i] * gradient->data[i];
+        }
+
+        for (int i = n->layer_count - 1; i >= 0 && gradient != NULL; i--) {
+            Matrix* next = layer_backward(w->layers[i], gradient, 0.0f);
+            free_matrix(gradient);
+            gradient = next;
+        }
+        free_matrix(gradient);
+
+        for (int i = 0; i < n->layer_count; i++) {
+            Layer* l = w->layers[i];
+            if (l->weights != NULL && l->d_weight != NULL) {
+                _hogwild_apply(n->layers[i]->weights, l->d_weight,
+                               run->learning_rate);
+            }
+            if (l->bias != NULL && l->d_bias != NULL) {
+                _hogwild_apply(n->layers[i]->bias, l->d_bias,
+                               run->learning_rate);
+            }
+        }
+    }
+    scheduler_run_inline(was_inline);
+    return NULL;
+}
+
+static void _hogwild_free_layers(Layer** layers, int count) {
+    if (layers == NULL) return;
+    for (int i = 0; i < count; i++) {
+        if (layers[i] == NULL) {
+            continue;
+        }
+        // The snapshots are private to the replica
+        free_matrix(layers[i]->weights);
+        free_matrix(layers[i]->bias);
+        layer_free_replica(layers[i]);
+    }
+    free(layers);
+}
+
+static Layer** _hogwild_create_layers(Network* n) {
+    Layer** layers = calloc(n->layer_count, sizeof(Layer*));
+    if (layers == NULL) {
+        perror("Error Allocating memory for hogwild replicas.\n");
+        return NULL;
+    }
+    for (int i = 0; i < n->layer_count; i++) {
+        Layer* r = layer_create_replica(n->layers[i]);
+        if (r == NULL) {
+            _hogwild_free_layers(layers, n->layer_count);
+            return NULL;
+        }
+        layers[i] = r;
+        Matrix* w = n->layers[i]->weights;
+        Matrix* b = n->layers[i]->bias;
+        r->weights = w != NULL ? create_matrix(w->rows, w->columns) : NULL;
+        r->bias = b != NULL ? create_matrix(b->rows, b->columns) : NULL;
+        if ((w != NULL && r->weights == NULL) || (b != NULL && r->bias == NULL)) {
+            _hogwild_free_layers(layers, n->layer_count);
+            return NULL;
+        }
+    }
+    return layers;
+}
+
+float train_hogwild(Network* n, Matrix* inputs, Matrix* targets, int threads,
+                    int batch_size, float learning_rate) {
+    if (n == NULL || inputs == NULL || targets == NULL || threads < 1 ||
+        batch_size < 1) {
+        fprintf(stderr, "Error: invalid arguments to train_hogwild\n");
+        return 0.0f;
+    }
+    if (inputs->columns != targets->columns) {
+        fprintf(stderr, "Error: %d input columns but %d target columns\n",
+                inputs->columns, targets->columns);
+        return 0.0f;
+    }
+
+    // Racing updates can't be reproduced. Deterministic mode applies the
+    // mini-batches in column order on the calling thread instead.
+    if (scheduler_deterministic()) {
+        threads = 1;
+    }
+
+    HogwildRun run = {n, inputs, targets, batch_size, learning_rate, threads, 0};
+    HogwildWorker* workers = calloc(threads, sizeof(HogwildWorker));
+    if (workers == NULL) {
+        perror("Error Allocating memory for hogwild workers.\n");
+        return 0.0f;
+    }
+
+    int started = 0;
+    for (int r = 0; r < threads; r++) {
+        workers[r].run = &run;
+        workers[r].layers = _hogwild_create_layers(n);
+        if (workers[r].layers == NULL) {
+            break;
+        }
+        // The caller's thread is worker 0 and runs after the others start
+        if (r > 0 && pthread_create(&workers[r].thread, NULL, _hogwild_main,
+                                    &workers[r]) != 0) {
+            perror("Error starting hogwild thread.\n");
+            _hogwild_free_layers(workers[r].layers, n->layer_count);
+            workers[r].layers = NULL;
+            break;
+        }
+        started = r + 1;
+    }
+
+    float loss = 0.0f;
+    if (started > 0) {
+        _hogwild_main(&workers[0]);
+        for (int r = 1; r < started; r++) {
+            pthread_join(workers[r].thread, NULL);
+        }
+        for (int r = 0; r < started; r++) {
+            loss += workers[r].loss;
+        }
+    }
+
+    for (int r = 0; r < started; r++) {
+        _hogwild_free_layers(workers[r].layers, n->layer_count);
+    }
+    free(workers);
+    return loss;
+}